@@ -0,0 +1,70 @@
+/* binfmt-detector.h - interface for in-process detector plugins
+ *
+ * Copyright (c) 2026 agent <agent@local>.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/* A format's detector may be given as "plugin:/path/to/detector.so"
+ * instead of the path to a program.  run-detectors then loads the shared
+ * object and calls it directly rather than running a separate process.
+ *
+ * A plugin must define:
+ *
+ *   const int binfmt_detector_abi = BINFMT_DETECTOR_ABI;
+ *
+ *   int binfmt_detect (const char *path, int fd,
+ *			const unsigned char *header, size_t header_size);
+ *
+ * path is the file being executed, and fd is open on it for reading.  The
+ * plugin must not close fd or rely on its file offset; use pread.  header
+ * holds the first header_size bytes of the file (fewer if the file is
+ * shorter than that).  binfmt_detect should return BINFMT_DETECT_MATCH if
+ * the file is appropriate for this format's interpreter, or
+ * BINFMT_DETECT_NO_MATCH otherwise; any other value is treated as no
+ * match.
+ *
+ * Plugins run inside run-detectors, or inside detectord on its behalf, so
+ * they must not exit, change the process state, or leave threads running.
+ * They may be called several times in one process.  Their verdicts may be
+ * cached, so they must not depend on environment variables.
+ */
+
+#ifndef BINFMT_DETECTOR_H
+#define BINFMT_DETECTOR_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define BINFMT_DETECTOR_ABI 1
+
+#define BINFMT_DETECT_NO_MATCH 0
+#define BINFMT_DETECT_MATCH 1
+
+typedef int binfmt_detect_fn (const char *path, int fd,
+			      const unsigned char *header,
+			      size_t header_size);
+
+extern const int binfmt_detector_abi;
+binfmt_detect_fn binfmt_detect;
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BINFMT_DETECTOR_H */
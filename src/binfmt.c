@@ -0,0 +1,237 @@
+/* binfmt.c - look up binary format interpreters from other programs
+ *
+ * Copyright (c) 2026 agent <agent@local>.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/* The rest of the code finds its directories in the globals from paths.c,
+ * which belong to whichever program it is part of.  A context instead
+ * reads everything it needs from its own directories up front, so that
+ * lookups touch nothing but the files being looked up.
+ *
+ * The rest of the code also reports problems through error.c, and gives up
+ * with quit (or xalloc_die) when it cannot go on.  Each entry point here
+ * installs an error handler for the calling thread while it runs, so that
+ * messages go to the context's handler and giving up comes back here.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "gl_xlist.h"
+#include "xalloc.h"
+
+#include "binfmt.h"
+#include "consolidate.h"
+#include "error.h"
+#include "find.h"
+#include "format.h"
+#include "kvhash.h"
+
+struct binfmt_context {
+    gl_list_t formats;
+    struct finder *finder;
+    binfmt_error_handler *handler;
+    void *data;
+};
+
+static void report_stderr (const char *message, void *data)
+{
+    (void) data;
+    fprintf (stderr, "libbinfmt: %s\n", message);
+}
+
+/* Create a context, or return NULL and set *error (if error is not NULL)
+ * if the format database cannot be read.
+ */
+struct binfmt_context *binfmt_context_new (const char *admindir,
+					   const char *procdir,
+					   const char *rundir, int *error)
+{
+    struct error_handler handler, *previous;
+    struct binfmt_context *context;
+    gl_list_t formats;
+    gl_list_iterator_t format_iter;
+    const struct binfmt *binfmt;
+    Hash_table *entries, *map, *enabled;
+
+    handler.report = report_stderr;
+    handler.data = NULL;
+    previous = error_set_handler (&handler);
+    if (setjmp (handler.recover)) {
+	error_set_handler (previous);
+	if (error)
+	    *error = BINFMT_ERR_NOMEM;
+	return NULL;
+    }
+
+    formats = scan_formats (admindir ? admindir : ADMINDIR, 0, 1);
+    if (!formats) {
+	error_set_handler (previous);
+	if (error)
+	    *error = BINFMT_ERR_DATABASE;
+	return NULL;
+    }
+
+    entries = kernel_entries_load_from (procdir ? procdir : PROCDIR);
+    map = consolidated_load_from (rundir ? rundir : RUNDIR);
+    enabled = kvhash_initialize (gl_list_size (formats), NULL,
+				  kvhash_free_key);
+    format_iter = gl_list_iterator (formats);
+    while (gl_list_iterator_next (&format_iter, (const void **) &binfmt,
+				  NULL))
+	if (format_enabled_in (binfmt->name, entries, map))
+	    kvhash_insert (enabled, binfmt->name, NULL);
+    gl_list_iterator_free (&format_iter);
+    hash_free (map);
+    hash_free (entries);
+
+    context = xzalloc (sizeof *context);
+    context->formats = formats;
+    context->finder = finder_new_enabled (formats, enabled);
+    context->handler = report_stderr;
+    error_set_handler (previous);
+    if (error)
+	*error = BINFMT_OK;
+    return context;
+}
+
+void binfmt_context_free (struct binfmt_context *context)
+{
+    gl_list_iterator_t format_iter;
+    struct binfmt *binfmt;
+
+    if (!context)
+	return;
+    format_iter = gl_list_iterator (context->formats);
+    while (gl_list_iterator_next (&format_iter, (const void **) &binfmt,
+				  NULL))
+	binfmt_free (binfmt);
+    gl_list_iterator_free (&format_iter);
+    /* This frees the list itself. */
+    finder_free (context->finder);
+    free (context);
+}
+
+void binfmt_context_set_error_handler (struct binfmt_context *context,
+				       binfmt_error_handler *handler,
+				       void *data)
+{
+    context->handler = handler;
+    context->data = data;
+}
+
+/* Fill in result for path, returning result->error. */
+int binfmt_find (struct binfmt_context *context, const char *path, int fd,
+		 struct binfmt_result *result)
+{
+    struct error_handler handler, *previous;
+    gl_list_t interpreters;
+    gl_list_iterator_t interpreter_iter;
+    const struct binfmt *binfmt;
+    /* Changed after setjmp, so it must not be kept in a register. */
+    volatile int our_fd = -1;
+    size_t i = 0;
+
+    result->error = BINFMT_OK;
+    result->errnum = 0;
+    result->count = 0;
+    result->interpreters = NULL;
+    if (!context || !path) {
+	result->error = BINFMT_ERR_INVALID;
+	return result->error;
+    }
+    if (fd < 0) {
+	fd = our_fd = open (path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+	    result->error = BINFMT_ERR_OPEN;
+	    result->errnum = errno;
+	    return result->error;
+	}
+    }
+
+    handler.report = context->handler;
+    handler.data = context->data;
+    previous = error_set_handler (&handler);
+    if (setjmp (handler.recover)) {
+	error_set_handler (previous);
+	if (our_fd >= 0)
+	    close (our_fd);
+	binfmt_result_clear (result);
+	result->error = BINFMT_ERR_NOMEM;
+	return result->error;
+    }
+
+    interpreters = finder_find (context->finder, path, fd, 0);
+    if (our_fd >= 0)
+	close (our_fd);
+    our_fd = -1;
+
+    result->count = gl_list_size (interpreters);
+    result->interpreters = xcalloc (result->count + 1,
+				    sizeof *result->interpreters);
+    interpreter_iter = gl_list_iterator (interpreters);
+    while (gl_list_iterator_next (&interpreter_iter, (const void **) &binfmt,
+				  NULL))
+	result->interpreters[i++] = binfmt->interpreter;
+    gl_list_iterator_free (&interpreter_iter);
+    gl_list_free (interpreters);
+    error_set_handler (previous);
+    return BINFMT_OK;
+}
+
+/* Fill in results[i] for each of paths[i].  Returns BINFMT_OK if every
+ * path could be looked up, or else the first error; the results say which
+ * paths failed.
+ */
+int binfmt_find_many (struct binfmt_context *context,
+		      const char *const *paths, size_t count,
+		      struct binfmt_result *results)
+{
+    int ret = BINFMT_OK;
+    size_t i;
+
+    for (i = 0; i < count; ++i)
+	if (binfmt_find (context, paths[i], -1, &results[i]) && !ret)
+	    ret = results[i].error;
+    return ret;
+}
+
+void binfmt_result_clear (struct binfmt_result *result)
+{
+    free (result->interpreters);
+    result->interpreters = NULL;
+    result->count = 0;
+}
+
+const char *binfmt_strerror (int error)
+{
+    switch (error) {
+	case BINFMT_OK:			return "success";
+	case BINFMT_ERR_INVALID:	return "invalid argument";
+	case BINFMT_ERR_DATABASE:	return "unable to read format database";
+	case BINFMT_ERR_OPEN:		return "unable to open file";
+	case BINFMT_ERR_NOMEM:		return "out of memory";
+	default:			return "unknown error";
+    }
+}
@@ -0,0 +1,98 @@
+/* binfmt.h - look up binary format interpreters from other programs
+ *
+ * Copyright (c) 2026 agent <agent@local>.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/* libbinfmt answers the question "update-binfmts --find" answers, without
+ * running a separate process for each file.
+ *
+ * A context holds the format database and the set of formats enabled in
+ * the kernel, as they were when binfmt_context_new was called; make a new
+ * context to see later changes.  Any number of threads may call
+ * binfmt_find and binfmt_find_many on the same context at once.  Errors,
+ * including running out of memory, are returned rather than ending the
+ * process.  Problems that do not stop a lookup (such as a detector that
+ * cannot be run) are passed to the context's error handler, which by
+ * default prints them on standard error.
+ *
+ * Link with the flags from "pkg-config --libs libbinfmt".
+ */
+
+#ifndef BINFMT_H
+#define BINFMT_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define BINFMT_OK		0
+#define BINFMT_ERR_INVALID	1	/* bad arguments */
+#define BINFMT_ERR_DATABASE	2	/* the format database is unreadable */
+#define BINFMT_ERR_OPEN		3	/* the file could not be opened */
+/* Out of memory, or some other failure that was passed to the error
+ * handler.  Memory and file descriptors that the failed call was using may
+ * not have been freed.
+ */
+#define BINFMT_ERR_NOMEM	4
+
+struct binfmt_context;
+
+/* Called with each message, which has no trailing newline. */
+typedef void binfmt_error_handler (const char *message, void *data);
+
+struct binfmt_result {
+    int error;			/* BINFMT_OK, or why the file was skipped */
+    int errnum;			/* the errno value, for BINFMT_ERR_OPEN */
+    size_t count;
+    /* The interpreters to try, in order.  The strings belong to the
+     * context; the array belongs to the result.
+     */
+    const char **interpreters;
+};
+
+/* NULL for any directory means the one update-binfmts uses by default. */
+struct binfmt_context *binfmt_context_new (const char *admindir,
+					   const char *procdir,
+					   const char *rundir, int *error);
+void binfmt_context_free (struct binfmt_context *context);
+
+/* handler may be NULL to discard messages.  Set this before the context is
+ * used by more than one thread.
+ */
+void binfmt_context_set_error_handler (struct binfmt_context *context,
+				       binfmt_error_handler *handler,
+				       void *data);
+
+/* If fd is non-negative, it is open on path and is used instead of
+ * opening path again.
+ */
+int binfmt_find (struct binfmt_context *context, const char *path, int fd,
+		 struct binfmt_result *result);
+int binfmt_find_many (struct binfmt_context *context,
+		      const char *const *paths, size_t count,
+		      struct binfmt_result *results);
+void binfmt_result_clear (struct binfmt_result *result);
+
+const char *binfmt_strerror (int error);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BINFMT_H */
@@ -0,0 +1,427 @@
+/* builtin.c - built-in detectors
+ *
+ * Copyright (c) 2026 agent <agent@local>.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/* Detectors for formats common enough to be worth building in, selected
+ * with a detector of the form "builtin:<name>" or "builtin:<name>:<args>".
+ * They read only the bytes they need and allocate nothing.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <elf.h>
+
+#include "builtin.h"
+#include "readat.h"
+
+static uint16_t get_le16 (const unsigned char *p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+static uint32_t get_le32 (const unsigned char *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+static uint16_t get_be16 (const unsigned char *p)
+{
+    return (p[0] << 8) | p[1];
+}
+
+static uint32_t get_be32 (const unsigned char *p)
+{
+    return ((uint32_t) p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+/* Layout of a PE image, as far as we need it.  The NT headers start at
+ * the offset stored at 0x3c in the DOS header, with the COFF file header
+ * and then the optional header, whose data directories are at a
+ * different offset in PE32 and PE32+ images.  Directory 14 describes the
+ * CLR runtime header of a managed assembly.
+ */
+#define PE_LFANEW_OFFSET	0x3c
+#define PE_OPTIONAL_SIZE	20	/* SizeOfOptionalHeader, in NT headers */
+#define PE_OPTIONAL		24
+#define PE32_MAGIC		0x10b
+#define PE32_PLUS_MAGIC		0x20b
+#define PE32_RVA_COUNT		92	/* in optional header */
+#define PE32_PLUS_RVA_COUNT	108
+#define PE32_DIRECTORIES	96
+#define PE32_PLUS_DIRECTORIES	112
+#define PE_DIRECTORY_CLR	14
+#define PE_NT_HEADERS_SIZE \
+    (PE_OPTIONAL + PE32_PLUS_DIRECTORIES + (PE_DIRECTORY_CLR + 1) * 8)
+
+enum pe_kind {
+    PE_NONE,	/* not a PE image at all */
+    PE_NATIVE,
+    PE_CLR
+};
+
+static enum pe_kind pe_classify (const struct builtin_target *target)
+{
+    int fd = target->fd;
+    const unsigned char *header = target->header;
+    size_t header_size = target->header_size;
+    unsigned char dos[PE_LFANEW_OFFSET + 4];
+    unsigned char nt[PE_NT_HEADERS_SIZE];
+    const unsigned char *optional = nt + PE_OPTIONAL;
+    uint64_t nt_offset;
+    uint16_t optional_size;
+    uint32_t rva_count, directories;
+    const unsigned char *clr;
+
+    if (!read_at (fd, header, header_size, 0, dos, sizeof dos) ||
+	dos[0] != 'M' || dos[1] != 'Z')
+	return PE_NONE;
+    nt_offset = get_le32 (dos + PE_LFANEW_OFFSET);
+    /* Only read as much of the optional header as this kind of image
+     * needs, since small images may end soon after it.
+     */
+    if (!read_at (fd, header, header_size, nt_offset, nt, PE_OPTIONAL + 2) ||
+	memcmp (nt, "PE\0\0", 4))
+	return PE_NONE;
+
+    optional_size = get_le16 (nt + PE_OPTIONAL_SIZE);
+    switch (get_le16 (optional)) {
+	case PE32_MAGIC:
+	    rva_count = PE32_RVA_COUNT;
+	    directories = PE32_DIRECTORIES;
+	    break;
+	case PE32_PLUS_MAGIC:
+	    rva_count = PE32_PLUS_RVA_COUNT;
+	    directories = PE32_PLUS_DIRECTORIES;
+	    break;
+	default:
+	    return PE_NATIVE;
+    }
+    if (optional_size < directories + (PE_DIRECTORY_CLR + 1) * 8)
+	return PE_NATIVE;
+    if (!read_at (fd, header, header_size, nt_offset + PE_OPTIONAL,
+		  nt + PE_OPTIONAL, directories + (PE_DIRECTORY_CLR + 1) * 8))
+	return PE_NATIVE;
+    if (get_le32 (optional + rva_count) <= PE_DIRECTORY_CLR)
+	return PE_NATIVE;
+    clr = optional + directories + PE_DIRECTORY_CLR * 8;
+    return (get_le32 (clr) && get_le32 (clr + 4)) ? PE_CLR : PE_NATIVE;
+}
+
+/* Managed CLI assemblies, for Mono and similar. */
+static int detect_cli (const struct builtin_args *args,
+		       struct builtin_target *target)
+{
+    (void) args;
+    return pe_classify (target) == PE_CLR;
+}
+
+/* Native Win32 images, for Wine. */
+static int detect_win32 (const struct builtin_args *args,
+			 struct builtin_target *target)
+{
+    (void) args;
+    return pe_classify (target) == PE_NATIVE;
+}
+
+static int elf_parse (struct builtin_target *target)
+{
+    unsigned char ehdr[sizeof (Elf64_Ehdr)];
+    size_t size;
+    int msb;
+
+    if (target->elf_parsed)
+	return target->elf_parsed > 0;
+    target->elf_parsed = -1;
+
+    if (!read_at (target->fd, target->header, target->header_size,
+		  0, ehdr, EI_NIDENT) ||
+	memcmp (ehdr, ELFMAG, SELFMAG))
+	return 0;
+    if (ehdr[EI_CLASS] == ELFCLASS32)
+	size = sizeof (Elf32_Ehdr);
+    else if (ehdr[EI_CLASS] == ELFCLASS64)
+	size = sizeof (Elf64_Ehdr);
+    else
+	return 0;
+    if (ehdr[EI_DATA] != ELFDATA2LSB && ehdr[EI_DATA] != ELFDATA2MSB)
+	return 0;
+    if (!read_at (target->fd, target->header, target->header_size,
+		  0, ehdr, size))
+	return 0;
+
+    /* e_machine is at the same offset in both classes; e_flags is not. */
+    msb = ehdr[EI_DATA] == ELFDATA2MSB;
+    target->elf.class = ehdr[EI_CLASS];
+    target->elf.data = ehdr[EI_DATA];
+    target->elf.osabi = ehdr[EI_OSABI];
+    target->elf.machine =
+	msb ? get_be16 (ehdr + offsetof (Elf32_Ehdr, e_machine))
+	    : get_le16 (ehdr + offsetof (Elf32_Ehdr, e_machine));
+    if (ehdr[EI_CLASS] == ELFCLASS32)
+	target->elf.flags =
+	    msb ? get_be32 (ehdr + offsetof (Elf32_Ehdr, e_flags))
+		: get_le32 (ehdr + offsetof (Elf32_Ehdr, e_flags));
+    else
+	target->elf.flags =
+	    msb ? get_be32 (ehdr + offsetof (Elf64_Ehdr, e_flags))
+		: get_le32 (ehdr + offsetof (Elf64_Ehdr, e_flags));
+    target->elf_parsed = 1;
+    return 1;
+}
+
+/* Return the length of the current comma-separated argument value. */
+static size_t value_length (const char *value)
+{
+    return strcspn (value, ",");
+}
+
+static int parse_number (const char *value, const char *terminators,
+			 unsigned long max, unsigned long *number)
+{
+    char *end;
+
+    if (*value < '0' || *value > '9')
+	return 0;
+    *number = strtoul (value, &end, 0);
+    return *number <= max && strchr (terminators, *end);
+}
+
+/* Parse what an ELF detector accepts, from arguments such as
+ * "class=32,data=lsb,machine=40,flags=0x400/0x400,osabi=0".  Fields that
+ * are not given match anything.
+ */
+static int parse_elf (const char *args, struct builtin_args *parsed,
+		      const char **message)
+{
+    const char *p = args;
+    unsigned long number;
+
+    parsed->elf.class = parsed->elf.data = -1;
+    parsed->elf.machine = parsed->elf.osabi = -1;
+    parsed->elf.flags = parsed->elf.flags_mask = 0;
+    while (p && *p) {
+	const char *value = strchr (p, '=');
+	size_t key_length;
+
+	if (!value || value > p + value_length (p)) {
+	    *message = "ELF detector arguments must be key=value";
+	    return 0;
+	}
+	key_length = value - p;
+	++value;
+
+#define KEY_IS(key) \
+    (key_length == strlen (key) && !strncmp (p, key, key_length))
+#define VALUE_IS(word) \
+    (value_length (value) == strlen (word) && \
+     !strncmp (value, word, value_length (value)))
+
+	if (KEY_IS ("class")) {
+	    if (VALUE_IS ("32"))
+		parsed->elf.class = ELFCLASS32;
+	    else if (VALUE_IS ("64"))
+		parsed->elf.class = ELFCLASS64;
+	    else {
+		*message = "ELF class must be 32 or 64";
+		return 0;
+	    }
+	} else if (KEY_IS ("data")) {
+	    if (VALUE_IS ("lsb"))
+		parsed->elf.data = ELFDATA2LSB;
+	    else if (VALUE_IS ("msb"))
+		parsed->elf.data = ELFDATA2MSB;
+	    else {
+		*message = "ELF data encoding must be lsb or msb";
+		return 0;
+	    }
+	} else if (KEY_IS ("machine")) {
+	    if (!parse_number (value, ",", 0xffff, &number)) {
+		*message = "ELF machine must be a number";
+		return 0;
+	    }
+	    parsed->elf.machine = number;
+	} else if (KEY_IS ("osabi")) {
+	    if (!parse_number (value, ",", 0xff, &number)) {
+		*message = "ELF OS ABI must be a number";
+		return 0;
+	    }
+	    parsed->elf.osabi = number;
+	} else if (KEY_IS ("flags")) {
+	    const char *slash = strchr (value, '/');
+
+	    if (!parse_number (value, ",/", 0xffffffff, &number)) {
+		*message = "ELF flags must be a number, optionally with /mask";
+		return 0;
+	    }
+	    parsed->elf.flags = number;
+	    parsed->elf.flags_mask = 0xffffffff;
+	    if (slash && slash < value + value_length (value)) {
+		if (!parse_number (slash + 1, ",", 0xffffffff, &number)) {
+		    *message = "ELF flags mask must be a number";
+		    return 0;
+		}
+		parsed->elf.flags_mask = number;
+	    }
+	} else {
+	    *message = "unknown ELF detector argument";
+	    return 0;
+	}
+
+#undef VALUE_IS
+#undef KEY_IS
+
+	p = value + value_length (value);
+	if (*p == ',')
+	    ++p;
+    }
+    return 1;
+}
+
+/* ELF images for a particular ABI, typically for qemu-user when several
+ * ABIs share a machine type.
+ */
+static int detect_elf (const struct builtin_args *args,
+		       struct builtin_target *target)
+{
+    if (!elf_parse (target))
+	return 0;
+    return (args->elf.class < 0 || args->elf.class == target->elf.class) &&
+	   (args->elf.data < 0 || args->elf.data == target->elf.data) &&
+	   (args->elf.machine < 0 ||
+	    args->elf.machine == target->elf.machine) &&
+	   (args->elf.osabi < 0 || args->elf.osabi == target->elf.osabi) &&
+	   (target->elf.flags & args->elf.flags_mask) ==
+		(args->elf.flags & args->elf.flags_mask);
+}
+
+static const struct builtin {
+    const char *name;
+    /* NULL if the detector takes no arguments. */
+    int (*parse) (const char *args, struct builtin_args *parsed,
+		  const char **message);
+    int (*detect) (const struct builtin_args *args,
+		   struct builtin_target *target);
+} builtins[] = {
+    { "cli",	NULL,		detect_cli },
+    { "win32",	NULL,		detect_win32 },
+    { "elf",	parse_elf,	detect_elf }
+};
+
+/* Find the built-in detector named by builtin, setting *args to its
+ * arguments (NULL if there are none).
+ */
+static const struct builtin *builtin_lookup (const char *builtin,
+					     const char **args)
+{
+    size_t length = strcspn (builtin, ":");
+    size_t i;
+
+    *args = builtin[length] ? builtin + length + 1 : NULL;
+    for (i = 0; i < sizeof builtins / sizeof *builtins; ++i)
+	if (strlen (builtins[i].name) == length &&
+	    !strncmp (builtins[i].name, builtin, length))
+	    return &builtins[i];
+    return NULL;
+}
+
+void builtin_target_init (struct builtin_target *target, int fd,
+			  const unsigned char *header, size_t header_size)
+{
+    memset (target, 0, sizeof *target);
+    target->fd = fd;
+    target->header = header;
+    target->header_size = header_size;
+}
+
+/* If detector names a built-in detector, return its name and arguments;
+ * otherwise return NULL.
+ */
+const char *builtin_name (const char *detector)
+{
+    if (strncmp (detector, BUILTIN_PREFIX, strlen (BUILTIN_PREFIX)))
+	return NULL;
+    return detector + strlen (BUILTIN_PREFIX);
+}
+
+static int parse_args (const char *builtin, struct builtin_args *parsed,
+		       const char **message)
+{
+    const char *args;
+    const struct builtin *entry = builtin_lookup (builtin, &args);
+
+    memset (parsed, 0, sizeof *parsed);
+    if (!entry) {
+	*message = "unknown built-in detector";
+	return 0;
+    }
+    if (!entry->parse) {
+	if (args) {
+	    *message = "built-in detector takes no arguments";
+	    return 0;
+	}
+    } else if (!entry->parse (args, parsed, message))
+	return 0;
+    parsed->valid = 1;
+    return 1;
+}
+
+/* Check that builtin names a built-in detector with valid arguments.  If
+ * not, return zero and set *message to a description of the problem.
+ */
+int builtin_valid (const char *builtin, const char **message)
+{
+    struct builtin_args parsed;
+
+    return parse_args (builtin, &parsed, message);
+}
+
+/* Parse the arguments of a built-in detector ahead of time, for
+ * builtin_detect.
+ */
+void builtin_parse (const char *builtin, struct builtin_args *parsed)
+{
+    const char *message;
+
+    parse_args (builtin, parsed, &message);
+}
+
+/* Run a built-in detector.  Returns non-zero if it accepts the file.
+ * parsed is its arguments from builtin_parse, or NULL to parse them now.
+ * Unknown detectors, and those with invalid arguments, never accept
+ * anything.
+ */
+int builtin_detect (const char *builtin, const struct builtin_args *parsed,
+		    struct builtin_target *target)
+{
+    const char *args;
+    const struct builtin *entry = builtin_lookup (builtin, &args);
+    struct builtin_args local;
+
+    if (!parsed) {
+	builtin_parse (builtin, &local);
+	parsed = &local;
+    }
+    if (!entry || !parsed->valid)
+	return 0;
+    return entry->detect (parsed, target);
+}
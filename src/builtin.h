@@ -0,0 +1,58 @@
+/* builtin.h - interface to built-in detectors
+ *
+ * Copyright (c) 2026 agent <agent@local>.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define BUILTIN_PREFIX "builtin:"
+
+/* A file being examined by built-in detectors.  Headers are parsed at most
+ * once, however many formats look at them.
+ */
+struct builtin_target {
+    int fd;
+    const unsigned char *header;
+    size_t header_size;
+    int elf_parsed;	/* 0 if not yet parsed, -1 if not ELF */
+    struct {
+	unsigned char class, data, osabi;
+	uint16_t machine;
+	uint32_t flags;
+    } elf;
+};
+
+/* A built-in detector's arguments, parsed once when the index is written
+ * rather than for each file.  This is kept in the index, so it must be
+ * plain data.
+ */
+struct builtin_args {
+    uint32_t valid;
+    struct {
+	int32_t class, data, machine, osabi;	/* -1 matches anything */
+	uint32_t flags, flags_mask;
+    } elf;
+};
+
+void builtin_target_init (struct builtin_target *target, int fd,
+			  const unsigned char *header, size_t header_size);
+const char *builtin_name (const char *detector);
+int builtin_valid (const char *builtin, const char **message);
+void builtin_parse (const char *builtin, struct builtin_args *parsed);
+int builtin_detect (const char *builtin, const struct builtin_args *parsed,
+		    struct builtin_target *target);
@@ -0,0 +1,272 @@
+/* cache.c - persistent cache of run-detectors verdicts
+ *
+ * Copyright (c) 2026 agent <agent@local>.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/* Which interpreters run-detectors picks for a file depends only on the
+ * file's contents and name and on the format database, so the answer can
+ * be remembered.  Each user has a cache file in rundir, mapped shared by
+ * every run-detectors process running as that user.  A verdict is keyed
+ * on the file's identity (device, inode, size, modification and change
+ * times), its extension, and the generation of the index it was computed
+ * from, and lists the interpreters as positions in that index.
+ *
+ * The cache is a fixed-size set-associative table, so it never grows;
+ * within a set, the least recently used entry is replaced.  Writers
+ * serialize on an fcntl lock, while readers take no locks at all: each
+ * entry has a sequence number that is odd while the entry is being
+ * written, and a reader discards anything it copied while the sequence
+ * number was odd or changed.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "xalloc.h"
+
+#include "cache.h"
+#include "paths.h"
+#include "runfile.h"
+
+#define CACHE_MAGIC "BFCACHE"
+#define CACHE_VERSION 1
+#define CACHE_SETS 512
+#define CACHE_WAYS 8
+
+struct cache_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t sets;
+    uint32_t ways;
+    uint32_t pad;
+    /* Incremented on every hit or store, to order entries by use. */
+    uint64_t clock;
+    char reserved[32];
+};
+
+struct cache_slot {
+    uint32_t seq;
+    uint32_t count;
+    uint64_t generation;
+    uint64_t dev;
+    uint64_t ino;
+    int64_t size;
+    int64_t mtime_sec, mtime_nsec;
+    int64_t ctime_sec, ctime_nsec;
+    uint64_t extension;
+    uint32_t flags;
+    uint32_t pad;
+    uint64_t last_used;
+    uint32_t formats[CACHE_MAX_FORMATS];
+};
+
+#define CACHE_SIZE (sizeof (struct cache_header) + \
+		    CACHE_SETS * CACHE_WAYS * sizeof (struct cache_slot))
+
+struct cache {
+    int fd;
+    struct cache_header *header;
+    struct cache_slot *slots;
+};
+
+static int header_ok (const void *map)
+{
+    const struct cache_header *header = map;
+
+    return header->version == CACHE_VERSION &&
+	   header->sets == CACHE_SETS && header->ways == CACHE_WAYS;
+}
+
+static void header_init (void *map)
+{
+    struct cache_header *header = map;
+
+    header->version = CACHE_VERSION;
+    header->sets = CACHE_SETS;
+    header->ways = CACHE_WAYS;
+}
+
+/* Anyone who can write to the cache can choose our interpreters, so
+ * runfile_open only accepts a cache that the user alone can write.
+ */
+static const struct runfile cache_file = {
+    "verdicts", CACHE_MAGIC, CACHE_SIZE, header_ok, header_init
+};
+
+/* Files with no extension and an empty extension differ. */
+static uint64_t hash_extension (const char *extension)
+{
+    return extension ? runfile_hash (extension) : 0;
+}
+
+static void key_slot (const struct cache_key *key, struct cache_slot *slot)
+{
+    memset (slot, 0, sizeof *slot);
+    slot->generation = key->generation;
+    slot->dev = key->st->st_dev;
+    slot->ino = key->st->st_ino;
+    slot->size = key->st->st_size;
+    slot->mtime_sec = key->st->st_mtim.tv_sec;
+    slot->mtime_nsec = key->st->st_mtim.tv_nsec;
+    slot->ctime_sec = key->st->st_ctim.tv_sec;
+    slot->ctime_nsec = key->st->st_ctim.tv_nsec;
+    slot->extension = hash_extension (key->extension);
+    slot->flags = key->flags;
+}
+
+static int key_equals (const struct cache_slot *a, const struct cache_slot *b)
+{
+    return a->generation == b->generation &&
+	   a->dev == b->dev && a->ino == b->ino && a->size == b->size &&
+	   a->mtime_sec == b->mtime_sec && a->mtime_nsec == b->mtime_nsec &&
+	   a->ctime_sec == b->ctime_sec && a->ctime_nsec == b->ctime_nsec &&
+	   a->extension == b->extension && a->flags == b->flags;
+}
+
+static struct cache_slot *key_set (struct cache *cache,
+				   const struct cache_slot *key)
+{
+    uint64_t hash = key->dev * 0x9e3779b97f4a7c15ULL;
+
+    hash ^= key->ino + 0x9e3779b97f4a7c15ULL + (hash << 6) + (hash >> 2);
+    hash ^= key->extension + (hash << 6) + (hash >> 2);
+    hash ^= hash >> 29;
+    return cache->slots + (hash % CACHE_SETS) * CACHE_WAYS;
+}
+
+/* Create rundir, which users share in the same way as /tmp.  This only
+ * works as root, and it is not an error if it fails.
+ */
+void cache_create_dir (void)
+{
+    if (mkdir (rundir, 01777) == 0)
+	chmod (rundir, 01777);
+}
+
+/* Open the current user's cache, creating it if necessary.  Returns NULL
+ * if there is no usable cache; callers should simply carry on without one.
+ */
+struct cache *cache_open (void)
+{
+    struct cache *cache;
+    struct cache_header *header;
+    int fd;
+
+    header = runfile_open (&cache_file, &fd);
+    if (!header)
+	return NULL;
+    cache = xmalloc (sizeof *cache);
+    cache->fd = fd;
+    cache->header = header;
+    cache->slots = (struct cache_slot *) (header + 1);
+    return cache;
+}
+
+static uint64_t tick (struct cache *cache)
+{
+    return __atomic_add_fetch (&cache->header->clock, 1, __ATOMIC_RELAXED);
+}
+
+/* Look up a verdict.  On a hit, copies the positions of its formats into
+ * formats (which must have room for CACHE_MAX_FORMATS), sets *count, and
+ * returns non-zero.
+ */
+int cache_lookup (struct cache *cache, const struct cache_key *key,
+		  uint32_t *formats, size_t *count)
+{
+    struct cache_slot want, copy, *set;
+    size_t i;
+
+    key_slot (key, &want);
+    set = key_set (cache, &want);
+    for (i = 0; i < CACHE_WAYS; ++i) {
+	struct cache_slot *slot = &set[i];
+	uint32_t seq;
+
+	seq = __atomic_load_n (&slot->seq, __ATOMIC_ACQUIRE);
+	if (seq & 1)
+	    continue;
+	memcpy (&copy, slot, sizeof copy);
+	__atomic_thread_fence (__ATOMIC_ACQUIRE);
+	if (__atomic_load_n (&slot->seq, __ATOMIC_RELAXED) != seq)
+	    continue;
+	if (!seq || !key_equals (&copy, &want) ||
+	    copy.count > CACHE_MAX_FORMATS)
+	    continue;
+
+	memcpy (formats, copy.formats, copy.count * sizeof *formats);
+	*count = copy.count;
+	/* Racing with a writer here only costs some LRU accuracy. */
+	__atomic_store_n (&slot->last_used, tick (cache), __ATOMIC_RELAXED);
+	return 1;
+    }
+    return 0;
+}
+
+/* Store a verdict, replacing the least recently used entry in its set.
+ * Verdicts with more than CACHE_MAX_FORMATS formats are not cached.
+ */
+void cache_store (struct cache *cache, const struct cache_key *key,
+		  const uint32_t *formats, size_t count)
+{
+    struct cache_slot want, *set, *victim = NULL;
+    size_t i;
+
+    if (count > CACHE_MAX_FORMATS)
+	return;
+    key_slot (key, &want);
+    set = key_set (cache, &want);
+
+    if (!runfile_lock (cache->fd, F_WRLCK))
+	return;
+    for (i = 0; i < CACHE_WAYS; ++i) {
+	if (set[i].seq && key_equals (&set[i], &want)) {
+	    /* Another process got here first. */
+	    victim = &set[i];
+	    break;
+	}
+	if (!victim || set[i].last_used < victim->last_used)
+	    victim = &set[i];
+    }
+
+    want.seq = victim->seq + 2;
+    want.count = count;
+    want.last_used = tick (cache);
+    memcpy (want.formats, formats, count * sizeof *formats);
+
+    __atomic_store_n (&victim->seq, victim->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence (__ATOMIC_RELEASE);
+    memcpy ((char *) victim + sizeof victim->seq,
+	    (char *) &want + sizeof want.seq,
+	    sizeof want - sizeof want.seq);
+    __atomic_store_n (&victim->seq, want.seq, __ATOMIC_RELEASE);
+
+    runfile_lock (cache->fd, F_UNLCK);
+}
+
+void cache_close (struct cache *cache)
+{
+    runfile_close (&cache_file, cache->header, cache->fd);
+    free (cache);
+}
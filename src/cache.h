@@ -0,0 +1,42 @@
+/* cache.h - persistent cache of run-detectors verdicts
+ *
+ * Copyright (c) 2026 agent <agent@local>.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/stat.h>
+
+/* The most formats that a single verdict can list. */
+#define CACHE_MAX_FORMATS 8
+
+struct cache;
+
+struct cache_key {
+    const struct stat *st;
+    const char *extension;	/* may be NULL */
+    uint32_t flags;
+    uint64_t generation;
+};
+
+struct cache *cache_open (void);
+int cache_lookup (struct cache *cache, const struct cache_key *key,
+		  uint32_t *formats, size_t *count);
+void cache_store (struct cache *cache, const struct cache_key *key,
+		  const uint32_t *formats, size_t count);
+void cache_close (struct cache *cache);
+void cache_create_dir (void);
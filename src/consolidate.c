@@ -0,0 +1,330 @@
+/* consolidate.c - consolidated kernel entries
+ *
+ * Copyright (c) 2026 agent <agent@local>.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/* The kernel tries every binfmt_misc entry in turn on each exec that gets
+ * that far, so fewer entries make every exec cheaper.  When one format's
+ * kernel-visible spec covers another's, i.e. every file matching the
+ * second also matches the first, the first format's entry can be pointed
+ * at run-detectors and the second need not have an entry of its own;
+ * run-detectors then tells them apart.  Nothing beyond the union of the
+ * formats is ever matched, so native executables are unaffected.
+ *
+ * Which formats are served by which entry is recorded in rundir, which
+ * like the kernel's entries does not survive a reboot.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "xalloc.h"
+#include "xvasprintf.h"
+
+#include "cache.h"
+#include "consolidate.h"
+#include "error.h"
+#include "format.h"
+#include "kvhash.h"
+#include "paths.h"
+
+/* The mask that applies to byte i of a format's magic. */
+static inline unsigned char mask_byte (const struct binfmt *binfmt, size_t i)
+{
+    return *binfmt->mask ? (unsigned char) binfmt->mask[i] : 0xff;
+}
+
+/* Return non-zero if every file that binfmt matches in the kernel is also
+ * matched by cover.  Both formats must have had their magic and mask
+ * expanded, as by load_formats.
+ */
+int binfmt_covers (const struct binfmt *cover, const struct binfmt *binfmt)
+{
+    unsigned long cover_offset, offset;
+    size_t i;
+
+    if (strcmp (cover->type, binfmt->type))
+	return 0;
+    if (strcmp (cover->type, "magic"))
+	return !strcmp (cover->magic, binfmt->magic);
+
+    cover_offset = strtoul (cover->offset, NULL, 10);
+    offset = strtoul (binfmt->offset, NULL, 10);
+    for (i = 0; i < cover->magic_size; ++i) {
+	unsigned char cover_mask = mask_byte (cover, i);
+	unsigned long pos = cover_offset + i;
+
+	if (!cover_mask)
+	    continue;
+	/* cover must only test bytes that binfmt tests at least as
+	 * strictly, and want the same bits in them.
+	 */
+	if (pos < offset || pos - offset >= binfmt->magic_size)
+	    return 0;
+	if (cover_mask & ~mask_byte (binfmt, pos - offset))
+	    return 0;
+	if ((cover->magic[i] ^ binfmt->magic[pos - offset]) & cover_mask)
+	    return 0;
+    }
+    return 1;
+}
+
+/* Return non-zero if some file could be matched in the kernel by both
+ * formats, so that which of them the kernel uses for it depends on the
+ * order in which they were registered.  Both formats must have had their
+ * magic and mask expanded, as by load_formats.
+ */
+int binfmt_overlaps (const struct binfmt *left, const struct binfmt *right)
+{
+    unsigned long left_offset, right_offset;
+    size_t i;
+
+    /* A file's name says nothing about its contents. */
+    if (strcmp (left->type, right->type))
+	return 1;
+    if (strcmp (left->type, "magic"))
+	return !strcmp (left->magic, right->magic);
+
+    left_offset = strtoul (left->offset, NULL, 10);
+    right_offset = strtoul (right->offset, NULL, 10);
+    for (i = 0; i < left->magic_size; ++i) {
+	unsigned long pos = left_offset + i;
+	unsigned char mask;
+
+	if (pos < right_offset || pos - right_offset >= right->magic_size)
+	    continue;
+	/* Both test some bit of this byte, and want it different. */
+	mask = mask_byte (left, i) & mask_byte (right, pos - right_offset);
+	if ((left->magic[i] ^ right->magic[pos - right_offset]) & mask)
+	    return 0;
+    }
+    return 1;
+}
+
+/* Load the map from consolidated format names to the names of the formats
+ * whose kernel entries serve them, from the runtime directory dir.  The map
+ * only counts if it was written by root or by the current user, since it
+ * decides which formats run-detectors considers.
+ */
+Hash_table *consolidated_load_from (const char *dir)
+{
+    Hash_table *map = kvhash_initialize (16, NULL, kvhash_free_pair);
+    char *path;
+    int fd;
+    struct stat st;
+    FILE *file;
+    char *line = NULL;
+    size_t n;
+
+    path = xasprintf ("%s/%s", dir, CONSOLIDATED_MAP);
+    fd = open (path, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+    free (path);
+    if (fd < 0)
+	return map;
+    if (fstat (fd, &st) == -1 || !S_ISREG (st.st_mode) ||
+	(st.st_uid != 0 && st.st_uid != geteuid ()) || (st.st_mode & 022)) {
+	close (fd);
+	return map;
+    }
+    file = fdopen (fd, "r");
+    if (!file) {
+	close (fd);
+	return map;
+    }
+    while (getline (&line, &n, file) != -1) {
+	char *space = strchr (line, ' ');
+	char *newline = strchr (line, '\n');
+	char *owner;
+
+	if (!space)
+	    continue;
+	if (newline)
+	    *newline = '\0';
+	*space = '\0';
+	owner = xstrdup (space + 1);
+	if (kvhash_insert (map, line, owner) != owner)
+	    free (owner);
+    }
+    free (line);
+    fclose (file);
+    return map;
+}
+
+Hash_table *consolidated_load (void)
+{
+    return consolidated_load_from (rundir);
+}
+
+/* Replace the saved map with map.  Returns non-zero on success. */
+int consolidated_save (Hash_table *map)
+{
+    char *path, *path_tmp;
+    int fd;
+    FILE *file;
+    struct kvelem *elem;
+
+    path = xasprintf ("%s/%s", rundir, CONSOLIDATED_MAP);
+    if (!hash_get_n_entries (map)) {
+	if (unlink (path) == -1 && errno != ENOENT) {
+	    warning_err ("unable to remove %s", path);
+	    free (path);
+	    return 0;
+	}
+	free (path);
+	return 1;
+    }
+
+    cache_create_dir ();
+    path_tmp = xasprintf ("%s.XXXXXX", path);
+    fd = mkstemp (path_tmp);
+    if (fd < 0 || fchmod (fd, 0644) == -1 || !(file = fdopen (fd, "w"))) {
+	warning_err ("unable to create %s", path_tmp);
+	if (fd >= 0) {
+	    close (fd);
+	    unlink (path_tmp);
+	}
+	goto fail;
+    }
+    for (elem = hash_get_first (map); elem; elem = hash_get_next (map, elem))
+	fprintf (file, "%s %s\n", elem->key, (const char *) elem->value);
+    if (fclose (file)) {
+	warning_err ("unable to write %s", path_tmp);
+	unlink (path_tmp);
+	goto fail;
+    }
+    if (rename (path_tmp, path) == -1) {
+	warning_err ("unable to install %s as %s", path_tmp, path);
+	unlink (path_tmp);
+	goto fail;
+    }
+    free (path_tmp);
+    free (path);
+    return 1;
+
+fail:
+    free (path_tmp);
+    free (path);
+    return 0;
+}
+
+static int entry_exists (const char *name)
+{
+    char *procdir_name;
+    struct stat st;
+    int ret;
+
+    procdir_name = xasprintf ("%s/%s", procdir, name);
+    ret = stat (procdir_name, &st) != -1;
+    free (procdir_name);
+    return ret;
+}
+
+/* Is there a kernel entry for name, or a twin standing in for it? */
+static int entry_or_twin_exists (const char *name)
+{
+    char *twin;
+    int ret;
+
+    if (entry_exists (name))
+	return 1;
+    twin = xasprintf ("%s%s", REORDER_PREFIX, name);
+    ret = entry_exists (twin);
+    free (twin);
+    return ret;
+}
+
+/* Return non-zero if the format called name is enabled in the kernel,
+ * either with its own entry or through another format's.
+ */
+int format_enabled (const char *name)
+{
+    Hash_table *map;
+    const char *owner;
+    int ret = 0;
+
+    if (entry_or_twin_exists (name))
+	return 1;
+    map = consolidated_load ();
+    owner = kvhash_lookup (map, name);
+    if (owner)
+	ret = entry_or_twin_exists (owner);
+    hash_free (map);
+    return ret;
+}
+
+/* Read the names of all the kernel's entries at once from the binfmt_misc
+ * directory proc, for callers about to ask about many formats.
+ */
+Hash_table *kernel_entries_load_from (const char *proc)
+{
+    Hash_table *entries = kvhash_initialize (64, NULL, kvhash_free_key);
+    DIR *dir;
+    struct dirent *entry;
+
+    dir = opendir (proc);
+    if (!dir)
+	return entries;
+    while ((entry = readdir (dir)) != NULL) {
+	if (!strcmp (entry->d_name, ".") || !strcmp (entry->d_name, ".."))
+	    continue;
+	kvhash_insert (entries, entry->d_name, NULL);
+    }
+    closedir (dir);
+    return entries;
+}
+
+Hash_table *kernel_entries_load (void)
+{
+    return kernel_entries_load_from (procdir);
+}
+
+static int entry_or_twin_in (const char *name, Hash_table *entries)
+{
+    char *twin;
+    int ret;
+
+    if (kvhash_exists (entries, name))
+	return 1;
+    twin = xasprintf ("%s%s", REORDER_PREFIX, name);
+    ret = kvhash_exists (entries, twin);
+    free (twin);
+    return ret;
+}
+
+/* Like format_enabled, but using entries from kernel_entries_load and a
+ * map from consolidated_load.
+ */
+int format_enabled_in (const char *name, Hash_table *entries,
+		       Hash_table *map)
+{
+    const char *owner;
+
+    if (entry_or_twin_in (name, entries))
+	return 1;
+    owner = kvhash_lookup (map, name);
+    return owner && entry_or_twin_in (owner, entries);
+}
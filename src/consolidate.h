@@ -0,0 +1,41 @@
+/* consolidate.h - interface to consolidated kernel entries
+ *
+ * Copyright (c) 2026 agent <agent@local>.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "hash.h"
+
+struct binfmt;
+
+/* Name of the map from consolidated formats to their entries, in rundir. */
+#define CONSOLIDATED_MAP "consolidated"
+
+/* Prefix of the twin entries that serve formats while --reorder replaces
+ * their own entries.  Format names may not start with it.
+ */
+#define REORDER_PREFIX "."
+
+int binfmt_covers (const struct binfmt *cover, const struct binfmt *binfmt);
+int binfmt_overlaps (const struct binfmt *left, const struct binfmt *right);
+Hash_table *consolidated_load_from (const char *dir);
+Hash_table *consolidated_load (void);
+int consolidated_save (Hash_table *map);
+int format_enabled (const char *name);
+Hash_table *kernel_entries_load_from (const char *proc);
+Hash_table *kernel_entries_load (void);
+int format_enabled_in (const char *name, Hash_table *entries,
+		       Hash_table *map);
@@ -0,0 +1,218 @@
+/* daemon.c - talk to the classification daemon
+ *
+ * Copyright (c) 2026 agent <agent@local>.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/* detectord keeps the format database and detector plugins loaded, so
+ * that run-detectors only needs to pass it the file and exec whatever it
+ * says.  Nothing here is ever fatal: if the daemon is absent, unsuitable,
+ * or misbehaves, daemon_find returns NULL and the caller looks for itself.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "gl_array_list.h"
+#include "gl_xlist.h"
+#include "xalloc.h"
+#include "xvasprintf.h"
+
+#include "daemon.h"
+#include "paths.h"
+
+char *daemon_socket_path (void)
+{
+    return xasprintf ("%s/%s", rundir, DAEMON_SOCKET);
+}
+
+static int daemon_connect (void)
+{
+    struct sockaddr_un addr;
+    char *path;
+    int sock;
+    struct ucred cred;
+    socklen_t len = sizeof cred;
+
+    path = daemon_socket_path ();
+    if (strlen (path) >= sizeof addr.sun_path) {
+	free (path);
+	return -1;
+    }
+    memset (&addr, 0, sizeof addr);
+    addr.sun_family = AF_UNIX;
+    strcpy (addr.sun_path, path);
+    free (path);
+
+    sock = socket (AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (sock < 0)
+	return -1;
+    if (connect (sock, (struct sockaddr *) &addr, sizeof addr) == -1)
+	goto fail;
+    /* rundir is world-writable, so only trust a daemon run by root or by
+     * ourselves.
+     */
+    if (getsockopt (sock, SOL_SOCKET, SO_PEERCRED, &cred, &len) == -1 ||
+	(cred.uid != 0 && cred.uid != geteuid ()))
+	goto fail;
+    return sock;
+
+fail:
+    close (sock);
+    return -1;
+}
+
+static int send_request (int sock, const char *path, int fd, int flags)
+{
+    struct daemon_request request;
+    char *cwd = NULL;
+    const char *strings[4];
+    char *buf, *p;
+    size_t size, i;
+    struct iovec iov;
+    struct msghdr msg;
+    union {
+	struct cmsghdr align;
+	char buf[CMSG_SPACE (sizeof (int))];
+    } control;
+    struct cmsghdr *cmsg;
+    ssize_t sent;
+
+    /* Relative paths are resolved against this. */
+    cwd = getcwd (NULL, 0);
+    if (!cwd)
+	return 0;
+    strings[0] = admindir;
+    strings[1] = procdir;
+    strings[2] = cwd;
+    strings[3] = path;
+
+    request.protocol = DAEMON_PROTOCOL;
+    request.flags = flags;
+    size = sizeof request;
+    for (i = 0; i < 4; ++i)
+	size += strlen (strings[i]) + 1;
+    if (size > DAEMON_MAX_MESSAGE) {
+	free (cwd);
+	return 0;
+    }
+    p = buf = xmalloc (size);
+    memcpy (p, &request, sizeof request);
+    p += sizeof request;
+    for (i = 0; i < 4; ++i)
+	p = stpcpy (p, strings[i]) + 1;
+    free (cwd);
+
+    iov.iov_base = buf;
+    iov.iov_len = size;
+    memset (&msg, 0, sizeof msg);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof control.buf;
+    cmsg = CMSG_FIRSTHDR (&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN (sizeof (int));
+    memcpy (CMSG_DATA (cmsg), &fd, sizeof (int));
+
+    do
+	sent = sendmsg (sock, &msg, MSG_NOSIGNAL);
+    while (sent == -1 && errno == EINTR);
+    free (buf);
+    return sent == (ssize_t) size;
+}
+
+static void free_string (const void *s)
+{
+    free ((void *) s);
+}
+
+static gl_list_t receive_reply (int sock)
+{
+    char *buf;
+    ssize_t got;
+    struct daemon_reply reply;
+    gl_list_t interpreters;
+    const char *p, *end;
+    uint32_t i;
+
+    buf = xmalloc (DAEMON_MAX_MESSAGE);
+    do
+	got = recv (sock, buf, DAEMON_MAX_MESSAGE, 0);
+    while (got == -1 && errno == EINTR);
+    if (got < (ssize_t) sizeof reply) {
+	free (buf);
+	return NULL;
+    }
+    memcpy (&reply, buf, sizeof reply);
+    if (reply.protocol != DAEMON_PROTOCOL || reply.status != DAEMON_OK) {
+	free (buf);
+	return NULL;
+    }
+
+    interpreters = gl_list_create_empty (GL_ARRAY_LIST, NULL, NULL,
+					 free_string, true);
+    p = buf + sizeof reply;
+    end = buf + got;
+    for (i = 0; i < reply.count; ++i) {
+	const char *nul = memchr (p, '\0', end - p);
+
+	if (!nul || nul == p) {
+	    gl_list_free (interpreters);
+	    free (buf);
+	    return NULL;
+	}
+	gl_list_add_last (interpreters, xstrdup (p));
+	p = nul + 1;
+    }
+    free (buf);
+    return interpreters;
+}
+
+/* Ask the daemon for the interpreters for path, as find_interpreters would
+ * return them.  fd is as for find_interpreters.  Returns a list of
+ * interpreter names, or NULL if the daemon could not answer.
+ */
+gl_list_t daemon_find (const char *path, int fd, int flags)
+{
+    int sock, our_fd = -1;
+    gl_list_t interpreters = NULL;
+
+    sock = daemon_connect ();
+    if (sock < 0)
+	return NULL;
+    if (fd < 0)
+	fd = our_fd = open (path, O_RDONLY | O_CLOEXEC);
+    if (fd >= 0) {
+	if (send_request (sock, path, fd, flags))
+	    interpreters = receive_reply (sock);
+	if (our_fd >= 0)
+	    close (our_fd);
+    }
+    close (sock);
+    return interpreters;
+}
@@ -0,0 +1,53 @@
+/* daemon.h - talk to the classification daemon
+ *
+ * Copyright (c) 2026 agent <agent@local>.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <stdint.h>
+
+#include "gl_xlist.h"
+
+/* Name of the daemon's socket within rundir. */
+#define DAEMON_SOCKET "detectord.socket"
+
+#define DAEMON_PROTOCOL 1
+#define DAEMON_MAX_MESSAGE 32768
+
+/* A request is a single packet carrying the file descriptor to classify. */
+struct daemon_request {
+    uint32_t protocol;
+    uint32_t flags;
+    /* Followed by admindir, procdir, the client's working directory and
+     * the path to the file, each NUL-terminated.  Any of these other than
+     * the working directory may be relative to it.
+     */
+};
+
+enum daemon_status {
+    DAEMON_OK,
+    DAEMON_DECLINED	/* client should look for itself */
+};
+
+struct daemon_reply {
+    uint32_t protocol;
+    uint32_t status;
+    uint32_t count;
+    /* Followed by count NUL-terminated interpreters. */
+};
+
+char *daemon_socket_path (void);
+gl_list_t daemon_find (const char *path, int fd, int flags);
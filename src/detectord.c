@@ -0,0 +1,460 @@
+/* detectord.c - classification daemon for run-detectors
+ *
+ * Copyright (c) 2026 agent <agent@local>.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/* The daemon holds the format database and any detector plugins, and
+ * forks a child for each connection.  The child takes on the client's
+ * user, group and supplementary groups before looking at anything the
+ * client sent, so detectors never run with more privilege than they would
+ * have had in run-detectors itself, and reach the same verdicts, which may
+ * be cached.  A detector that crashes or hangs only affects its own
+ * client.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <grp.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#include "argp.h"
+#include "gl_xlist.h"
+#include "xalloc.h"
+
+#include "cache.h"
+#include "daemon.h"
+#include "error.h"
+#include "find.h"
+#include "format.h"
+#include "paths.h"
+
+/* The first file descriptor passed by systemd socket activation. */
+#define LISTEN_FDS_START 3
+
+/* Connections being handled at once.  Further clients wait in the
+ * listen queue.
+ */
+#define MAX_CHILDREN 64
+
+/* How long a client may take to send its request. */
+#define REQUEST_TIMEOUT 5
+
+char *program_name;
+
+const char *argp_program_version = "binfmt-support " PACKAGE_VERSION;
+const char *argp_program_bug_address = PACKAGE_BUGREPORT;
+
+enum opts {
+    OPT_ADMINDIR = 256,
+    OPT_PROCDIR,
+    OPT_RUNDIR
+};
+
+static struct argp_option options[] = {
+    { "admindir",	OPT_ADMINDIR,	"DIRECTORY",	0,
+	"administration directory (default: " ADMINDIR ")" },
+    { "procdir",	OPT_PROCDIR,	"DIRECTORY",	OPTION_HIDDEN,
+	"proc directory, for test suite use only "
+	"(default: " PROCDIR ")", 5 },
+    { "rundir",		OPT_RUNDIR,	"DIRECTORY",	0,
+	"runtime directory (default: " RUNDIR ")", 4 },
+    { 0 }
+};
+
+static error_t parse_opt (int key, char *arg, struct argp_state *state)
+{
+    switch (key) {
+	case OPT_ADMINDIR:
+	    admindir = arg;
+	    return 0;
+
+	case OPT_PROCDIR:
+	    procdir = arg;
+	    return 0;
+
+	case OPT_RUNDIR:
+	    rundir = arg;
+	    return 0;
+    }
+
+    return ARGP_ERR_UNKNOWN;
+}
+
+static struct argp argp = {
+    options, parse_opt, NULL,
+    "\v"
+    "Copyright (C) 2026 agent.\n"
+    "This is free software; see the GNU General Public License version 3 or\n"
+    "later for copying conditions."
+};
+
+static volatile sig_atomic_t children;
+
+static void reap_children (int signum)
+{
+    int saved_errno = errno;
+
+    (void) signum;
+    while (waitpid (-1, NULL, WNOHANG) > 0)
+	--children;
+    errno = saved_errno;
+}
+
+/* Use the socket passed by systemd if there is one; otherwise create our
+ * own in rundir.
+ */
+static int listen_socket (void)
+{
+    const char *listen_pid = getenv ("LISTEN_PID");
+    const char *listen_fds = getenv ("LISTEN_FDS");
+    struct sockaddr_un addr;
+    char *path;
+    int sock;
+
+    if (listen_pid && listen_fds &&
+	atol (listen_pid) == (long) getpid () && atoi (listen_fds) >= 1) {
+	unsetenv ("LISTEN_PID");
+	unsetenv ("LISTEN_FDS");
+	fcntl (LISTEN_FDS_START, F_SETFD, FD_CLOEXEC);
+	return LISTEN_FDS_START;
+    }
+
+    cache_create_dir ();
+    path = daemon_socket_path ();
+    if (strlen (path) >= sizeof addr.sun_path)
+	quit ("socket path %s is too long", path);
+    memset (&addr, 0, sizeof addr);
+    addr.sun_family = AF_UNIX;
+    strcpy (addr.sun_path, path);
+
+    sock = socket (AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (sock < 0)
+	quit_err ("unable to create socket");
+    if (unlink (path) == -1 && errno != ENOENT)
+	quit_err ("unable to remove %s", path);
+    if (bind (sock, (struct sockaddr *) &addr, sizeof addr) == -1)
+	quit_err ("unable to bind to %s", path);
+    /* Anyone may ask; each client's detectors run as that client. */
+    if (chmod (path, 0666) == -1)
+	quit_err ("unable to set permissions on %s", path);
+    if (listen (sock, SOMAXCONN) == -1)
+	quit_err ("unable to listen on %s", path);
+    free (path);
+    return sock;
+}
+
+/* Resolve path, or return it unchanged if that fails.  Our own
+ * directories are resolved at startup and compared with what clients ask
+ * for.
+ */
+static const char *canonical (const char *path)
+{
+    char *resolved = realpath (path, NULL);
+
+    return resolved ? resolved : path;
+}
+
+static void send_reply (int conn, enum daemon_status status,
+			gl_list_t interpreters)
+{
+    struct daemon_reply reply;
+    char *buf, *p;
+    size_t size = sizeof reply;
+    gl_list_iterator_t interpreter_iter;
+    const struct binfmt *binfmt;
+
+    reply.protocol = DAEMON_PROTOCOL;
+    reply.status = status;
+    reply.count = 0;
+    if (interpreters) {
+	interpreter_iter = gl_list_iterator (interpreters);
+	while (gl_list_iterator_next (&interpreter_iter,
+				      (const void **) &binfmt, NULL)) {
+	    if (size + strlen (binfmt->interpreter) + 1 > DAEMON_MAX_MESSAGE)
+		break;
+	    size += strlen (binfmt->interpreter) + 1;
+	    ++reply.count;
+	}
+	gl_list_iterator_free (&interpreter_iter);
+    }
+
+    p = buf = xmalloc (size);
+    memcpy (p, &reply, sizeof reply);
+    p += sizeof reply;
+    if (interpreters) {
+	size_t i;
+
+	for (i = 0; i < reply.count; ++i) {
+	    binfmt = gl_list_get_at (interpreters, i);
+	    p = stpcpy (p, binfmt->interpreter) + 1;
+	}
+    }
+    send (conn, buf, size, MSG_NOSIGNAL);
+    free (buf);
+}
+
+/* Return the supplementary groups that the client had when it connected,
+ * setting *count to the number of them, or NULL if the kernel cannot tell
+ * us.
+ */
+static gid_t *peer_groups (int conn, size_t *count)
+{
+#ifdef SO_PEERGROUPS
+    socklen_t len = 32 * sizeof (gid_t);
+    gid_t *groups = xmalloc (len);
+
+    while (getsockopt (conn, SOL_SOCKET, SO_PEERGROUPS, groups, &len) == -1) {
+	if (errno != ERANGE) {
+	    free (groups);
+	    return NULL;
+	}
+	/* len is now the size needed. */
+	groups = xrealloc (groups, len);
+    }
+    *count = len / sizeof (gid_t);
+    return groups;
+#else
+    (void) conn;
+    (void) count;
+    return NULL;
+#endif
+}
+
+static int compare_gids (const void *left, const void *right)
+{
+    gid_t l = *(const gid_t *) left, r = *(const gid_t *) right;
+
+    return l < r ? -1 : l > r;
+}
+
+/* Return non-zero if we already have exactly these supplementary groups. */
+static int have_groups (gid_t *groups, size_t count)
+{
+    gid_t *ours;
+    int n, same;
+
+    n = getgroups (0, NULL);
+    if (n < 0 || (size_t) n != count)
+	return 0;
+    ours = XNMALLOC (n + 1, gid_t);
+    n = getgroups (n, ours);
+    same = n >= 0 && (size_t) n == count;
+    if (same) {
+	qsort (ours, n, sizeof *ours, compare_gids);
+	qsort (groups, count, sizeof *groups, compare_gids);
+	same = !memcmp (ours, groups, count * sizeof *groups);
+    }
+    free (ours);
+    return same;
+}
+
+/* Become the client, or return zero if we cannot.  Detectors must run with
+ * the same groups as in the client, since they decide what the detectors
+ * can read.
+ */
+static int become_client (int conn, const struct ucred *cred)
+{
+    gid_t *groups;
+    size_t count;
+    int ok;
+
+    groups = peer_groups (conn, &count);
+    if (!groups)
+	return 0;
+    if (geteuid () != 0)
+	ok = cred->uid == geteuid () && cred->gid == getegid () &&
+	     have_groups (groups, count);
+    else
+	ok = setgroups (count, groups) == 0 && setgid (cred->gid) == 0 &&
+	     (cred->uid == 0 || setuid (cred->uid) == 0);
+    free (groups);
+    return ok;
+}
+
+/* Handle a single request.  This runs in a child process. */
+static void serve (int conn, struct finder *finder)
+{
+    char *buf, *end;
+    const char *strings[4];
+    struct daemon_request request;
+    struct iovec iov;
+    struct msghdr msg;
+    union {
+	struct cmsghdr align;
+	char buf[CMSG_SPACE (sizeof (int))];
+    } control;
+    struct cmsghdr *cmsg;
+    struct ucred cred;
+    socklen_t len = sizeof cred;
+    struct timeval timeout;
+    ssize_t got;
+    int fd = -1;
+    size_t i;
+    struct stat path_st, fd_st;
+    gl_list_t interpreters;
+
+    timeout.tv_sec = REQUEST_TIMEOUT;
+    timeout.tv_usec = 0;
+    setsockopt (conn, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof timeout);
+
+    buf = xmalloc (DAEMON_MAX_MESSAGE);
+    iov.iov_base = buf;
+    iov.iov_len = DAEMON_MAX_MESSAGE;
+    memset (&msg, 0, sizeof msg);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof control.buf;
+    do
+	got = recvmsg (conn, &msg, MSG_CMSG_CLOEXEC);
+    while (got == -1 && errno == EINTR);
+    if (got < (ssize_t) sizeof request)
+	return;
+    for (cmsg = CMSG_FIRSTHDR (&msg); cmsg; cmsg = CMSG_NXTHDR (&msg, cmsg))
+	if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS &&
+	    cmsg->cmsg_len == CMSG_LEN (sizeof (int)))
+	    memcpy (&fd, CMSG_DATA (cmsg), sizeof fd);
+    if (fd < 0 || (msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC)))
+	return;
+
+    if (getsockopt (conn, SOL_SOCKET, SO_PEERCRED, &cred, &len) == -1 ||
+	!become_client (conn, &cred)) {
+	send_reply (conn, DAEMON_DECLINED, NULL);
+	return;
+    }
+
+    memcpy (&request, buf, sizeof request);
+    if (request.protocol != DAEMON_PROTOCOL)
+	return;
+    end = buf + sizeof request;
+    for (i = 0; i < 4; ++i) {
+	char *nul = memchr (end, '\0', buf + got - end);
+
+	if (!nul)
+	    return;
+	strings[i] = end;
+	end = nul + 1;
+    }
+
+    /* We only know about our own format database.  Detectors are given
+     * the path, so also make sure that it names the file we were passed.
+     */
+    if (chdir (strings[2]) == -1 ||
+	strcmp (canonical (strings[0]), admindir) ||
+	strcmp (canonical (strings[1]), procdir) ||
+	stat (strings[3], &path_st) == -1 || fstat (fd, &fd_st) == -1 ||
+	path_st.st_dev != fd_st.st_dev || path_st.st_ino != fd_st.st_ino) {
+	send_reply (conn, DAEMON_DECLINED, NULL);
+	return;
+    }
+
+    if (!finder)
+	finder = finder_new (0);
+    interpreters = finder_find (finder, strings[3], fd,
+				request.flags &
+				(FIND_PARALLEL | FIND_CACHE | FIND_PROFILE |
+				 FIND_FIRST));
+    send_reply (conn, DAEMON_OK, interpreters);
+}
+
+int main (int argc, char **argv)
+{
+    int sock;
+    struct finder *finder;
+    struct sigaction sa;
+    sigset_t chld, orig;
+
+    program_name = xstrdup ("detectord");
+    error_prefix = program_name;
+
+    argp_err_exit_status = 2;
+    if (argp_parse (&argp, argc, argv, 0, 0, 0))
+	exit (argp_err_exit_status);
+
+    admindir = canonical (admindir);
+    procdir = canonical (procdir);
+    sock = listen_socket ();
+
+    memset (&sa, 0, sizeof sa);
+    sa.sa_handler = reap_children;
+    sigemptyset (&sa.sa_mask);
+    sa.sa_flags = SA_NOCLDSTOP;
+    sigaction (SIGCHLD, &sa, NULL);
+    sigemptyset (&chld);
+    sigaddset (&chld, SIGCHLD);
+
+    finder = finder_new (1);
+    if (finder)
+	finder_preload (finder);
+
+    for (;;) {
+	int conn;
+	pid_t pid;
+
+	conn = accept4 (sock, NULL, NULL, SOCK_CLOEXEC);
+	if (conn < 0) {
+	    if (errno != EINTR && errno != ECONNABORTED)
+		warning_err ("unable to accept connection");
+	    continue;
+	}
+
+	/* Reload the database if it has changed since we last looked.
+	 * Children only have their own copies of the old formats, so they
+	 * can all go.  Without an index, formats have to be loaded afresh for
+	 * every request, so that is left to the children.
+	 */
+	if (finder && !finder_current (finder)) {
+	    finder_free_all (finder);
+	    finder = NULL;
+	}
+	if (!finder) {
+	    finder = finder_new (1);
+	    if (finder)
+		finder_preload (finder);
+	}
+
+	sigprocmask (SIG_BLOCK, &chld, &orig);
+	while (children >= MAX_CHILDREN)
+	    sigsuspend (&orig);
+	pid = fork ();
+	if (pid == 0) {
+	    signal (SIGCHLD, SIG_DFL);
+	    sigprocmask (SIG_SETMASK, &orig, NULL);
+	    close (sock);
+	    serve (conn, finder);
+	    _exit (0);
+	} else if (pid < 0)
+	    warning_err ("unable to fork");
+	else
+	    ++children;
+	sigprocmask (SIG_SETMASK, &orig, NULL);
+	close (conn);
+    }
+}
@@ -28,20 +28,71 @@
 #include <string.h>
 #include <errno.h>
 
-extern char *program_name;
+#include "xalloc.h"
+
+#include "error.h"
+
+const char *error_prefix = PACKAGE;
+
+static __thread struct error_handler *handler;
+
+/* Install handler for the calling thread, or go back to standard error if
+ * it is NULL.  Returns the handler it replaces.
+ */
+struct error_handler *error_set_handler (struct error_handler *new_handler)
+{
+    struct error_handler *old_handler = handler;
+
+    handler = new_handler;
+    return old_handler;
+}
+
+/* errnum is an errno value to describe after the message, or 0. */
+static void report (const char *kind, int errnum, const char *message,
+		    va_list args)
+{
+    char *text, *full;
+
+    if (!handler) {
+	fprintf (stderr, "%s: %s", error_prefix, kind);
+	vfprintf (stderr, message, args);
+	if (errnum)
+	    fprintf (stderr, ": %s", strerror (errnum));
+	putc ('\n', stderr);
+	return;
+    }
+
+    /* Not xvasprintf, which would come back here if memory ran out. */
+    if (!handler->report || vasprintf (&text, message, args) < 0)
+	return;
+    if (errnum) {
+	if (asprintf (&full, "%s: %s", text, strerror (errnum)) < 0) {
+	    free (text);
+	    return;
+	}
+	free (text);
+	text = full;
+    }
+    handler->report (text, handler->data);
+    free (text);
+}
+
+static void __attribute__ ((noreturn)) give_up (void)
+{
+    if (handler)
+	longjmp (handler->recover, 1);
+    exit (2);
+}
 
 void quit (const char *message, ...)
 {
     va_list args;
 
-    fprintf (stderr, "%s: ", program_name);
-
     va_start (args, message);
-    vfprintf (stderr, message, args);
+    report ("", 0, message, args);
     va_end (args);
-    putc ('\n', stderr);
 
-    exit (2);
+    give_up ();
 }
 
 void quit_err (const char *message, ...)
@@ -49,14 +100,11 @@ void quit_err (const char *message, ...)
     int saved_errno = errno;
     va_list args;
 
-    fprintf (stderr, "%s: ", program_name);
-
     va_start (args, message);
-    vfprintf (stderr, message, args);
+    report ("", saved_errno, message, args);
     va_end (args);
-    fprintf (stderr, ": %s\n", strerror (saved_errno));
 
-    exit (2);
+    give_up ();
 }
 
 /* Something has gone wrong, but not badly enough for us to give up. */
@@ -64,12 +112,9 @@ void warning (const char *message, ...)
 {
     va_list args;
 
-    fprintf (stderr, "%s: warning: ", program_name);
-
     va_start (args, message);
-    vfprintf (stderr, message, args);
+    report ("warning: ", 0, message, args);
     va_end (args);
-    putc ('\n', stderr);
 }
 
 void warning_err (const char *message, ...)
@@ -77,10 +122,15 @@ void warning_err (const char *message, ...)
     int saved_errno = errno;
     va_list args;
 
-    fprintf (stderr, "%s: warning: ", program_name);
-
     va_start (args, message);
-    vfprintf (stderr, message, args);
+    report ("warning: ", saved_errno, message, args);
     va_end (args);
-    fprintf (stderr, ": %s\n", strerror (saved_errno));
+}
+
+/* gnulib's allocation functions call this when memory runs out.  Its own
+ * version always ends the process.
+ */
+void xalloc_die (void)
+{
+    quit ("memory exhausted");
 }
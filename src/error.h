@@ -18,7 +18,25 @@
  * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
  */
 
-void quit (const char *message, ...);
-void quit_err (const char *message, ...);
+#include <setjmp.h>
+
+/* Messages start with this; each program sets it to its own name. */
+extern const char *error_prefix;
+
+/* While a handler is installed for a thread, that thread's messages go to
+ * report rather than to standard error, and quit longjmps to recover
+ * rather than ending the process.  libbinfmt installs one around each call
+ * it makes into the rest of the code.
+ */
+struct error_handler {
+    void (*report) (const char *message, void *data);
+    void *data;
+    jmp_buf recover;
+};
+
+struct error_handler *error_set_handler (struct error_handler *handler);
+
+void quit (const char *message, ...) __attribute__ ((noreturn));
+void quit_err (const char *message, ...) __attribute__ ((noreturn));
 void warning (const char *message, ...);
 void warning_err (const char *message, ...);
@@ -26,20 +26,46 @@
 #include <string.h>
 #include <dirent.h>
 #include <assert.h>
+#include <fcntl.h>
+#include <signal.h>
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 
-#include <pipeline.h>
-
 #include "gl_xlist.h"
 #include "gl_array_list.h"
 #include "xalloc.h"
 #include "xvasprintf.h"
 
+#include "builtin.h"
+#include "cache.h"
+#include "consolidate.h"
 #include "error.h"
+#include "find.h"
 #include "format.h"
+#include "index.h"
+#include "kvhash.h"
+#include "launch.h"
+#include "match.h"
 #include "paths.h"
+#include "plugin.h"
+#include "profile.h"
+#include "rule.h"
+#include "trace.h"
+
+/* The size of the kernel's buffer for the start of an executable.
+ * Detector plugins get at least this much of the file.
+ */
+#define BINPRM_BUF_SIZE 256
+
+/* A file being examined by detectors. */
+struct target {
+    const char *path;
+    int fd;
+    const unsigned char *header;
+    size_t header_size;
+    struct builtin_target *builtin;
+};
 
 static size_t expand_hex (char **str)
 {
@@ -75,32 +101,36 @@ static size_t expand_hex (char **str)
     return p - new;
 }
 
-static void load_all_formats (gl_list_t *formats)
+/* Load all formats from the format database in dir, expanding escapes in
+ * their magic and mask.  If enabled_only is set, formats not enabled in the
+ * kernel are skipped.  If quiet is set, corrupt format files are skipped
+ * rather than being fatal.  Returns NULL, with errno set, if dir cannot be
+ * read.
+ */
+gl_list_t scan_formats (const char *dir_name, int enabled_only, int quiet)
 {
     DIR *dir;
     struct dirent *entry;
+    gl_list_t formats;
 
-    dir = opendir (admindir);
+    dir = opendir (dir_name);
     if (!dir)
-	quit_err ("unable to open %s", admindir);
-    *formats = gl_list_create_empty (GL_ARRAY_LIST, NULL, NULL, NULL, true);
+	return NULL;
+    formats = gl_list_create_empty (GL_ARRAY_LIST, NULL, NULL, NULL, true);
     while ((entry = readdir (dir)) != NULL) {
-	char *admindir_name, *procdir_name;
-	struct stat st;
+	char *admindir_name;
 	struct binfmt *binfmt;
 	size_t mask_size;
 
-	if (!strcmp (entry->d_name, ".") || !strcmp (entry->d_name, ".."))
+	if (entry->d_name[0] == '.')
 	    continue;
-	procdir_name = xasprintf ("%s/%s", procdir, entry->d_name);
-	if (stat (procdir_name, &st) == -1) {
-	    free (procdir_name);
+	if (enabled_only && !format_enabled (entry->d_name))
 	    continue;
-	}
-	free (procdir_name);
-	admindir_name = xasprintf ("%s/%s", admindir, entry->d_name);
-	binfmt = binfmt_load (entry->d_name, admindir_name, 0);
+	admindir_name = xasprintf ("%s/%s", dir_name, entry->d_name);
+	binfmt = binfmt_load (entry->d_name, admindir_name, quiet);
 	free (admindir_name);
+	if (!binfmt)
+	    continue;
 
 	/* binfmt_load should always make these at least empty strings,
 	 * never null pointers.
@@ -111,6 +141,8 @@ static void load_all_formats (gl_list_t *formats)
 	assert (binfmt->offset);
 	assert (binfmt->interpreter);
 	assert (binfmt->detector);
+	assert (binfmt->rule);
+	assert (binfmt->priority);
 
 	binfmt->magic_size = expand_hex (&binfmt->magic);
 	mask_size = expand_hex (&binfmt->mask);
@@ -121,53 +153,430 @@ static void load_all_formats (gl_list_t *formats)
 	    binfmt_free (binfmt);
 	    continue;
 	}
-	if (!*binfmt->offset)
+	if (!*binfmt->offset) {
+	    free (binfmt->offset);
 	    binfmt->offset = xstrdup ("0");
-	gl_list_add_last (*formats, binfmt);
+	}
+	gl_list_add_last (formats, binfmt);
     }
     closedir (dir);
+    return formats;
+}
+
+/* Like scan_formats, but for admindir, which must be readable. */
+gl_list_t load_formats (int enabled_only, int quiet)
+{
+    gl_list_t formats = scan_formats (admindir, enabled_only, quiet);
+
+    if (!formats)
+	quit_err ("unable to open %s", admindir);
+    return formats;
 }
 
-gl_list_t find_interpreters (const char *path)
+/* The formats that files are matched against. */
+struct finder {
+    gl_list_t formats;
+    struct matcher *matcher;
+    /* Formats in the index have not been checked against the kernel, so
+     * this is set if that still needs to be done for each file.
+     */
+    int check_enabled;
+    /* If set, the names of the formats that were enabled when the finder
+     * was made, checked instead of asking the kernel each time.
+     */
+    Hash_table *enabled;
+    struct index_snapshot snapshot;
+    struct timespec stamp;
+};
+
+/* Use the compiled index if there is an up-to-date one; otherwise scan
+ * admindir and build a matcher for the result, unless index_only is set in
+ * which case return NULL.
+ */
+struct finder *finder_new (int index_only)
+{
+    struct finder *finder = xzalloc (sizeof *finder);
+    struct stat st;
+
+    /* Take the stamp first, so that a concurrent change is never missed. */
+    if (stat (admindir, &st) == 0)
+	finder->stamp = st.st_mtim;
+    finder->formats = index_load (&finder->snapshot, &finder->matcher);
+    if (finder->formats) {
+	finder->check_enabled = 1;
+	return finder;
+    }
+    if (index_only) {
+	free (finder);
+	return NULL;
+    }
+    finder->formats = load_formats (1, 0);
+    finder->matcher = matcher_new (finder->formats);
+    return finder;
+}
+
+/* Make a finder for formats, as returned by scan_formats, considering only
+ * those named in enabled.  The finder takes over both, although the formats
+ * themselves are still not freed by finder_free.  Such a finder reads
+ * nothing but the files it is asked about, so it can be shared between
+ * threads as long as FIND_CACHE and FIND_PROFILE are not used.
+ */
+struct finder *finder_new_enabled (gl_list_t formats, Hash_table *enabled)
+{
+    struct finder *finder = xzalloc (sizeof *finder);
+
+    finder->formats = formats;
+    finder->matcher = matcher_new (formats);
+    finder->check_enabled = 1;
+    finder->enabled = enabled;
+    return finder;
+}
+
+/* Return non-zero if finder still reflects the format database.  Formats
+ * scanned from admindir are only good for one lookup, since only enabled
+ * formats were loaded.  A pending index stays current until update-binfmts
+ * renames a new one over it.
+ */
+int finder_current (const struct finder *finder)
+{
+    struct stat st;
+
+    if (!finder->check_enabled || finder->enabled ||
+	!index_snapshot_current (&finder->snapshot))
+	return 0;
+    if (index_snapshot_pending (&finder->snapshot))
+	return 1;
+    if (stat (admindir, &st) == -1)
+	return 0;
+    return st.st_mtim.tv_sec == finder->stamp.tv_sec &&
+	   st.st_mtim.tv_nsec == finder->stamp.tv_nsec;
+}
+
+/* Load any detector plugins that finder's formats use. */
+void finder_preload (const struct finder *finder)
 {
-    gl_list_t formats, ok_formats, interpreters;
     gl_list_iterator_t format_iter;
     const struct binfmt *binfmt;
-    size_t toread;
-    char *buf;
-    FILE *target_file;
-    const char *dot, *extension = NULL;
 
-    load_all_formats (&formats);
+    format_iter = gl_list_iterator (finder->formats);
+    while (gl_list_iterator_next (&format_iter, (const void **) &binfmt,
+				  NULL)) {
+	const char *plugin = plugin_path (binfmt->detector);
 
-    /* Find out how much of the file we need to read.  The kernel doesn't
-     * currently let this be more than 128, so we shouldn't need to worry
-     * about huge memory consumption.
+	if (plugin)
+	    plugin_preload (plugin);
+    }
+    gl_list_iterator_free (&format_iter);
+}
+
+/* The formats themselves are not freed, since lists returned by
+ * finder_find refer to them.
+ */
+void finder_free (struct finder *finder)
+{
+    matcher_free (finder->matcher);
+    gl_list_free (finder->formats);
+    if (finder->enabled)
+	hash_free (finder->enabled);
+    free (finder);
+}
+
+/* Free a finder made by finder_new along with its formats, once no lists
+ * returned by finder_find are left.
+ */
+void finder_free_all (struct finder *finder)
+{
+    struct index_snapshot snapshot = finder->snapshot;
+    gl_list_iterator_t format_iter;
+    struct binfmt *binfmt;
+
+    if (!snapshot.map) {
+	format_iter = gl_list_iterator (finder->formats);
+	while (gl_list_iterator_next (&format_iter, (const void **) &binfmt,
+				      NULL))
+	    binfmt_free (binfmt);
+	gl_list_iterator_free (&format_iter);
+    }
+    /* The matcher may point into the index, so unmap it last. */
+    finder_free (finder);
+    if (snapshot.map)
+	index_unload (&snapshot);
+}
+
+/* Formats with a rule are treated as having a detector, even if the rule
+ * is all they have, so that they are preferred to formats that match
+ * anything with the right magic.
+ */
+static int has_detector (const struct binfmt *binfmt)
+{
+    return *binfmt->detector || *binfmt->rule;
+}
+
+/* Run a single detector to completion, returning non-zero if it accepts
+ * the target.  Rules have already been checked by filter_rules.
+ */
+static int run_detector (const struct binfmt *binfmt,
+			 const struct target *target)
+{
+    const char *plugin = plugin_path (binfmt->detector);
+    const char *builtin = builtin_name (binfmt->detector);
+    uint64_t started;
+    pid_t pid;
+    int status;
+
+    if (!*binfmt->detector)
+	return 1;
+    started = trace_now ();
+    if (builtin)
+	status = !builtin_detect (builtin, binfmt->builtin_args,
+				  target->builtin);
+    else if (plugin)
+	status = !plugin_detect (plugin, target->path, target->fd,
+				 target->header, target->header_size);
+    else {
+	pid = launch_detector (binfmt->detector, target->path);
+	status = pid > 0 ? launch_wait (pid) : TRACE_NOT_RUN;
+    }
+    trace_detector (binfmt->name, status, started);
+    return status == 0;
+}
+
+/* Start every detector program in ok_formats at once, and add the formats
+ * whose detectors accept the target to interpreters, in ok_formats order,
+ * just as running them one after another would.  Plugins and built-in
+ * detectors are called in turn while the programs run.
+ *
+ * If first_only is set, only the first format that is accepted is added.
+ * Once it is known, any detectors still running after it cannot change the
+ * result, so they are killed outright rather than waited for.
+ */
+static void run_detectors_parallel (gl_list_t ok_formats,
+				    const struct target *target,
+				    gl_list_t interpreters, int first_only)
+{
+    size_t count = gl_list_size (ok_formats), n = 0, i;
+    const struct binfmt **binfmts;
+    pid_t *pids;
+    gl_list_iterator_t format_iter;
+    const struct binfmt *binfmt;
+    int found = 0;
+    uint64_t launched = trace_now ();
+    int status;
+
+    binfmts = xcalloc (count + 1, sizeof *binfmts);
+    /* 0 for detectors run in-process, -1 for programs that could not be
+     * started.
      */
-    toread = 0;
-    format_iter = gl_list_iterator (formats);
+    pids = xcalloc (count + 1, sizeof *pids);
+    format_iter = gl_list_iterator (ok_formats);
     while (gl_list_iterator_next (&format_iter, (const void **) &binfmt,
 				  NULL)) {
-	if (!strcmp (binfmt->type, "magic")) {
-	    size_t size;
+	if (!has_detector (binfmt))
+	    continue;
+	binfmts[n] = binfmt;
+	if (*binfmt->detector && !plugin_path (binfmt->detector) &&
+	    !builtin_name (binfmt->detector))
+	    pids[n] = launch_detector (binfmt->detector, target->path);
+	++n;
+    }
+    gl_list_iterator_free (&format_iter);
 
-	    size = atoi (binfmt->offset) + binfmt->magic_size;
-	    if (size > toread)
-		toread = size;
+    /* Waiting in order means that the winner is known as soon as it and
+     * every detector before it have finished, which is as early as it can
+     * be known.
+     */
+    for (i = 0; i < n; ++i) {
+	if (pids[i] < 0) {
+	    trace_detector (binfmts[i]->name, TRACE_NOT_RUN, launched);
+	    continue;
+	}
+	if (first_only && found) {
+	    if (pids[i] > 0) {
+		kill (pids[i], SIGKILL);
+		launch_wait (pids[i]);
+		trace_detector (binfmts[i]->name, TRACE_KILLED, launched);
+	    }
+	    continue;
 	}
+	if (pids[i] == 0)
+	    status = !run_detector (binfmts[i], target);
+	else {
+	    status = launch_wait (pids[i]);
+	    trace_detector (binfmts[i]->name, status, launched);
+	}
+	if (status == 0) {
+	    gl_list_add_last (interpreters, binfmts[i]);
+	    found = 1;
+	}
+    }
+
+    free (pids);
+    free (binfmts);
+}
+
+/* Remove any formats that are not enabled in the kernel from a list. */
+static gl_list_t filter_enabled (const struct finder *finder,
+				 gl_list_t formats)
+{
+    gl_list_t enabled_formats;
+    gl_list_iterator_t format_iter;
+    const struct binfmt *binfmt;
+
+    enabled_formats = gl_list_create_empty (GL_ARRAY_LIST, NULL, NULL, NULL,
+					    true);
+    format_iter = gl_list_iterator (formats);
+    while (gl_list_iterator_next (&format_iter, (const void **) &binfmt,
+				  NULL)) {
+	if (finder->enabled ? kvhash_exists (finder->enabled, binfmt->name)
+			    : format_enabled (binfmt->name))
+	    gl_list_add_last (enabled_formats, binfmt);
+    }
+    gl_list_iterator_free (&format_iter);
+    gl_list_free (formats);
+    return enabled_formats;
+}
+
+/* Remove any formats whose rules the target does not satisfy from a
+ * list.
+ */
+static gl_list_t filter_rules (gl_list_t formats, const struct target *target)
+{
+    gl_list_t matching_formats;
+    gl_list_iterator_t format_iter;
+    const struct binfmt *binfmt;
+
+    matching_formats = gl_list_create_empty (GL_ARRAY_LIST, NULL, NULL, NULL,
+					     true);
+    format_iter = gl_list_iterator (formats);
+    while (gl_list_iterator_next (&format_iter, (const void **) &binfmt,
+				  NULL)) {
+	if (!*binfmt->rule ||
+	    rule_match (binfmt->rule, target->fd,
+			target->header, target->header_size))
+	    gl_list_add_last (matching_formats, binfmt);
     }
     gl_list_iterator_free (&format_iter);
+    gl_list_free (formats);
+    return matching_formats;
+}
+
+/* Look up a previous verdict for path.  The formats it lists may have been
+ * disabled since then without changing the index, in which case detectors
+ * that were skipped or rejected last time might now be needed, so the
+ * verdict is only used if every format in it is still enabled.
+ */
+static gl_list_t cache_find (const struct finder *finder, struct cache *cache,
+			     const struct cache_key *key)
+{
+    gl_list_t formats = finder->formats;
+    uint32_t positions[CACHE_MAX_FORMATS];
+    size_t count, i;
+    gl_list_t interpreters;
+
+    if (!cache_lookup (cache, key, positions, &count))
+	return NULL;
+    for (i = 0; i < count; ++i)
+	if (positions[i] >= gl_list_size (formats))
+	    return NULL;
+    interpreters = gl_list_create_empty (GL_ARRAY_LIST, NULL, NULL, NULL,
+					 true);
+    for (i = 0; i < count; ++i)
+	gl_list_add_last (interpreters,
+			  gl_list_get_at (formats, positions[i]));
+    interpreters = filter_enabled (finder, interpreters);
+    if (gl_list_size (interpreters) != count) {
+	gl_list_free (interpreters);
+	return NULL;
+    }
+    return interpreters;
+}
+
+static void cache_remember (struct cache *cache, const struct cache_key *key,
+			    gl_list_t formats, gl_list_t interpreters)
+{
+    uint32_t positions[CACHE_MAX_FORMATS];
+    size_t count = gl_list_size (interpreters), i;
+
+    if (count > CACHE_MAX_FORMATS)
+	return;
+    for (i = 0; i < count; ++i)
+	positions[i] = gl_list_indexof (formats,
+					gl_list_get_at (interpreters, i));
+    cache_store (cache, key, positions, count);
+}
+
+/* Find the interpreters for path, which is open for reading on fd.  The
+ * file offset of fd is not preserved.
+ */
+gl_list_t finder_find (struct finder *finder, const char *path, int fd,
+		       int flags)
+{
+    gl_list_t ok_formats, interpreters;
+    gl_list_iterator_t format_iter;
+    const struct binfmt *binfmt;
+    size_t toread, bufsize;
+    char *buf;
+    struct target target;
+    struct builtin_target builtin_target;
+    const char *dot, *extension = NULL;
+    struct cache *cache = NULL;
+    struct stat st;
+    struct cache_key key;
+
+    dot = strrchr (path, '.');
+    if (dot)
+	extension = dot + 1;
+
+    /* Verdicts are only cached for formats from the index, since only
+     * those have a generation.
+     */
+    if ((flags & FIND_CACHE) && finder->check_enabled && !finder->enabled)
+	cache = cache_open ();
+    if (cache) {
+	if (fstat (fd, &st) == 0) {
+	    key.st = &st;
+	    key.extension = extension;
+	    key.flags = flags & ~FIND_PROFILE;
+	    key.generation = finder->snapshot.generation;
+	    interpreters = cache_find (finder, cache, &key);
+	    trace_mark (TRACE_CACHE);
+	    if (interpreters) {
+		cache_close (cache);
+		goto out;
+	    }
+	} else {
+	    cache_close (cache);
+	    cache = NULL;
+	}
+    }
+
+    /* Find out how much of the file we need to read.  The kernel doesn't
+     * currently let this be more than 128, so we shouldn't need to worry
+     * about huge memory consumption.
+     */
+    toread = matcher_toread (finder->matcher);
+
+    bufsize = toread > BINPRM_BUF_SIZE ? toread : BINPRM_BUF_SIZE;
+    buf = xzalloc (bufsize);
+    target.path = path;
+    target.fd = fd;
+    target.header = (const unsigned char *) buf;
+    target.header_size = 0;
+    while (target.header_size < bufsize) {
+	ssize_t r = pread (fd, buf + target.header_size,
+			   bufsize - target.header_size, target.header_size);
 
-    buf = xzalloc (toread);
-    target_file = fopen (path, "r");
-    if (!target_file)
-	quit_err ("unable to open %s", path);
-    if (fread (buf, 1, toread, target_file) == 0)
 	/* Ignore errors; the buffer is zero-filled so attempts to match
 	 * beyond the data read here will fail anyway.
 	 */
-	;
-    fclose (target_file);
+	if (r <= 0)
+	    break;
+	target.header_size += r;
+    }
+    builtin_target_init (&builtin_target, fd, target.header,
+			 target.header_size);
+    target.builtin = &builtin_target;
+    trace_mark (TRACE_READ);
 
     /* Now the horrible bit.  Since there isn't a real way to plug userspace
      * detectors into the kernel (which is why this program exists in the
@@ -178,33 +587,21 @@ gl_list_t find_interpreters (const char *path)
      * performing it.  I don't believe that this is a big deal; certainly
      * there can be no privilege elevation involved unless somebody
      * deliberately makes a set-id binary a binfmt handler, in which case
-     * "don't do that, then".
+     * "don't do that, then".  Formats registered with open-binary close
+     * the race entirely, since then fd is the file the kernel checked.
      */
-    dot = strrchr (path, '.');
-    if (dot)
-	extension = dot + 1;
-
-    ok_formats = gl_list_create_empty (GL_ARRAY_LIST, NULL, NULL, NULL, true);
-    format_iter = gl_list_iterator (formats);
-    while (gl_list_iterator_next (&format_iter, (const void **) &binfmt,
-				  NULL)) {
-	if (!strcmp (binfmt->type, "magic")) {
-	    char *segment;
-
-	    segment = xmalloc (binfmt->magic_size);
-	    memcpy (segment, buf + atoi (binfmt->offset), binfmt->magic_size);
-	    if (*binfmt->mask)
-		for (size_t i = 0; i < toread && i < binfmt->magic_size; ++i)
-		    segment[i] &= binfmt->mask[i];
-	    if (!memcmp (segment, binfmt->magic, binfmt->magic_size))
-		gl_list_add_last (ok_formats, binfmt);
-	    free (segment);
-	} else {
-	    if (extension && !strcmp (extension, binfmt->magic))
-		gl_list_add_last (ok_formats, binfmt);
-	}
+    ok_formats = matcher_match (finder->matcher, buf, extension);
+    trace_mark (TRACE_MATCH);
+    if (finder->check_enabled) {
+	ok_formats = filter_enabled (finder, ok_formats);
+	trace_mark (TRACE_ENABLED);
     }
-    gl_list_iterator_free (&format_iter);
+
+    /* Rules are cheap, so check them before starting any detector
+     * programs.
+     */
+    ok_formats = filter_rules (ok_formats, &target);
+    trace_mark (TRACE_RULES);
 
     /* Everything in ok_formats is now a candidate.  Loop through twice,
      * once to try everything with a detector and once to try everything
@@ -212,27 +609,112 @@ gl_list_t find_interpreters (const char *path)
      */
     interpreters = gl_list_create_empty (GL_ARRAY_LIST, NULL, NULL, NULL,
 					 true);
-    format_iter = gl_list_iterator (ok_formats);
-    while (gl_list_iterator_next (&format_iter, (const void **) &binfmt,
-				  NULL)) {
-	if (*binfmt->detector) {
-	    pipeline *detector;
-
-	    detector = pipeline_new_command_args (binfmt->detector,
-						  path, NULL);
-	    if (pipeline_run (detector) == 0)
+    if (flags & FIND_PARALLEL)
+	run_detectors_parallel (ok_formats, &target, interpreters,
+				flags & FIND_FIRST);
+    else {
+	format_iter = gl_list_iterator (ok_formats);
+	while (gl_list_iterator_next (&format_iter, (const void **) &binfmt,
+				      NULL)) {
+	    if (has_detector (binfmt) && run_detector (binfmt, &target))
 		gl_list_add_last (interpreters, binfmt);
 	}
+	gl_list_iterator_free (&format_iter);
     }
-    gl_list_iterator_free (&format_iter);
+    trace_mark (TRACE_DETECT);
+    free (buf);
 
     format_iter = gl_list_iterator (ok_formats);
     while (gl_list_iterator_next (&format_iter, (const void **) &binfmt,
 				  NULL)) {
-	if (!*binfmt->detector)
+	if (!has_detector (binfmt))
 	    gl_list_add_last (interpreters, binfmt);
     }
     gl_list_iterator_free (&format_iter);
+    gl_list_free (ok_formats);
+
+    if (cache) {
+	cache_remember (cache, &key, finder->formats, interpreters);
+	cache_close (cache);
+    }
 
+    /* Counting takes several system calls, which a cached verdict should
+     * not have to pay for; see profile.c.
+     */
+    if ((flags & FIND_PROFILE) && gl_list_size (interpreters)) {
+	binfmt = gl_list_get_at (interpreters, 0);
+	profile_count (binfmt->name);
+    }
+
+out:
+    /* Only the first interpreter will normally be used. */
+    if (gl_list_size (interpreters)) {
+	binfmt = gl_list_get_at (interpreters, 0);
+	trace_format (binfmt->name);
+    }
+    trace_mark (TRACE_SAVE);
+    return interpreters;
+}
+
+/* Return how many bytes from the start of a file finder_match needs. */
+size_t finder_toread (const struct finder *finder)
+{
+    return matcher_toread (finder->matcher);
+}
+
+/* Return the formats whose magic or extension match a file called path,
+ * given the first finder_toread bytes of it in header (zero-filled if the
+ * file is shorter).  Rules and detectors need the whole file and are not
+ * checked, so the formats are in the order that finder_find would choose
+ * them if every detector accepted the file.
+ */
+gl_list_t finder_match (const struct finder *finder, const char *path,
+			const char *header)
+{
+    const char *dot = strrchr (path, '.');
+    gl_list_t ok_formats, formats;
+    gl_list_iterator_t format_iter;
+    const struct binfmt *binfmt;
+    int pass;
+
+    ok_formats = matcher_match (finder->matcher, header,
+				dot ? dot + 1 : NULL);
+    if (finder->check_enabled)
+	ok_formats = filter_enabled (finder, ok_formats);
+
+    formats = gl_list_create_empty (GL_ARRAY_LIST, NULL, NULL, NULL, true);
+    for (pass = 1; pass >= 0; --pass) {
+	format_iter = gl_list_iterator (ok_formats);
+	while (gl_list_iterator_next (&format_iter, (const void **) &binfmt,
+				      NULL))
+	    if (has_detector (binfmt) == pass)
+		gl_list_add_last (formats, binfmt);
+	gl_list_iterator_free (&format_iter);
+    }
+    gl_list_free (ok_formats);
+    return formats;
+}
+
+/* Find the interpreters for path.  If fd is non-negative, it is already open
+ * on path (for instance, because the kernel handed it to us) and is used
+ * instead of opening path again.
+ */
+gl_list_t find_interpreters (const char *path, int fd, int flags)
+{
+    struct finder *finder;
+    gl_list_t interpreters;
+    int our_fd = -1;
+
+    finder = finder_new (0);
+    trace_mark (TRACE_LOAD);
+    if (fd < 0) {
+	fd = our_fd = open (path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+	    quit_err ("unable to open %s", path);
+    }
+    interpreters = finder_find (finder, path, fd, flags);
+    if (our_fd >= 0)
+	close (our_fd);
+    finder_free (finder);
     return interpreters;
 }
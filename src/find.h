@@ -18,5 +18,27 @@
  */
 
 #include "gl_xlist.h"
+#include "hash.h"
 
-gl_list_t find_interpreters (const char *path);
+struct finder;
+
+gl_list_t scan_formats (const char *dir_name, int enabled_only, int quiet);
+gl_list_t load_formats (int enabled_only, int quiet);
+/* Flags for find_interpreters. */
+#define FIND_PARALLEL	1	/* run detectors at once */
+#define FIND_CACHE	2	/* use the verdict cache in rundir */
+#define FIND_PROFILE	4	/* count uncached choices in the usage profile */
+#define FIND_FIRST	8	/* with FIND_PARALLEL, keep only the first match */
+
+struct finder *finder_new (int index_only);
+struct finder *finder_new_enabled (gl_list_t formats, Hash_table *enabled);
+int finder_current (const struct finder *finder);
+void finder_preload (const struct finder *finder);
+gl_list_t finder_find (struct finder *finder, const char *path, int fd,
+		       int flags);
+size_t finder_toread (const struct finder *finder);
+gl_list_t finder_match (const struct finder *finder, const char *path,
+			const char *header);
+void finder_free (struct finder *finder);
+void finder_free_all (struct finder *finder);
+gl_list_t find_interpreters (const char *path, int fd, int flags);
@@ -31,10 +31,12 @@
 
 #include "hash.h"
 #include "xalloc.h"
+#include "xvasprintf.h"
 
 #include "error.h"
 #include "kvhash.h"
 #include "format.h"
+#include "paths.h"
 
 struct binfmt *binfmt_load (const char *name, const char *filename, int quiet)
 {
@@ -42,8 +44,11 @@ struct binfmt *binfmt_load (const char *name, const char *filename, int quiet)
     struct binfmt *binfmt;
 
     binfmt_file = fopen (filename, "r");
-    if (!binfmt_file)
+    if (!binfmt_file) {
+	if (quiet)
+	    return NULL;
 	quit_err ("unable to open %s", filename);
+    }
 
     binfmt = xzalloc (sizeof *binfmt);
     binfmt->name = xstrdup (name);
@@ -58,6 +63,7 @@ struct binfmt *binfmt_load (const char *name, const char *filename, int quiet)
 	    binfmt->field = xstrdup (""); \
 	else if (quiet) { \
 	    binfmt_free (binfmt); \
+	    fclose (binfmt_file); \
 	    return NULL; \
 	} else \
 	    quit ("%s corrupt: out of binfmt data reading %s", \
@@ -77,6 +83,10 @@ struct binfmt *binfmt_load (const char *name, const char *filename, int quiet)
     READ_LINE (detector, 1);
     READ_LINE (credentials, 1);
     READ_LINE (preserve, 1);
+    READ_LINE (open_binary, 1);
+    READ_LINE (fix_binary, 1);
+    READ_LINE (rule, 1);
+    READ_LINE (priority, 1);
 
 #undef READ_LINE
 
@@ -91,13 +101,14 @@ struct binfmt *binfmt_new (const char *name, Hash_table *args)
     binfmt = xzalloc (sizeof *binfmt);
     binfmt->name = xstrdup (name);
 
-#define SET_FIELD(field) do { \
-    const char *value = kvhash_lookup (args, #field); \
+#define SET_FIELD_KEY(field, key) do { \
+    const char *value = kvhash_lookup (args, key); \
     /* value may be NULL, as update-binfmts' parser is simpler that way. */ \
     if (value && strchr (value, '\n')) \
 	quit ("newlines prohibited in binfmt files (%s)", value); \
     binfmt->field = value ? xstrdup (value) : NULL; \
 } while (0)
+#define SET_FIELD(field) SET_FIELD_KEY (field, #field)
 
     SET_FIELD (package);
     SET_FIELD (type);
@@ -108,8 +119,13 @@ struct binfmt *binfmt_new (const char *name, Hash_table *args)
     SET_FIELD (detector);
     SET_FIELD (credentials);
     SET_FIELD (preserve);
+    SET_FIELD_KEY (open_binary, "open-binary");
+    SET_FIELD_KEY (fix_binary, "fix-binary");
+    SET_FIELD (rule);
+    SET_FIELD (priority);
 
 #undef SET_FIELD
+#undef SET_FIELD_KEY
 
     if (!binfmt->type) {
 	if (binfmt->magic) {
@@ -182,6 +198,10 @@ int binfmt_write (const struct binfmt *binfmt, const char *filename)
     WRITE_FIELD (detector);
     WRITE_FIELD (credentials);
     WRITE_FIELD (preserve);
+    WRITE_FIELD (open_binary);
+    WRITE_FIELD (fix_binary);
+    WRITE_FIELD (rule);
+    WRITE_FIELD (priority);
 
 #undef WRITE_FIELD
 
@@ -195,8 +215,9 @@ int binfmt_write (const struct binfmt *binfmt, const char *filename)
 
 void binfmt_print (const struct binfmt *binfmt)
 {
-#define PRINT_FIELD(field) \
-    printf ("%12s = %s\n", #field, binfmt->field ? binfmt->field : "")
+#define PRINT_FIELD_KEY(field, key) \
+    printf ("%12s = %s\n", key, binfmt->field ? binfmt->field : "")
+#define PRINT_FIELD(field) PRINT_FIELD_KEY (field, #field)
 
     PRINT_FIELD (package);
     PRINT_FIELD (type);
@@ -207,8 +228,13 @@ void binfmt_print (const struct binfmt *binfmt)
     PRINT_FIELD (detector);
     PRINT_FIELD (credentials);
     PRINT_FIELD (preserve);
+    PRINT_FIELD_KEY (open_binary, "open-binary");
+    PRINT_FIELD_KEY (fix_binary, "fix-binary");
+    PRINT_FIELD (rule);
+    PRINT_FIELD (priority);
 
 #undef PRINT_FIELD
+#undef PRINT_FIELD_KEY
 }
 
 int binfmt_equals (const struct binfmt *left, const struct binfmt *right)
@@ -219,6 +245,159 @@ int binfmt_equals (const struct binfmt *left, const struct binfmt *right)
 	    !strcmp (left->mask, right->mask));
 }
 
+/* Decode the hex dump in str, as the kernel prints magic and mask. */
+static char *decode_hex (const char *str, size_t *size)
+{
+    size_t len = strlen (str), i;
+    char *out;
+
+    if (len % 2)
+	return NULL;
+    out = xmalloc (len / 2 + 1);
+    for (i = 0; i < len / 2; ++i) {
+	char in[3];
+	char *end;
+
+	in[0] = str[i * 2];
+	in[1] = str[i * 2 + 1];
+	in[2] = '\0';
+	out[i] = (char) strtol (in, &end, 16);
+	if (end != in + 2) {
+	    free (out);
+	    return NULL;
+	}
+    }
+    out[i] = '\0';
+    *size = i;
+    return out;
+}
+
+/* Parse the kernel's entry called name into a binfmt, with its magic and
+ * mask expanded as by load_formats.  Return NULL if the entry is disabled
+ * or cannot be parsed.
+ */
+struct binfmt *binfmt_load_kernel (const char *name)
+{
+    char *procdir_name;
+    FILE *entry_file;
+    struct binfmt *binfmt;
+    char *line = NULL;
+    size_t n = 0, mask_size = 0;
+    ssize_t len;
+    int enabled = 0, ok = 1;
+
+    procdir_name = xasprintf ("%s/%s", procdir, name);
+    entry_file = fopen (procdir_name, "r");
+    free (procdir_name);
+    if (!entry_file)
+	return NULL;
+
+    binfmt = xzalloc (sizeof *binfmt);
+    binfmt->name = xstrdup (name);
+    while (ok && (len = getline (&line, &n, entry_file)) != -1) {
+	if (len && line[len - 1] == '\n')
+	    line[--len] = '\0';
+	if (!strcmp (line, "enabled"))
+	    enabled = 1;
+	else if (!strncmp (line, "interpreter ", 12) && !binfmt->interpreter)
+	    binfmt->interpreter = xstrdup (line + 12);
+	else if (!strncmp (line, "flags: ", 7) && !binfmt->credentials) {
+	    const char *flags = line + 7;
+
+	    binfmt->credentials = xstrdup (strchr (flags, 'C') ? "yes" : "no");
+	    binfmt->preserve = xstrdup (strchr (flags, 'P') ? "yes" : "no");
+	    binfmt->open_binary = xstrdup (strchr (flags, 'O') ? "yes" : "no");
+	    binfmt->fix_binary = xstrdup (strchr (flags, 'F') ? "yes" : "no");
+	} else if (!strncmp (line, "extension .", 11) && !binfmt->type) {
+	    binfmt->type = xstrdup ("extension");
+	    binfmt->magic = xstrdup (line + 11);
+	    binfmt->magic_size = strlen (binfmt->magic);
+	} else if (!strncmp (line, "offset ", 7) && !binfmt->offset)
+	    binfmt->offset = xstrdup (line + 7);
+	else if (!strncmp (line, "magic ", 6) && !binfmt->type) {
+	    binfmt->type = xstrdup ("magic");
+	    binfmt->magic = decode_hex (line + 6, &binfmt->magic_size);
+	    ok = binfmt->magic != NULL;
+	} else if (!strncmp (line, "mask ", 5) && !binfmt->mask) {
+	    binfmt->mask = decode_hex (line + 5, &mask_size);
+	    ok = binfmt->mask != NULL;
+	}
+    }
+    free (line);
+    fclose (entry_file);
+
+    if (!ok || !enabled || !binfmt->type || !binfmt->interpreter ||
+	(binfmt->mask && mask_size != binfmt->magic_size)) {
+	binfmt_free (binfmt);
+	return NULL;
+    }
+
+#define DEFAULT_FIELD(field, value) do { \
+    if (!binfmt->field) \
+	binfmt->field = xstrdup (value); \
+} while (0)
+
+    DEFAULT_FIELD (package, "");
+    DEFAULT_FIELD (offset, "0");
+    DEFAULT_FIELD (mask, "");
+    DEFAULT_FIELD (detector, "");
+    DEFAULT_FIELD (credentials, "no");
+    DEFAULT_FIELD (preserve, "no");
+    DEFAULT_FIELD (open_binary, "no");
+    DEFAULT_FIELD (fix_binary, "no");
+    DEFAULT_FIELD (rule, "");
+    DEFAULT_FIELD (priority, "");
+
+#undef DEFAULT_FIELD
+
+    return binfmt;
+}
+
+static int flag_yes (const char *flag)
+{
+    return flag && !strcmp (flag, "yes");
+}
+
+/* Return true if kernel, from binfmt_load_kernel, is the entry that
+ * registering wanted (expanded as by load_formats) with the given
+ * interpreter would make.  The kernel turns on open-binary whenever
+ * credentials is set, so wanted is compared as it would be registered.
+ */
+int binfmt_kernel_matches (const struct binfmt *kernel,
+			   const struct binfmt *wanted,
+			   const char *interpreter)
+{
+    size_t i;
+
+    if (strcmp (kernel->type, wanted->type) ||
+	strcmp (kernel->interpreter, interpreter) ||
+	flag_yes (kernel->credentials) != flag_yes (wanted->credentials) ||
+	flag_yes (kernel->preserve) != flag_yes (wanted->preserve) ||
+	flag_yes (kernel->open_binary) !=
+	    (flag_yes (wanted->open_binary) ||
+	     flag_yes (wanted->credentials)) ||
+	flag_yes (kernel->fix_binary) != flag_yes (wanted->fix_binary))
+	return 0;
+    if (!strcmp (wanted->type, "extension"))
+	return !strcmp (kernel->magic, wanted->magic);
+
+    if (strtol (kernel->offset, NULL, 10) !=
+	    strtol (wanted->offset, NULL, 10) ||
+	kernel->magic_size != wanted->magic_size ||
+	!*kernel->mask != !*wanted->mask)
+	return 0;
+    /* The kernel may keep magic with the mask already applied. */
+    for (i = 0; i < wanted->magic_size; ++i) {
+	unsigned char mask = *wanted->mask ? wanted->mask[i] : 0xff;
+
+	if (*wanted->mask && kernel->mask[i] != wanted->mask[i])
+	    return 0;
+	if ((kernel->magic[i] ^ wanted->magic[i]) & mask)
+	    return 0;
+    }
+    return 1;
+}
+
 void binfmt_free (struct binfmt *binfmt)
 {
     free (binfmt->name);
@@ -231,10 +410,19 @@ void binfmt_free (struct binfmt *binfmt)
     free (binfmt->detector);
     free (binfmt->credentials);
     free (binfmt->preserve);
+    free (binfmt->open_binary);
+    free (binfmt->fix_binary);
+    free (binfmt->rule);
+    free (binfmt->priority);
     free (binfmt);
 }
 
-void binfmt_hash_free (void *binfmt)
+/* Tables made with kvhash_initialize hand their data freer whole elements. */
+void binfmt_hash_free (void *data)
 {
-    binfmt_free ((struct binfmt *) binfmt);
+    struct kvelem *elem = data;
+
+    free (elem->key);
+    binfmt_free (elem->value);
+    free (elem);
 }
@@ -20,6 +20,8 @@
 
 #include "hash.h"
 
+struct builtin_args;
+
 struct binfmt {
     char *name;
     char *package;
@@ -32,6 +34,12 @@ struct binfmt {
     char *detector;
     char *credentials;
     char *preserve;
+    char *open_binary;
+    char *fix_binary;
+    char *rule;
+    char *priority;
+    /* Only used in run-detectors; NULL if not parsed ahead of time. */
+    const struct builtin_args *builtin_args;
 };
 
 struct binfmt *binfmt_load (const char *name, const char *filename, int quiet);
@@ -39,5 +47,9 @@ struct binfmt *binfmt_new (const char *name, Hash_table *args);
 int binfmt_write (const struct binfmt *binfmt, const char *filename);
 void binfmt_print (const struct binfmt *binfmt);
 int binfmt_equals (const struct binfmt *left, const struct binfmt *right);
+struct binfmt *binfmt_load_kernel (const char *name);
+int binfmt_kernel_matches (const struct binfmt *kernel,
+			   const struct binfmt *wanted,
+			   const char *interpreter);
 void binfmt_free (struct binfmt *binfmt);
-void binfmt_hash_free (void *binfmt);
+void binfmt_hash_free (void *data);
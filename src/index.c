@@ -0,0 +1,534 @@
+/* index.c - compiled index of binary formats
+ *
+ * Copyright (c) 2026 agent <agent@local>.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/* run-detectors is executed for every file handled by a format with a
+ * detector, so re-parsing every file in admindir each time is wasteful.
+ * update-binfmts instead compiles the whole database into a single file
+ * whenever it changes: magic and mask are stored with their escapes
+ * already expanded, and everything else is a NUL-terminated string.  The
+ * tables of a matcher for those formats are stored too, so that readers
+ * need not build one for every file they look at.  Since the index is only
+ * ever read on this machine, it is written in native byte order.
+ *
+ * The index records the modification time of admindir after the index
+ * itself has been renamed into place.  If anything else changes admindir
+ * later, the times no longer match and readers fall back to scanning
+ * admindir.
+ *
+ * The index is also the snapshot of the database that readers use while
+ * update-binfmts is changing it.  Before touching admindir, update-binfmts
+ * marks the current index as pending, and readers go on trusting a pending
+ * index even though admindir has changed under it, so they never see a
+ * database that is half-way through an upgrade.  The new index replaces
+ * it with a single rename, and the mark is only cleared once its stamp is
+ * in place.  Readers take no locks and never wait; if update-binfmts dies
+ * part way, readers keep the old snapshot until it next runs.
+ *
+ * The index also carries the boot plan: the registration strings that
+ * "update-binfmts --enable" would write with the database as it stands,
+ * already in registration order.  Keeping it here means that it is
+ * regenerated and checked for staleness along with everything else.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "gl_xlist.h"
+#include "gl_array_list.h"
+#include "xalloc.h"
+#include "xstrndup.h"
+#include "xvasprintf.h"
+
+#include "builtin.h"
+#include "error.h"
+#include "format.h"
+#include "index.h"
+#include "match.h"
+#include "paths.h"
+
+#define INDEX_MAGIC "BFINDEX"
+#define INDEX_VERSION 10
+
+struct index_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t count;
+    uint64_t generation;
+    /* Modification time of admindir once the index was in place.  Zero
+     * while the index is being written.
+     */
+    int64_t stamp_sec;
+    int64_t stamp_nsec;
+    /* Non-zero if the index is to be used whatever the stamp says. */
+    uint32_t pending;
+    uint32_t reserved;
+    uint32_t matcher;
+    uint32_t matcher_size;
+    uint32_t strings;
+    uint32_t plan;	/* runs to the end of the file */
+    uint32_t size;
+};
+
+/* Each field is an offset into the string table, apart from magic_size
+ * and builtin_args.
+ */
+struct index_entry {
+    uint32_t name;
+    uint32_t package;
+    uint32_t type;
+    uint32_t offset;
+    uint32_t magic;
+    uint32_t magic_size;
+    uint32_t mask;
+    uint32_t interpreter;
+    uint32_t detector;
+    uint32_t credentials;
+    uint32_t preserve;
+    uint32_t open_binary;
+    uint32_t fix_binary;
+    uint32_t rule;
+    uint32_t priority;
+    struct builtin_args builtin_args;	/* if the detector is built in */
+};
+
+struct strbuf {
+    char *data;
+    size_t len, alloc;
+};
+
+static uint32_t strbuf_add (struct strbuf *buf, const char *data, size_t len)
+{
+    uint32_t offset = buf->len;
+
+    if (buf->len + len + 1 > buf->alloc) {
+	buf->alloc = (buf->len + len + 1) * 2;
+	buf->data = xrealloc (buf->data, buf->alloc);
+    }
+    memcpy (buf->data + buf->len, data, len);
+    buf->data[buf->len + len] = '\0';
+    buf->len += len + 1;
+    return offset;
+}
+
+static char *index_path (void)
+{
+    return xasprintf ("%s/%s", admindir, INDEX_NAME);
+}
+
+/* Read the generation of the current index, if any, without checking
+ * whether it is stale.  If there is none, start from the current time
+ * rather than from zero, so that verdicts cached for a deleted index are
+ * never mistaken for verdicts about a new one.
+ */
+static uint64_t index_generation (const char *path)
+{
+    int fd;
+    struct index_header header;
+    uint64_t generation = (uint64_t) time (NULL) << 20;
+
+    fd = open (path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+	return generation;
+    if (read (fd, &header, sizeof header) == sizeof header &&
+	!memcmp (header.magic, INDEX_MAGIC, sizeof header.magic))
+	generation = header.generation;
+    close (fd);
+    return generation;
+}
+
+/* Write an index of formats, which must already have been expanded by
+ * load_formats, along with a boot plan (which may be NULL).
+ */
+int index_write (gl_list_t formats, const char *plan)
+{
+    char *path, *path_tmp;
+    struct index_header header;
+    struct index_entry *entries;
+    struct strbuf strings = { NULL, 0, 0 };
+    struct matcher *matcher;
+    void *matcher_data;
+    size_t matcher_size;
+    gl_list_iterator_t format_iter;
+    const struct binfmt *binfmt;
+    size_t count, i;
+    size_t plan_size = plan ? strlen (plan) : 0;
+    struct stat st;
+    int fd;
+    int ret = 0;
+
+    path = index_path ();
+    path_tmp = xasprintf ("%s.tmp", path);
+
+    count = gl_list_size (formats);
+    entries = xcalloc (count ? count : 1, sizeof *entries);
+    i = 0;
+    format_iter = gl_list_iterator (formats);
+    while (gl_list_iterator_next (&format_iter, (const void **) &binfmt,
+				  NULL)) {
+	struct index_entry *entry = &entries[i++];
+
+#define ADD_STRING(field) \
+	entry->field = strbuf_add (&strings, binfmt->field, \
+				   strlen (binfmt->field))
+
+	ADD_STRING (name);
+	ADD_STRING (package);
+	ADD_STRING (type);
+	ADD_STRING (offset);
+	entry->magic = strbuf_add (&strings, binfmt->magic,
+				   binfmt->magic_size);
+	entry->magic_size = binfmt->magic_size;
+	/* The mask is either empty or the same size as the magic. */
+	entry->mask = strbuf_add (&strings, binfmt->mask,
+				  *binfmt->mask ? binfmt->magic_size : 0);
+	ADD_STRING (interpreter);
+	ADD_STRING (detector);
+	ADD_STRING (credentials);
+	ADD_STRING (preserve);
+	ADD_STRING (open_binary);
+	ADD_STRING (fix_binary);
+	ADD_STRING (rule);
+	ADD_STRING (priority);
+
+#undef ADD_STRING
+
+	if (builtin_name (binfmt->detector))
+	    builtin_parse (builtin_name (binfmt->detector),
+			   &entry->builtin_args);
+    }
+    gl_list_iterator_free (&format_iter);
+
+    matcher = matcher_new (formats);
+    matcher_data = matcher_serialize (matcher, &matcher_size);
+    matcher_free (matcher);
+
+    memset (&header, 0, sizeof header);
+    memcpy (header.magic, INDEX_MAGIC, sizeof header.magic);
+    header.version = INDEX_VERSION;
+    /* Complete as soon as it is renamed into place, before it is stamped. */
+    header.pending = 1;
+    header.count = count;
+    header.generation = index_generation (path) + 1;
+    header.matcher = sizeof header + count * sizeof *entries;
+    header.matcher_size = matcher_size;
+    header.strings = header.matcher + matcher_size;
+    header.plan = header.strings + strings.len;
+    header.size = header.plan + plan_size;
+
+    if (unlink (path_tmp) == -1 && errno != ENOENT) {
+	warning_err ("unable to ensure %s nonexistent", path_tmp);
+	goto out;
+    }
+    fd = open (path_tmp, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (fd < 0) {
+	warning_err ("unable to open %s for writing", path_tmp);
+	goto out;
+    }
+    if (write (fd, &header, sizeof header) != sizeof header ||
+	write (fd, entries, count * sizeof *entries) !=
+	    (ssize_t) (count * sizeof *entries) ||
+	write (fd, matcher_data, matcher_size) != (ssize_t) matcher_size ||
+	write (fd, strings.data, strings.len) != (ssize_t) strings.len ||
+	write (fd, plan ? plan : "", plan_size) != (ssize_t) plan_size) {
+	warning_err ("unable to write %s", path_tmp);
+	close (fd);
+	unlink (path_tmp);
+	goto out;
+    }
+    /* Make sure the new index is on disk before it replaces the old one,
+     * or a crash could leave an index with nothing in it.
+     */
+    if (fsync (fd) == -1) {
+	warning_err ("unable to sync %s", path_tmp);
+	close (fd);
+	unlink (path_tmp);
+	goto out;
+    }
+    if (rename (path_tmp, path) == -1) {
+	warning_err ("unable to install %s as %s", path_tmp, path);
+	close (fd);
+	unlink (path_tmp);
+	goto out;
+    }
+
+    /* Only now is admindir in the state that the index describes. */
+    if (stat (admindir, &st) == -1) {
+	warning_err ("unable to stat %s", admindir);
+	close (fd);
+	goto out;
+    }
+    header.stamp_sec = st.st_mtim.tv_sec;
+    header.stamp_nsec = st.st_mtim.tv_nsec;
+    header.pending = 0;
+    if (pwrite (fd, &header, sizeof header, 0) != sizeof header) {
+	warning_err ("unable to write %s", path);
+	close (fd);
+	goto out;
+    }
+    if (close (fd)) {
+	warning_err ("unable to close %s", path);
+	goto out;
+    }
+    ret = 1;
+
+out:
+    /* The old index may be marked pending, and must not outlive this. */
+    if (!ret)
+	unlink (path);
+    free (matcher_data);
+    free (strings.data);
+    free (entries);
+    free (path_tmp);
+    free (path);
+    return ret;
+}
+
+/* Mark the current index as pending, if it is up to date; see above.
+ * Failures are ignored, as readers then simply fall back to scanning
+ * admindir while it changes.
+ */
+void index_begin_update (void)
+{
+    char *path;
+    int fd;
+    struct stat admin_st;
+    struct index_header header;
+    uint32_t pending = 1;
+
+    if (stat (admindir, &admin_st) == -1)
+	return;
+    path = index_path ();
+    fd = open (path, O_RDWR | O_CLOEXEC);
+    free (path);
+    if (fd < 0)
+	return;
+    if (read (fd, &header, sizeof header) == sizeof header &&
+	!memcmp (header.magic, INDEX_MAGIC, sizeof header.magic) &&
+	header.version == INDEX_VERSION &&
+	header.stamp_sec == admin_st.st_mtim.tv_sec &&
+	header.stamp_nsec == admin_st.st_mtim.tv_nsec)
+	pwrite (fd, &pending, sizeof pending,
+		offsetof (struct index_header, pending));
+    close (fd);
+}
+
+/* Map the index if it is usable and still up to date, or pending, setting
+ * *size to the size of the mapping and *st to the index's status.
+ */
+static const char *index_map (size_t *size, struct stat *st_out)
+{
+    char *path;
+    int fd;
+    struct stat st, admin_st;
+    const char *map;
+    const struct index_header *header;
+
+    if (stat (admindir, &admin_st) == -1)
+	return NULL;
+    path = index_path ();
+    fd = open (path, O_RDONLY | O_CLOEXEC);
+    free (path);
+    if (fd < 0)
+	return NULL;
+    if (fstat (fd, &st) == -1 || st.st_size < (off_t) sizeof *header) {
+	close (fd);
+	return NULL;
+    }
+    map = mmap (NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close (fd);
+    if (map == MAP_FAILED)
+	return NULL;
+
+    header = (const struct index_header *) map;
+    if (memcmp (header->magic, INDEX_MAGIC, sizeof header->magic) ||
+	header->version != INDEX_VERSION ||
+	header->size != st.st_size ||
+	header->matcher != sizeof *header +
+			   header->count * sizeof (struct index_entry) ||
+	header->strings != header->matcher + header->matcher_size ||
+	header->strings > header->plan ||
+	header->plan > header->size ||
+	(header->plan > header->strings && map[header->plan - 1] != '\0') ||
+	(!__atomic_load_n (&header->pending, __ATOMIC_ACQUIRE) &&
+	 (header->stamp_sec != admin_st.st_mtim.tv_sec ||
+	  header->stamp_nsec != admin_st.st_mtim.tv_nsec))) {
+	munmap ((void *) map, st.st_size);
+	return NULL;
+    }
+    *size = st.st_size;
+    if (st_out)
+	*st_out = st;
+    return map;
+}
+
+/* Map the index and return a list of the formats it contains, or NULL if
+ * there is no usable index.  If matcher is non-NULL, it is set to a
+ * matcher for those formats.  The formats and the matcher's tables point
+ * into the mapping, so the formats must not be freed individually; once
+ * nothing refers to them any more, free the list and the matcher and then
+ * call index_unload.
+ */
+gl_list_t index_load (struct index_snapshot *snapshot,
+		      struct matcher **matcher)
+{
+    struct stat st;
+    size_t size;
+    const char *map;
+    const struct index_header *header;
+    const struct index_entry *entries;
+    struct binfmt *binfmts;
+    gl_list_t formats;
+    size_t i;
+
+    map = index_map (&size, &st);
+    if (!map)
+	return NULL;
+    header = (const struct index_header *) map;
+    entries = (const struct index_entry *) (map + sizeof *header);
+
+    binfmts = xcalloc (header->count ? header->count : 1, sizeof *binfmts);
+    formats = gl_list_create_empty (GL_ARRAY_LIST, NULL, NULL, NULL, true);
+    for (i = 0; i < header->count; ++i) {
+	const struct index_entry *entry = &entries[i];
+	struct binfmt *binfmt = &binfmts[i];
+	const char *strings = map + header->strings;
+	size_t strings_size = header->plan - header->strings;
+
+#define GET_STRING(field) do { \
+    if (entry->field >= strings_size) \
+	goto corrupt; \
+    binfmt->field = (char *) strings + entry->field; \
+} while (0)
+
+	GET_STRING (name);
+	GET_STRING (package);
+	GET_STRING (type);
+	GET_STRING (offset);
+	GET_STRING (magic);
+	GET_STRING (mask);
+	GET_STRING (interpreter);
+	GET_STRING (detector);
+	GET_STRING (credentials);
+	GET_STRING (preserve);
+	GET_STRING (open_binary);
+	GET_STRING (fix_binary);
+	GET_STRING (rule);
+	GET_STRING (priority);
+
+#undef GET_STRING
+
+	if (entry->magic_size >= strings_size - entry->magic)
+	    goto corrupt;
+	binfmt->magic_size = entry->magic_size;
+	if (builtin_name (binfmt->detector))
+	    binfmt->builtin_args = &entry->builtin_args;
+	gl_list_add_last (formats, binfmt);
+    }
+
+    if (matcher) {
+	*matcher = matcher_load (formats, map + header->matcher,
+				 header->matcher_size);
+	if (!*matcher)
+	    goto corrupt;
+    }
+    if (snapshot) {
+	snapshot->generation = header->generation;
+	snapshot->dev = st.st_dev;
+	snapshot->ino = st.st_ino;
+	snapshot->map = map;
+	snapshot->size = size;
+	snapshot->binfmts = binfmts;
+    }
+    return formats;
+
+corrupt:
+    gl_list_free (formats);
+    free (binfmts);
+    munmap ((void *) map, size);
+    return NULL;
+}
+
+/* Free the formats that index_load returned along with snapshot, and
+ * unmap the index.
+ */
+void index_unload (struct index_snapshot *snapshot)
+{
+    free (snapshot->binfmts);
+    munmap ((void *) snapshot->map, snapshot->size);
+    snapshot->map = NULL;
+    snapshot->binfmts = NULL;
+}
+
+/* Return non-zero if snapshot is still the index in place.  This costs
+ * one stat, and never waits for update-binfmts.
+ */
+int index_snapshot_current (const struct index_snapshot *snapshot)
+{
+    char *path = index_path ();
+    struct stat st;
+    int ret;
+
+    ret = stat (path, &st) == 0 &&
+	  st.st_dev == snapshot->dev && st.st_ino == snapshot->ino;
+    free (path);
+    return ret;
+}
+
+/* Return non-zero if update-binfmts is changing admindir under snapshot.
+ * It marks the index pending in place, so this shows up in the mapping.
+ */
+int index_snapshot_pending (const struct index_snapshot *snapshot)
+{
+    const struct index_header *header =
+	(const struct index_header *) snapshot->map;
+
+    return __atomic_load_n (&header->pending, __ATOMIC_ACQUIRE);
+}
+
+/* Return a copy of the boot plan from the index, or NULL if there is no
+ * usable index.
+ */
+char *index_load_plan (void)
+{
+    size_t size;
+    const char *map;
+    const struct index_header *header;
+    char *plan;
+
+    map = index_map (&size, NULL);
+    if (!map)
+	return NULL;
+    header = (const struct index_header *) map;
+    plan = xstrndup (map + header->plan, header->size - header->plan);
+    munmap ((void *) map, size);
+    return plan;
+}
@@ -0,0 +1,54 @@
+/* index.h - compiled index of binary formats
+ *
+ * Copyright (c) 2026 agent <agent@local>.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "gl_xlist.h"
+
+struct binfmt;
+struct matcher;
+
+/* Name of the index within admindir.  Names starting with '.' are never
+ * treated as binary formats.
+ */
+#define INDEX_NAME ".index"
+
+/* Identifies the index that index_load used.  The index is only ever
+ * replaced by renaming a new one over it, so a new snapshot of the
+ * database always has a new inode.
+ */
+struct index_snapshot {
+    uint64_t generation;
+    dev_t dev;
+    ino_t ino;
+    /* What the formats from index_load point into; see index_unload. */
+    const char *map;
+    size_t size;
+    struct binfmt *binfmts;
+};
+
+void index_begin_update (void);
+int index_write (gl_list_t formats, const char *plan);
+gl_list_t index_load (struct index_snapshot *snapshot,
+		      struct matcher **matcher);
+void index_unload (struct index_snapshot *snapshot);
+int index_snapshot_current (const struct index_snapshot *snapshot);
+int index_snapshot_pending (const struct index_snapshot *snapshot);
+char *index_load_plan (void);
@@ -45,8 +45,12 @@ bool kvhash_comparator (const void *a, const void *b)
 Hash_table *kvhash_initialize (size_t candidate, const Hash_tuning *tuning,
 			       Hash_data_freer data_freer)
 {
-    return hash_initialize (candidate, tuning,
-			    kvhash_hasher, kvhash_comparator, data_freer);
+    Hash_table *table = hash_initialize (candidate, tuning, kvhash_hasher,
+					 kvhash_comparator, data_freer);
+
+    if (!table)
+	xalloc_die ();
+    return table;
 }
 
 bool kvhash_exists (const Hash_table *table, const char *key)
@@ -80,11 +84,13 @@ void *kvhash_insert (Hash_table *table, const char *key, const void *value)
     entry->value = (void *) value;
 
     ret = hash_insert (table, entry);
+    if (!ret)
+	xalloc_die ();
     if (ret != entry) {
 	free (entry->key);
 	free (entry);
     }
-    return ret ? ret->value : NULL;
+    return ret->value;
 }
 
 extern void *kvhash_delete (Hash_table *table, const char *key)
@@ -103,3 +109,22 @@ extern void *kvhash_delete (Hash_table *table, const char *key)
     } else
 	return NULL;
 }
+
+/* Data freers for tables whose values are not owned by the table, and for
+ * tables whose values are single blocks of memory from malloc.
+ */
+void kvhash_free_key (void *data)
+{
+    struct kvelem *elem = data;
+
+    free (elem->key);
+    free (elem);
+}
+
+void kvhash_free_pair (void *data)
+{
+    struct kvelem *elem = data;
+
+    free (elem->value);
+    kvhash_free_key (elem);
+}
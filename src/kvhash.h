@@ -32,3 +32,5 @@ bool kvhash_exists (const Hash_table *table, const char *key);
 void *kvhash_lookup (const Hash_table *table, const char *key);
 void *kvhash_insert (Hash_table *table, const char *key, const void *value);
 void *kvhash_delete (Hash_table *table, const char *key);
+void kvhash_free_key (void *data);
+void kvhash_free_pair (void *data);
@@ -0,0 +1,132 @@
+/* launch.c - run detector programs
+ *
+ * Copyright (c) 2026 agent <agent@local>.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/* Detectors are run a great deal and need nothing more than an argument
+ * and an exit status, so they are started with posix_spawn rather than
+ * libpipeline.  glibc implements posix_spawn with a vfork-style clone, so
+ * the cost of starting a detector does not grow with the size of the
+ * process starting it.
+ *
+ * A detector may be run by run-detectors or by detectord, and its verdict
+ * may be cached and reused by other processes, so it must not depend on
+ * the environment of whichever process happens to run it.  Detectors get a
+ * fixed environment instead, and are found on its PATH.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <spawn.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "xvasprintf.h"
+
+#include "error.h"
+#include "launch.h"
+
+#define DETECTOR_PATH "/usr/local/sbin:/usr/local/bin:/usr/sbin:/usr/bin:" \
+		      "/sbin:/bin"
+
+static char *detector_environ[] = {
+    "PATH=" DETECTOR_PATH,
+    NULL
+};
+
+/* Find detector on DETECTOR_PATH, as posix_spawnp would if it did not use
+ * our own PATH.  Returns a newly allocated path, or NULL if there is no
+ * such program.
+ */
+static char *search_path (const char *detector)
+{
+    const char *dir = DETECTOR_PATH;
+
+    for (;;) {
+	size_t len = strcspn (dir, ":");
+	char *path = xasprintf ("%.*s/%s", (int) len, dir, detector);
+
+	if (access (path, X_OK) == 0)
+	    return path;
+	free (path);
+	if (!dir[len])
+	    return NULL;
+	dir += len + 1;
+    }
+}
+
+/* Start detector with path as its only argument.  Returns the process ID,
+ * or -1 if the detector could not be started.
+ */
+pid_t launch_detector (const char *detector, const char *path)
+{
+    char *argv[3];
+    posix_spawnattr_t attr;
+    sigset_t none;
+    char *found = NULL;
+    pid_t pid;
+    int err;
+
+    if (!strchr (detector, '/')) {
+	found = search_path (detector);
+	if (!found) {
+	    errno = ENOENT;
+	    warning_err ("unable to run %s", detector);
+	    return -1;
+	}
+    }
+
+    argv[0] = (char *) detector;
+    argv[1] = (char *) path;
+    argv[2] = NULL;
+
+    posix_spawnattr_init (&attr);
+    sigemptyset (&none);
+    posix_spawnattr_setsigmask (&attr, &none);
+    posix_spawnattr_setflags (&attr, POSIX_SPAWN_SETSIGMASK);
+    err = posix_spawn (&pid, found ? found : detector, NULL, &attr, argv,
+		       detector_environ);
+    posix_spawnattr_destroy (&attr);
+    free (found);
+    if (err) {
+	errno = err;
+	warning_err ("unable to run %s", detector);
+	return -1;
+    }
+    return pid;
+}
+
+/* Wait for a detector to finish.  Returns its exit status, or -1 if it did
+ * not exit normally.
+ */
+int launch_wait (pid_t pid)
+{
+    int status;
+
+    while (waitpid (pid, &status, 0) == -1)
+	if (errno != EINTR)
+	    return -1;
+    if (!WIFEXITED (status))
+	return -1;
+    return WEXITSTATUS (status);
+}
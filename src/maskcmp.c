@@ -0,0 +1,201 @@
+/* maskcmp.c - check many masked magic strings against one header
+ *
+ * Copyright (c) 2026 agent <agent@local>.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/* Formats for different qemu-user targets typically share a long masked
+ * ELF header magic, so a matcher bucket may hold many formats that all
+ * need a full check.  Their magics and masks are laid out as padded rows
+ * in two separate pools, which lets each check be done a vector at a time
+ * straight from the tables with no copying.  Padding bytes have a zero
+ * mask and a zero magic, so they always compare equal.
+ *
+ * The best implementation that the CPU supports is chosen at run time.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <string.h>
+#include <limits.h>
+
+#include "maskcmp.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#  define MASKCMP_X86 1
+#  include <immintrin.h>
+#endif
+
+#define BITS (sizeof (unsigned long) * CHAR_BIT)
+#define MARK(matched, i) \
+    ((matched)[(i) / BITS] |= 1UL << ((i) % BITS))
+
+static void maskcmp_generic (const struct maskcmp_table *table,
+			     const unsigned char *header,
+			     const uint32_t *candidates, size_t n,
+			     unsigned long *matched)
+{
+    size_t i, j;
+
+    for (i = 0; i < n; ++i) {
+	uint32_t c = candidates[i];
+	const unsigned char *segment = header + table->offsets[c];
+	const unsigned char *magic = table->magics + table->rows[c];
+	const unsigned char *mask = table->masks + table->rows[c];
+	uint64_t diff = 0;
+
+	for (j = 0; j < table->widths[c]; j += sizeof diff) {
+	    uint64_t s, k, m;
+
+	    memcpy (&s, segment + j, sizeof s);
+	    memcpy (&k, mask + j, sizeof k);
+	    memcpy (&m, magic + j, sizeof m);
+	    diff = (s & k) ^ m;
+	    if (diff)
+		break;
+	}
+	if (!diff)
+	    MARK (matched, c);
+    }
+}
+
+#ifdef MASKCMP_X86
+
+__attribute__ ((target ("sse2")))
+static void maskcmp_sse2 (const struct maskcmp_table *table,
+			  const unsigned char *header,
+			  const uint32_t *candidates, size_t n,
+			  unsigned long *matched)
+{
+    size_t i, j;
+
+    for (i = 0; i < n; ++i) {
+	uint32_t c = candidates[i];
+	const unsigned char *segment = header + table->offsets[c];
+	const unsigned char *magic = table->magics + table->rows[c];
+	const unsigned char *mask = table->masks + table->rows[c];
+	int equal = 0xffff;
+
+	for (j = 0; j < table->widths[c]; j += 16) {
+	    __m128i s = _mm_loadu_si128 ((const __m128i *) (segment + j));
+	    __m128i k = _mm_loadu_si128 ((const __m128i *) (mask + j));
+	    __m128i m = _mm_loadu_si128 ((const __m128i *) (magic + j));
+
+	    equal = _mm_movemask_epi8
+		(_mm_cmpeq_epi8 (_mm_and_si128 (s, k), m));
+	    if (equal != 0xffff)
+		break;
+	}
+	if (equal == 0xffff)
+	    MARK (matched, c);
+    }
+}
+
+__attribute__ ((target ("avx2")))
+static void maskcmp_avx2 (const struct maskcmp_table *table,
+			  const unsigned char *header,
+			  const uint32_t *candidates, size_t n,
+			  unsigned long *matched)
+{
+    size_t i, j;
+
+    for (i = 0; i < n; ++i) {
+	uint32_t c = candidates[i];
+	const unsigned char *segment = header + table->offsets[c];
+	const unsigned char *magic = table->magics + table->rows[c];
+	const unsigned char *mask = table->masks + table->rows[c];
+	int equal = -1;
+
+	for (j = 0; j < table->widths[c]; j += 32) {
+	    __m256i s = _mm256_loadu_si256 ((const __m256i *) (segment + j));
+	    __m256i k = _mm256_loadu_si256 ((const __m256i *) (mask + j));
+	    __m256i m = _mm256_loadu_si256 ((const __m256i *) (magic + j));
+
+	    equal = _mm256_movemask_epi8
+		(_mm256_cmpeq_epi8 (_mm256_and_si256 (s, k), m));
+	    if (equal != -1)
+		break;
+	}
+	if (equal == -1)
+	    MARK (matched, c);
+    }
+}
+
+#endif /* MASKCMP_X86 */
+
+static const struct {
+    const char *name;
+    maskcmp_fn *fn;
+} implementations[] = {
+#ifdef MASKCMP_X86
+    { "avx2", maskcmp_avx2 },
+    { "sse2", maskcmp_sse2 },
+#endif
+    { "generic", maskcmp_generic },
+};
+
+#define N_IMPLEMENTATIONS (sizeof implementations / sizeof *implementations)
+
+static int supported (const char *name)
+{
+#ifdef MASKCMP_X86
+    __builtin_cpu_init ();
+    if (!strcmp (name, "avx2"))
+	return __builtin_cpu_supports ("avx2");
+    if (!strcmp (name, "sse2"))
+	return __builtin_cpu_supports ("sse2");
+#endif
+    return !strcmp (name, "generic");
+}
+
+/* Return the named implementation, or NULL if it does not exist or this
+ * CPU does not support it.
+ */
+maskcmp_fn *maskcmp_get (const char *name)
+{
+    size_t i;
+
+    for (i = 0; i < N_IMPLEMENTATIONS; ++i)
+	if (!strcmp (implementations[i].name, name))
+	    return supported (name) ? implementations[i].fn : NULL;
+    return NULL;
+}
+
+/* Return the fastest implementation that this CPU supports. */
+maskcmp_fn *maskcmp_best (void)
+{
+    static maskcmp_fn *best;
+    size_t i;
+
+    if (best)
+	return best;
+    for (i = 0; i < N_IMPLEMENTATIONS; ++i)
+	if (supported (implementations[i].name)) {
+	    best = implementations[i].fn;
+	    break;
+	}
+    return best;
+}
+
+/* Return the name of the i'th implementation, or NULL if there are no
+ * more.
+ */
+const char *maskcmp_names (size_t i)
+{
+    return i < N_IMPLEMENTATIONS ? implementations[i].name : NULL;
+}
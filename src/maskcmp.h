@@ -0,0 +1,50 @@
+/* maskcmp.h - check many masked magic strings against one header
+ *
+ * Copyright (c) 2026 agent <agent@local>.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Magic and mask rows are padded with zeroes to a multiple of this, and
+ * headers must be readable for this many bytes beyond the end of the
+ * longest magic.
+ */
+#define MASKCMP_ALIGN 32
+
+/* Format i matches if, for each of the widths[i] bytes from
+ * header[offsets[i]], (header & masks[rows[i]]) == magics[rows[i]].
+ */
+struct maskcmp_table {
+    const uint32_t *offsets;
+    const uint32_t *rows;
+    const uint32_t *widths;
+    const unsigned char *magics;
+    const unsigned char *masks;
+};
+
+/* Check each of the n formats in candidates against header, setting the
+ * bit for each one that matches in the matched bitmap.
+ */
+typedef void maskcmp_fn (const struct maskcmp_table *table,
+			 const unsigned char *header,
+			 const uint32_t *candidates, size_t n,
+			 unsigned long *matched);
+
+maskcmp_fn *maskcmp_get (const char *name);
+maskcmp_fn *maskcmp_best (void);
+const char *maskcmp_names (size_t i);
@@ -0,0 +1,653 @@
+/* match.c - match file headers against many binary formats at once
+ *
+ * Copyright (c) 2026 agent <agent@local>.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/* Checking every format against a file in turn gets slow once there are a
+ * few hundred of them.  Instead, each magic format is filed under a single
+ * key byte: a position in the header, the mask that applies at that
+ * position, and the value the masked byte must have.  Positions are chosen
+ * so that as few formats as possible share a value, while reusing
+ * positions where possible.  Matching then looks up one bucket per
+ * distinct (position, mask) pair and fully checks only the formats in
+ * those buckets, using a maskcmp kernel.  Formats whose mask ignores every
+ * byte go on a separate list that is always checked, and extension formats
+ * are kept sorted by extension.
+ *
+ * Matches are collected in a bitmap indexed by the position of each format
+ * in the original list, so the result is in exactly the same order as a
+ * linear scan would produce.
+ *
+ * All the tables are arrays of indices, so a matcher can be stored in the
+ * index and used directly from there (see matcher_serialize and
+ * matcher_load).
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <limits.h>
+
+#include "gl_xlist.h"
+#include "gl_array_list.h"
+#include "hash.h"
+#include "xalloc.h"
+
+#include "format.h"
+#include "maskcmp.h"
+#include "match.h"
+
+#define BUCKETS 256
+
+struct match_key {
+    uint32_t pos;
+    uint32_t mask;
+};
+
+struct matcher {
+    size_t count;
+    const struct binfmt **formats;
+    uint32_t *offsets;
+    size_t toread;
+
+    /* starts has BUCKETS + 1 entries per key, indexing members. */
+    size_t nkeys;
+    struct match_key *keys;
+    uint32_t *starts;
+    size_t nmembers;
+    uint32_t *members;
+
+    size_t nalways;
+    uint32_t *always;
+
+    /* Extension formats, sorted by extension and then by index. */
+    size_t nextensions;
+    uint32_t *extensions;
+
+    /* Padded magic and mask rows for the maskcmp kernel. */
+    uint32_t *rows;
+    uint32_t *widths;
+    size_t pool;
+    unsigned char *magics;
+    unsigned char *masks;
+    struct maskcmp_table table;
+    maskcmp_fn *maskcmp;
+
+    /* Whether the tables are owned by the matcher or by a mapping. */
+    bool owned;
+};
+
+#define BITS (sizeof (unsigned long) * CHAR_BIT)
+
+/* Key bytes, as counted while choosing a key for each format. */
+struct key_count {
+    uint32_t pos;
+    uint32_t mask;
+    uint32_t value;
+    size_t count;
+    size_t index;
+};
+
+static size_t key_count_hasher (const void *data, size_t n)
+{
+    const struct key_count *kc = data;
+    return ((size_t) kc->pos * 65537 + kc->mask * 257 + kc->value) % n;
+}
+
+static bool key_count_comparator (const void *a, const void *b)
+{
+    const struct key_count *kca = a, *kcb = b;
+    return kca->pos == kcb->pos && kca->mask == kcb->mask &&
+	   kca->value == kcb->value;
+}
+
+/* Find or add an entry in a key_count table. */
+static struct key_count *key_count_get (Hash_table *table, uint32_t pos,
+					uint32_t mask, uint32_t value)
+{
+    struct key_count lookup, *kc;
+
+    lookup.pos = pos;
+    lookup.mask = mask;
+    lookup.value = value;
+    kc = hash_lookup (table, &lookup);
+    if (!kc) {
+	kc = xzalloc (sizeof *kc);
+	kc->pos = pos;
+	kc->mask = mask;
+	kc->value = value;
+	if (!hash_insert (table, kc))
+	    xalloc_die ();
+    }
+    return kc;
+}
+
+static inline bool is_magic (const struct binfmt *binfmt)
+{
+    return !strcmp (binfmt->type, "magic");
+}
+
+/* The mask that applies to byte i of a format's magic. */
+static inline unsigned char mask_byte (const struct binfmt *binfmt, size_t i)
+{
+    return *binfmt->mask ? (unsigned char) binfmt->mask[i] : 0xff;
+}
+
+static inline size_t row_width (size_t magic_size)
+{
+    return (magic_size + MASKCMP_ALIGN - 1) / MASKCMP_ALIGN * MASKCMP_ALIGN;
+}
+
+static void matcher_set_table (struct matcher *matcher)
+{
+    matcher->table.offsets = matcher->offsets;
+    matcher->table.rows = matcher->rows;
+    matcher->table.widths = matcher->widths;
+    matcher->table.magics = matcher->magics;
+    matcher->table.masks = matcher->masks;
+    matcher->maskcmp = maskcmp_best ();
+}
+
+static const struct binfmt **extension_sort_formats;
+
+static int extension_compare (const void *a, const void *b)
+{
+    uint32_t ia = *(const uint32_t *) a, ib = *(const uint32_t *) b;
+    int cmp = strcmp (extension_sort_formats[ia]->magic,
+		      extension_sort_formats[ib]->magic);
+
+    if (cmp)
+	return cmp;
+    return (ia > ib) - (ia < ib);
+}
+
+/* Build a matcher for a list of formats, which must already have been
+ * expanded by load_formats.  The formats must outlive the matcher.
+ */
+struct matcher *matcher_new (gl_list_t formats)
+{
+    struct matcher *matcher;
+    Hash_table *values, *keys;
+    struct key_count **chosen;
+    gl_list_iterator_t format_iter;
+    const struct binfmt *binfmt;
+    size_t i, j, nmembers;
+
+    matcher = xzalloc (sizeof *matcher);
+    matcher->owned = true;
+    matcher->count = gl_list_size (formats);
+    matcher->formats = xcalloc (matcher->count + 1,
+				sizeof *matcher->formats);
+    matcher->offsets = xcalloc (matcher->count + 1,
+				sizeof *matcher->offsets);
+    matcher->rows = xcalloc (matcher->count + 1, sizeof *matcher->rows);
+    matcher->widths = xcalloc (matcher->count + 1, sizeof *matcher->widths);
+    i = 0;
+    format_iter = gl_list_iterator (formats);
+    while (gl_list_iterator_next (&format_iter, (const void **) &binfmt,
+				  NULL)) {
+	matcher->formats[i] = binfmt;
+	if (is_magic (binfmt)) {
+	    size_t size;
+
+	    matcher->offsets[i] = atoi (binfmt->offset);
+	    size = matcher->offsets[i] + binfmt->magic_size;
+	    if (size > matcher->toread)
+		matcher->toread = size;
+	    matcher->rows[i] = matcher->pool;
+	    matcher->widths[i] = row_width (binfmt->magic_size);
+	    matcher->pool += matcher->widths[i];
+	}
+	++i;
+    }
+    gl_list_iterator_free (&format_iter);
+
+    matcher->magics = xzalloc (matcher->pool + 1);
+    matcher->masks = xzalloc (matcher->pool + 1);
+    for (i = 0; i < matcher->count; ++i) {
+	binfmt = matcher->formats[i];
+	if (!is_magic (binfmt))
+	    continue;
+	memcpy (matcher->magics + matcher->rows[i], binfmt->magic,
+		binfmt->magic_size);
+	for (j = 0; j < binfmt->magic_size; ++j)
+	    matcher->masks[matcher->rows[i] + j] = mask_byte (binfmt, j);
+    }
+
+    /* Count how many formats want each value at each (position, mask),
+     * and how many formats could use each (position, mask) as a key.
+     */
+    values = hash_initialize (matcher->count * 4, NULL, key_count_hasher,
+			      key_count_comparator, free);
+    keys = hash_initialize (64, NULL, key_count_hasher,
+			    key_count_comparator, free);
+    if (!values || !keys)
+	xalloc_die ();
+    for (i = 0; i < matcher->count; ++i) {
+	binfmt = matcher->formats[i];
+	if (!is_magic (binfmt))
+	    continue;
+	for (j = 0; j < binfmt->magic_size; ++j) {
+	    unsigned char mask = mask_byte (binfmt, j);
+	    uint32_t pos = matcher->offsets[i] + j;
+
+	    if (!mask)
+		continue;
+	    ++key_count_get (values, pos, mask,
+			     (unsigned char) binfmt->magic[j])->count;
+	    ++key_count_get (keys, pos, mask, 0)->count;
+	}
+    }
+
+    /* Pick the most selective key byte for each format, preferring keys
+     * that other formats use too so that fewer buckets need to be looked
+     * up.
+     */
+    chosen = xcalloc (matcher->count + 1, sizeof *chosen);
+    for (i = 0; i < matcher->count; ++i) {
+	struct key_count *best = NULL, *best_key = NULL;
+
+	binfmt = matcher->formats[i];
+	if (is_magic (binfmt)) {
+	    for (j = 0; j < binfmt->magic_size; ++j) {
+		unsigned char mask = mask_byte (binfmt, j);
+		uint32_t pos = matcher->offsets[i] + j;
+		struct key_count *value, *key;
+
+		if (!mask)
+		    continue;
+		value = key_count_get (values, pos, mask,
+				       (unsigned char) binfmt->magic[j]);
+		key = key_count_get (keys, pos, mask, 0);
+		if (!best || value->count < best->count ||
+		    (value->count == best->count &&
+		     key->count > best_key->count)) {
+		    best = value;
+		    best_key = key;
+		}
+	    }
+	    if (best)
+		chosen[i] = best;
+	    else
+		++matcher->nalways;
+	} else
+	    ++matcher->nextensions;
+    }
+
+    /* Number the keys that were actually chosen. */
+    {
+	struct key_count *key;
+
+	for (key = hash_get_first (keys); key; key = hash_get_next (keys, key))
+	    key->index = SIZE_MAX;
+	matcher->keys = xcalloc (hash_get_n_entries (keys) + 1,
+				 sizeof *matcher->keys);
+	for (i = 0; i < matcher->count; ++i) {
+	    if (!chosen[i])
+		continue;
+	    key = key_count_get (keys, chosen[i]->pos, chosen[i]->mask, 0);
+	    if (key->index == SIZE_MAX) {
+		key->index = matcher->nkeys++;
+		matcher->keys[key->index].pos = key->pos;
+		matcher->keys[key->index].mask = key->mask;
+	    }
+	    /* Reuse the value's index field to remember the key. */
+	    chosen[i]->index = key->index;
+	}
+    }
+
+    /* Lay out the buckets, keeping members of each bucket in format
+     * order.
+     */
+    matcher->starts = xcalloc (matcher->nkeys * (BUCKETS + 1) + 1,
+			       sizeof *matcher->starts);
+    nmembers = 0;
+    for (i = 0; i < matcher->count; ++i)
+	if (chosen[i]) {
+	    ++matcher->starts[chosen[i]->index * (BUCKETS + 1) +
+			      chosen[i]->value + 1];
+	    ++nmembers;
+	}
+    {
+	uint32_t total = 0;
+
+	for (i = 0; i < matcher->nkeys; ++i) {
+	    uint32_t *starts = matcher->starts + i * (BUCKETS + 1);
+
+	    starts[0] = total;
+	    for (j = 1; j <= BUCKETS; ++j) {
+		total += starts[j];
+		starts[j] = total;
+	    }
+	}
+    }
+    matcher->nmembers = nmembers;
+    matcher->members = xcalloc (nmembers + 1, sizeof *matcher->members);
+    matcher->always = xcalloc (matcher->nalways + 1,
+			       sizeof *matcher->always);
+    matcher->extensions = xcalloc (matcher->nextensions + 1,
+				   sizeof *matcher->extensions);
+    {
+	uint32_t *fill = xcalloc (matcher->nkeys * BUCKETS + 1,
+				  sizeof *fill);
+	size_t nalways = 0, nextensions = 0;
+
+	for (i = 0; i < matcher->count; ++i) {
+	    if (chosen[i]) {
+		size_t bucket = chosen[i]->index * BUCKETS + chosen[i]->value;
+		uint32_t start = matcher->starts[chosen[i]->index *
+						 (BUCKETS + 1) +
+						 chosen[i]->value];
+
+		matcher->members[start + fill[bucket]++] = i;
+	    } else if (is_magic (matcher->formats[i]))
+		matcher->always[nalways++] = i;
+	    else
+		matcher->extensions[nextensions++] = i;
+	}
+	free (fill);
+    }
+
+    extension_sort_formats = matcher->formats;
+    qsort (matcher->extensions, matcher->nextensions,
+	   sizeof *matcher->extensions, extension_compare);
+    extension_sort_formats = NULL;
+
+    free (chosen);
+    hash_free (keys);
+    hash_free (values);
+    matcher_set_table (matcher);
+    return matcher;
+}
+
+/* The number of bytes of a file that must be read before matching it. */
+size_t matcher_toread (const struct matcher *matcher)
+{
+    return matcher->toread;
+}
+
+/* Return the list of formats matching a file, in the same order as they
+ * were given to matcher_new.  buf must hold the first matcher_toread bytes
+ * of the file, zero-filled if the file is shorter than that.  extension
+ * may be NULL.
+ */
+gl_list_t matcher_match (const struct matcher *matcher,
+			 const char *buf, const char *extension)
+{
+    unsigned long *matched;
+    size_t nwords = matcher->count / BITS + 1;
+    unsigned char *header;
+    gl_list_t ok_formats;
+    size_t i;
+
+    matched = xcalloc (nwords, sizeof *matched);
+
+    /* The kernel reads whole rows, which may run past toread. */
+    header = xzalloc (matcher->toread + MASKCMP_ALIGN);
+    memcpy (header, buf, matcher->toread);
+
+    for (i = 0; i < matcher->nkeys; ++i) {
+	const struct match_key *key = &matcher->keys[i];
+	const uint32_t *starts = matcher->starts + i * (BUCKETS + 1);
+	unsigned char value = header[key->pos] & key->mask;
+
+	matcher->maskcmp (&matcher->table, header,
+			  matcher->members + starts[value],
+			  starts[value + 1] - starts[value], matched);
+    }
+
+    matcher->maskcmp (&matcher->table, header, matcher->always,
+		      matcher->nalways, matched);
+    free (header);
+
+#define MARK(i) (matched[(i) / BITS] |= 1UL << ((i) % BITS))
+
+    if (extension && matcher->nextensions) {
+	size_t low = 0, high = matcher->nextensions;
+
+	/* Find the first format with this extension. */
+	while (low < high) {
+	    size_t mid = low + (high - low) / 2;
+	    const struct binfmt *binfmt =
+		matcher->formats[matcher->extensions[mid]];
+
+	    if (strcmp (binfmt->magic, extension) < 0)
+		low = mid + 1;
+	    else
+		high = mid;
+	}
+	for (i = low; i < matcher->nextensions; ++i) {
+	    uint32_t index = matcher->extensions[i];
+
+	    if (strcmp (matcher->formats[index]->magic, extension))
+		break;
+	    MARK (index);
+	}
+    }
+
+#undef MARK
+
+    ok_formats = gl_list_create_empty (GL_ARRAY_LIST, NULL, NULL, NULL, true);
+    for (i = 0; i < nwords; ++i) {
+	unsigned long word = matched[i];
+
+	while (word) {
+	    size_t bit = __builtin_ctzl (word);
+
+	    gl_list_add_last (ok_formats, matcher->formats[i * BITS + bit]);
+	    word &= word - 1;
+	}
+    }
+    free (matched);
+    return ok_formats;
+}
+
+/* Serialized matchers start with a header of counts, followed by each of
+ * the tables in turn.
+ */
+enum {
+    SER_COUNT,
+    SER_TOREAD,
+    SER_NKEYS,
+    SER_NMEMBERS,
+    SER_NALWAYS,
+    SER_NEXTENSIONS,
+    SER_POOL,
+    SER_MAX
+};
+
+static size_t serialized_words (size_t count, size_t nkeys, size_t nmembers,
+				size_t nalways, size_t nextensions,
+				size_t pool)
+{
+    /* pool is always a multiple of MASKCMP_ALIGN, and so of the word
+     * size.
+     */
+    return SER_MAX + count + nkeys * 2 + nkeys * (BUCKETS + 1) +
+	   nmembers + nalways + nextensions + count * 2 +
+	   pool * 2 / sizeof (uint32_t);
+}
+
+/* Return a copy of the matcher's tables in a form that matcher_load can
+ * use in place.  It does not include the formats themselves.
+ */
+void *matcher_serialize (const struct matcher *matcher, size_t *size)
+{
+    size_t words = serialized_words (matcher->count, matcher->nkeys,
+				     matcher->nmembers, matcher->nalways,
+				     matcher->nextensions, matcher->pool);
+    uint32_t *data, *p;
+    size_t i;
+
+    p = data = xcalloc (words, sizeof *data);
+    *p++ = matcher->count;
+    *p++ = matcher->toread;
+    *p++ = matcher->nkeys;
+    *p++ = matcher->nmembers;
+    *p++ = matcher->nalways;
+    *p++ = matcher->nextensions;
+    *p++ = matcher->pool;
+    memcpy (p, matcher->offsets, matcher->count * sizeof *p);
+    p += matcher->count;
+    for (i = 0; i < matcher->nkeys; ++i) {
+	*p++ = matcher->keys[i].pos;
+	*p++ = matcher->keys[i].mask;
+    }
+#define COPY_TABLE(table, n) do { \
+    memcpy (p, matcher->table, (n) * sizeof *p); \
+    p += (n); \
+} while (0)
+    COPY_TABLE (starts, matcher->nkeys * (BUCKETS + 1));
+    COPY_TABLE (members, matcher->nmembers);
+    COPY_TABLE (always, matcher->nalways);
+    COPY_TABLE (extensions, matcher->nextensions);
+    COPY_TABLE (rows, matcher->count);
+    COPY_TABLE (widths, matcher->count);
+#undef COPY_TABLE
+    memcpy (p, matcher->magics, matcher->pool);
+    memcpy ((char *) p + matcher->pool, matcher->masks, matcher->pool);
+
+    *size = words * sizeof *data;
+    return data;
+}
+
+/* Use a matcher serialized by matcher_serialize for the same list of
+ * formats, without copying its tables.  data must be suitably aligned and
+ * must outlive the matcher.  Returns NULL if the data is inconsistent with
+ * the formats.
+ */
+struct matcher *matcher_load (gl_list_t formats, const void *data,
+			      size_t size)
+{
+    const uint32_t *p = data;
+    struct matcher *matcher;
+    gl_list_iterator_t format_iter;
+    const struct binfmt *binfmt;
+    size_t i;
+
+    if (size < SER_MAX * sizeof *p ||
+	p[SER_COUNT] != gl_list_size (formats) ||
+	size != serialized_words (p[SER_COUNT], p[SER_NKEYS],
+				  p[SER_NMEMBERS], p[SER_NALWAYS],
+				  p[SER_NEXTENSIONS], p[SER_POOL]) * sizeof *p ||
+	p[SER_POOL] % MASKCMP_ALIGN)
+	return NULL;
+
+    matcher = xzalloc (sizeof *matcher);
+    matcher->count = p[SER_COUNT];
+    matcher->toread = p[SER_TOREAD];
+    matcher->nkeys = p[SER_NKEYS];
+    matcher->nmembers = p[SER_NMEMBERS];
+    matcher->nalways = p[SER_NALWAYS];
+    matcher->nextensions = p[SER_NEXTENSIONS];
+    matcher->pool = p[SER_POOL];
+    p += SER_MAX;
+    matcher->offsets = (uint32_t *) p;
+    p += matcher->count;
+    matcher->keys = (struct match_key *) p;
+    p += matcher->nkeys * 2;
+    matcher->starts = (uint32_t *) p;
+    p += matcher->nkeys * (BUCKETS + 1);
+    matcher->members = (uint32_t *) p;
+    p += matcher->nmembers;
+    matcher->always = (uint32_t *) p;
+    p += matcher->nalways;
+    matcher->extensions = (uint32_t *) p;
+    p += matcher->nextensions;
+    matcher->rows = (uint32_t *) p;
+    p += matcher->count;
+    matcher->widths = (uint32_t *) p;
+    p += matcher->count;
+    matcher->magics = (unsigned char *) p;
+    matcher->masks = matcher->magics + matcher->pool;
+
+    matcher->formats = xcalloc (matcher->count + 1,
+				sizeof *matcher->formats);
+    i = 0;
+    format_iter = gl_list_iterator (formats);
+    while (gl_list_iterator_next (&format_iter, (const void **) &binfmt,
+				  NULL))
+	matcher->formats[i++] = binfmt;
+    gl_list_iterator_free (&format_iter);
+
+    /* Everything that matcher_match relies on must be in bounds. */
+    for (i = 0; i < matcher->count; ++i) {
+	if (!is_magic (matcher->formats[i])) {
+	    if (matcher->widths[i])
+		goto corrupt;
+	    continue;
+	}
+	if ((size_t) matcher->offsets[i] + matcher->formats[i]->magic_size >
+		matcher->toread ||
+	    matcher->widths[i] !=
+		row_width (matcher->formats[i]->magic_size) ||
+	    matcher->rows[i] > matcher->pool ||
+	    matcher->widths[i] > matcher->pool - matcher->rows[i])
+	    goto corrupt;
+    }
+    for (i = 0; i < matcher->nkeys; ++i) {
+	const uint32_t *starts = matcher->starts + i * (BUCKETS + 1);
+	size_t j;
+
+	if (matcher->keys[i].pos >= matcher->toread)
+	    goto corrupt;
+	for (j = 0; j < BUCKETS; ++j)
+	    if (starts[j] > starts[j + 1])
+		goto corrupt;
+	if (starts[BUCKETS] > matcher->nmembers)
+	    goto corrupt;
+    }
+#define CHECK_TABLE(table, n) do { \
+    for (i = 0; i < (n); ++i) \
+	if (matcher->table[i] >= matcher->count) \
+	    goto corrupt; \
+} while (0)
+    CHECK_TABLE (members, matcher->nmembers);
+    CHECK_TABLE (always, matcher->nalways);
+    CHECK_TABLE (extensions, matcher->nextensions);
+#undef CHECK_TABLE
+
+    matcher_set_table (matcher);
+    return matcher;
+
+corrupt:
+    matcher_free (matcher);
+    return NULL;
+}
+
+void matcher_free (struct matcher *matcher)
+{
+    if (matcher->owned) {
+	free (matcher->offsets);
+	free (matcher->keys);
+	free (matcher->starts);
+	free (matcher->members);
+	free (matcher->always);
+	free (matcher->extensions);
+	free (matcher->rows);
+	free (matcher->widths);
+	free (matcher->magics);
+	free (matcher->masks);
+    }
+    free (matcher->formats);
+    free (matcher);
+}
@@ -0,0 +1,31 @@
+/* match.h - match file headers against many binary formats at once
+ *
+ * Copyright (c) 2026 agent <agent@local>.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "gl_xlist.h"
+
+struct matcher;
+
+struct matcher *matcher_new (gl_list_t formats);
+size_t matcher_toread (const struct matcher *matcher);
+gl_list_t matcher_match (const struct matcher *matcher,
+			 const char *buf, const char *extension);
+void *matcher_serialize (const struct matcher *matcher, size_t *size);
+struct matcher *matcher_load (gl_list_t formats, const void *data,
+			      size_t size);
+void matcher_free (struct matcher *matcher);
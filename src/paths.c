@@ -28,3 +28,4 @@ const char *admindir = ADMINDIR;
 const char *importdir = IMPORTDIR;
 const char *procdir = PROCDIR;
 const char *auxdir = AUXDIR;
+const char *rundir = RUNDIR;
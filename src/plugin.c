@@ -0,0 +1,96 @@
+/* plugin.c - in-process detector plugins
+ *
+ * Copyright (c) 2026 agent <agent@local>.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/* See binfmt-detector.h for the interface that plugins implement.  Once
+ * loaded, plugins stay loaded for the life of the process, which normally
+ * ends by exec'ing an interpreter shortly afterwards anyway.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <string.h>
+#include <dlfcn.h>
+
+#include "binfmt-detector.h"
+#include "error.h"
+#include "plugin.h"
+
+/* If detector names a plugin, return the path to its shared object;
+ * otherwise return NULL.
+ */
+const char *plugin_path (const char *detector)
+{
+    if (strncmp (detector, PLUGIN_PREFIX, strlen (PLUGIN_PREFIX)))
+	return NULL;
+    return detector + strlen (PLUGIN_PREFIX);
+}
+
+/* Load a detector plugin, returning its detection function or NULL if it
+ * is unusable.  Loading the same plugin again is cheap.
+ */
+static binfmt_detect_fn *plugin_load (const char *plugin)
+{
+    void *handle;
+    const int *abi;
+    binfmt_detect_fn *detect;
+
+    /* Never search the library path for a plugin. */
+    if (*plugin != '/') {
+	warning ("detector plugin %s is not an absolute path", plugin);
+	return NULL;
+    }
+    handle = dlopen (plugin, RTLD_NOW | RTLD_LOCAL);
+    if (!handle) {
+	warning ("unable to load detector plugin: %s", dlerror ());
+	return NULL;
+    }
+    abi = dlsym (handle, "binfmt_detector_abi");
+    if (!abi || *abi != BINFMT_DETECTOR_ABI) {
+	warning ("detector plugin %s has an unsupported interface version",
+		 plugin);
+	return NULL;
+    }
+    *(void **) &detect = dlsym (handle, "binfmt_detect");
+    if (!detect) {
+	warning ("detector plugin %s does not define binfmt_detect", plugin);
+	return NULL;
+    }
+    return detect;
+}
+
+/* Load a detector plugin ahead of time, for long-running processes. */
+void plugin_preload (const char *plugin)
+{
+    plugin_load (plugin);
+}
+
+/* Run a detector plugin.  Returns non-zero if it accepts the file.  A
+ * plugin that cannot be loaded never accepts anything.
+ */
+int plugin_detect (const char *plugin, const char *path, int fd,
+		   const unsigned char *header, size_t header_size)
+{
+    binfmt_detect_fn *detect = plugin_load (plugin);
+
+    if (!detect)
+	return 0;
+    return detect (path, fd, header, header_size) == BINFMT_DETECT_MATCH;
+}
@@ -0,0 +1,186 @@
+/* profile.c - binary format usage profile
+ *
+ * Copyright (c) 2026 agent <agent@local>.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/* run-detectors counts how often each format is chosen, so that
+ * update-binfmts can register the busiest formats where the kernel will
+ * try them first.  Like the verdict cache, each user has a file in rundir,
+ * mapped shared by every run-detectors process running as that user.  It
+ * is a fixed-size open-addressed table of counters keyed on a hash of the
+ * format name; slots are claimed and counters bumped with atomic
+ * operations, so counting takes no locks.
+ *
+ * Only choices that had to be worked out are counted, not those found in
+ * the verdict cache.  Counting opens and maps the profile, which would add
+ * several system calls to every cache hit.
+ *
+ * The counts only affect the order in which formats are registered.  When
+ * two kernel entries could match the same file, that order decides which of
+ * them wins, and any user can write their own counts, so update-binfmts
+ * only lets counts move entries that overlap no others (see order_formats).
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <stdlib.h>
+
+#include "xalloc.h"
+
+#include "profile.h"
+#include "runfile.h"
+
+#define PROFILE_MAGIC "BFUSAGE"
+#define PROFILE_VERSION 1
+#define PROFILE_SLOTS 1024
+
+struct profile_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t slots;
+};
+
+struct profile_slot {
+    uint64_t hash;	/* 0 if unused */
+    uint64_t count;
+};
+
+#define PROFILE_SIZE (sizeof (struct profile_header) + \
+		      PROFILE_SLOTS * sizeof (struct profile_slot))
+
+struct profile {
+    struct profile_slot slots[PROFILE_SLOTS];
+};
+
+static int header_ok (const void *map)
+{
+    const struct profile_header *header = map;
+
+    return header->version == PROFILE_VERSION &&
+	   header->slots == PROFILE_SLOTS;
+}
+
+static void header_init (void *map)
+{
+    struct profile_header *header = map;
+
+    header->version = PROFILE_VERSION;
+    header->slots = PROFILE_SLOTS;
+}
+
+static const struct runfile profile_file = {
+    "usage", PROFILE_MAGIC, PROFILE_SIZE, header_ok, header_init
+};
+
+/* Count one use of the format called name in the current user's profile.
+ * Failures are ignored; the profile is only advisory.
+ */
+void profile_count (const char *name)
+{
+    struct profile_header *header;
+    struct profile_slot *slots;
+    uint64_t hash = runfile_hash (name);
+    size_t i;
+
+    header = runfile_open (&profile_file, NULL);
+    if (!header)
+	return;
+    slots = (struct profile_slot *) (header + 1);
+    for (i = 0; i < PROFILE_SLOTS; ++i) {
+	struct profile_slot *slot = &slots[(hash + i) % PROFILE_SLOTS];
+	uint64_t seen = __atomic_load_n (&slot->hash, __ATOMIC_ACQUIRE);
+
+	/* If another process claims the slot first, seen becomes its hash. */
+	if (!seen &&
+	    __atomic_compare_exchange_n (&slot->hash, &seen, hash, 0,
+					 __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+	    seen = hash;
+	if (seen == hash) {
+	    __atomic_add_fetch (&slot->count, 1, __ATOMIC_RELAXED);
+	    break;
+	}
+    }
+    runfile_close (&profile_file, header, -1);
+}
+
+static void add_slot (struct profile *profile, const struct profile_slot *in)
+{
+    size_t i;
+
+    for (i = 0; i < PROFILE_SLOTS; ++i) {
+	struct profile_slot *slot =
+	    &profile->slots[(in->hash + i) % PROFILE_SLOTS];
+
+	if (!slot->hash)
+	    slot->hash = in->hash;
+	if (slot->hash == in->hash) {
+	    slot->count += in->count;
+	    return;
+	}
+    }
+}
+
+static void add_profile (const void *map, void *data)
+{
+    const struct profile_header *header = map;
+    const struct profile_slot *slots =
+	(const struct profile_slot *) (header + 1);
+    size_t i;
+
+    for (i = 0; i < PROFILE_SLOTS; ++i) {
+	struct profile_slot slot;
+
+	slot.hash = __atomic_load_n (&slots[i].hash, __ATOMIC_ACQUIRE);
+	slot.count = __atomic_load_n (&slots[i].count, __ATOMIC_RELAXED);
+	if (slot.hash && slot.count)
+	    add_slot (data, &slot);
+    }
+}
+
+/* Add up every user's profile. */
+struct profile *profile_load (void)
+{
+    struct profile *profile = xzalloc (sizeof *profile);
+
+    runfile_each (&profile_file, add_profile, profile);
+    return profile;
+}
+
+/* Return how many times the format called name has been used. */
+uint64_t profile_lookup (const struct profile *profile, const char *name)
+{
+    uint64_t hash = runfile_hash (name);
+    size_t i;
+
+    for (i = 0; i < PROFILE_SLOTS; ++i) {
+	const struct profile_slot *slot =
+	    &profile->slots[(hash + i) % PROFILE_SLOTS];
+
+	if (!slot->hash)
+	    break;
+	if (slot->hash == hash)
+	    return slot->count;
+    }
+    return 0;
+}
+
+void profile_free (struct profile *profile)
+{
+    free (profile);
+}
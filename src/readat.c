@@ -0,0 +1,56 @@
+/* readat.c - read parts of a file being examined
+ *
+ * Copyright (c) 2026 agent <agent@local>.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "readat.h"
+
+/* Read size bytes at offset from fd, preferring the header_size bytes of
+ * header that have already been read from its start.  fd may be -1 if
+ * only the header is available.  Returns non-zero if all size bytes were
+ * read.
+ */
+int read_at (int fd, const unsigned char *header, size_t header_size,
+	     uint64_t offset, unsigned char *buf, size_t size)
+{
+    size_t got = 0;
+
+    if (offset <= header_size && size <= header_size - offset) {
+	memcpy (buf, header + offset, size);
+	return 1;
+    }
+    if (fd < 0 || offset > (uint64_t) INT64_MAX - size)
+	return 0;
+    while (got < size) {
+	ssize_t r = pread (fd, buf + got, size - got, offset + got);
+
+	if (r < 0 && errno == EINTR)
+	    continue;
+	if (r <= 0)
+	    return 0;
+	got += r;
+    }
+    return 1;
+}
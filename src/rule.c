@@ -0,0 +1,303 @@
+/* rule.c - declarative detector rules
+ *
+ * Copyright (c) 2026 agent <agent@local>.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/* A rule tests fields in the file being executed, so that simple detectors
+ * need not be separate programs.  The grammar is:
+ *
+ *   rule   := and { "||" and }
+ *   and    := unary { "&&" unary }
+ *   unary  := "!" unary | "(" rule ")" | test
+ *   test   := value [ "&" number ] [ op number ]
+ *   op     := "==" | "!=" | "<" | "<=" | ">" | ">="
+ *   value  := type "@" offset
+ *   type   := "u8" | "le16" | "be16" | "le32" | "be32" | "le64" | "be64"
+ *   offset := number | "(" value [ ( "+" | "-" ) number ] ")"
+ *
+ * Numbers are as for strtoull with base 0.  A test with no op is true if
+ * the (masked) value is non-zero.  A test that reads beyond the end of the
+ * file is false.  Rules are interpreted directly from their text; they are
+ * short, so this costs very little next to the read system calls.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "readat.h"
+#include "rule.h"
+
+/* Rules come from the administrative directory, but a limit on nesting
+ * keeps a corrupt one from exhausting the stack.
+ */
+#define MAX_DEPTH 32
+
+struct parser {
+    const char *p;
+    const char *error;
+    int depth;
+    /* The file being tested, if any. */
+    int fd;
+    const unsigned char *header;
+    size_t header_size;
+};
+
+static void fail (struct parser *parser, const char *message)
+{
+    if (!parser->error)
+	parser->error = message;
+}
+
+static void skip_space (struct parser *parser)
+{
+    while (isspace ((unsigned char) *parser->p))
+	++parser->p;
+}
+
+/* Consume token if it comes next.  Operators that are prefixes of others
+ * ("&" of "&&", "!" of "!=", "<" of "<=") are only consumed on their own.
+ */
+static int accept (struct parser *parser, const char *token)
+{
+    size_t len = strlen (token);
+
+    skip_space (parser);
+    if (strncmp (parser->p, token, len))
+	return 0;
+    if (len == 1 && (*token == '&' || *token == '!' ||
+		     *token == '<' || *token == '>')) {
+	if (parser->p[1] == '&' || parser->p[1] == '=')
+	    return 0;
+    }
+    parser->p += len;
+    return 1;
+}
+
+static uint64_t parse_number (struct parser *parser)
+{
+    char *end;
+    uint64_t number;
+
+    skip_space (parser);
+    if (!isdigit ((unsigned char) *parser->p)) {
+	fail (parser, "number expected");
+	return 0;
+    }
+    number = strtoull (parser->p, &end, 0);
+    parser->p = end;
+    return number;
+}
+
+static uint64_t parse_value (struct parser *parser, int eval, int *ok);
+
+static uint64_t parse_offset (struct parser *parser, int eval, int *ok)
+{
+    uint64_t offset;
+
+    if (!accept (parser, "("))
+	return parse_number (parser);
+    offset = parse_value (parser, eval, ok);
+    if (accept (parser, "+"))
+	offset += parse_number (parser);
+    else if (accept (parser, "-"))
+	offset -= parse_number (parser);
+    if (!accept (parser, ")"))
+	fail (parser, "')' expected");
+    return offset;
+}
+
+static uint64_t parse_value (struct parser *parser, int eval, int *ok)
+{
+    static const struct {
+	const char *name;
+	size_t size;
+	int big_endian;
+    } types[] = {
+	{ "u8", 1, 0 },
+	{ "le16", 2, 0 }, { "be16", 2, 1 },
+	{ "le32", 4, 0 }, { "be32", 4, 1 },
+	{ "le64", 8, 0 }, { "be64", 8, 1 }
+    };
+    const char *start;
+    size_t len, i, size = 0;
+    int big_endian = 0;
+    uint64_t offset, value = 0;
+    unsigned char buf[8];
+
+    if (++parser->depth > MAX_DEPTH) {
+	fail (parser, "rule nested too deeply");
+	return 0;
+    }
+
+    skip_space (parser);
+    start = parser->p;
+    while (isalnum ((unsigned char) *parser->p))
+	++parser->p;
+    len = parser->p - start;
+    for (i = 0; i < sizeof types / sizeof *types; ++i) {
+	if (strlen (types[i].name) == len &&
+	    !strncmp (types[i].name, start, len)) {
+	    size = types[i].size;
+	    big_endian = types[i].big_endian;
+	    break;
+	}
+    }
+    if (!size) {
+	fail (parser, "type expected");
+	return 0;
+    }
+    if (!accept (parser, "@")) {
+	fail (parser, "'@' expected");
+	return 0;
+    }
+    offset = parse_offset (parser, eval, ok);
+    --parser->depth;
+
+    if (!eval || !*ok || parser->error)
+	return 0;
+    if (!read_at (parser->fd, parser->header, parser->header_size,
+		  offset, buf, size)) {
+	*ok = 0;
+	return 0;
+    }
+    for (i = 0; i < size; ++i)
+	value |= (uint64_t) buf[big_endian ? size - 1 - i : i] << (8 * i);
+    return value;
+}
+
+static int parse_test (struct parser *parser, int eval)
+{
+    int ok = 1;
+    uint64_t value, operand;
+
+    value = parse_value (parser, eval, &ok);
+    if (accept (parser, "&"))
+	value &= parse_number (parser);
+
+    if (accept (parser, "==")) {
+	operand = parse_number (parser);
+	return ok && value == operand;
+    } else if (accept (parser, "!=")) {
+	operand = parse_number (parser);
+	return ok && value != operand;
+    } else if (accept (parser, "<=")) {
+	operand = parse_number (parser);
+	return ok && value <= operand;
+    } else if (accept (parser, ">=")) {
+	operand = parse_number (parser);
+	return ok && value >= operand;
+    } else if (accept (parser, "<")) {
+	operand = parse_number (parser);
+	return ok && value < operand;
+    } else if (accept (parser, ">")) {
+	operand = parse_number (parser);
+	return ok && value > operand;
+    }
+    return ok && value != 0;
+}
+
+static int parse_rule (struct parser *parser, int eval);
+
+static int parse_unary (struct parser *parser, int eval)
+{
+    int result;
+
+    if (++parser->depth > MAX_DEPTH) {
+	fail (parser, "rule nested too deeply");
+	return 0;
+    }
+    if (accept (parser, "!"))
+	result = !parse_unary (parser, eval);
+    else if (accept (parser, "(")) {
+	result = parse_rule (parser, eval);
+	if (!accept (parser, ")"))
+	    fail (parser, "')' expected");
+    } else
+	result = parse_test (parser, eval);
+    --parser->depth;
+    return result;
+}
+
+/* Subexpressions that cannot affect the result are still parsed, so that
+ * syntax errors are found, but with eval clear so that nothing is read.
+ */
+static int parse_and (struct parser *parser, int eval)
+{
+    int result = parse_unary (parser, eval);
+
+    while (accept (parser, "&&"))
+	if (!parse_unary (parser, eval && result))
+	    result = 0;
+    return result;
+}
+
+static int parse_rule (struct parser *parser, int eval)
+{
+    int result = parse_and (parser, eval);
+
+    while (accept (parser, "||"))
+	if (parse_and (parser, eval && !result))
+	    result = 1;
+    return result;
+}
+
+static int parse (struct parser *parser, int eval)
+{
+    int result = parse_rule (parser, eval);
+
+    skip_space (parser);
+    if (*parser->p)
+	fail (parser, "unexpected text at end of rule");
+    return parser->error ? 0 : result;
+}
+
+/* Check the syntax of rule.  If it is invalid, return zero and set
+ * *message to a description of the problem.
+ */
+int rule_valid (const char *rule, const char **message)
+{
+    struct parser parser;
+
+    memset (&parser, 0, sizeof parser);
+    parser.p = rule;
+    parser.fd = -1;
+    parse (&parser, 0);
+    *message = parser.error;
+    return !parser.error;
+}
+
+/* Return non-zero if the file open on fd, starting with header, satisfies
+ * rule.  Invalid rules never match.
+ */
+int rule_match (const char *rule, int fd,
+		const unsigned char *header, size_t header_size)
+{
+    struct parser parser;
+
+    memset (&parser, 0, sizeof parser);
+    parser.p = rule;
+    parser.fd = fd;
+    parser.header = header;
+    parser.header_size = header_size;
+    return parse (&parser, 1);
+}
@@ -21,17 +21,23 @@
 #  include "config.h"
 #endif
 
+#include <errno.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
+#include <sys/auxv.h>
 
 #include "argp.h"
+#include "gl_array_list.h"
 #include "gl_xlist.h"
 #include "xalloc.h"
 
+#include "daemon.h"
 #include "error.h"
 #include "find.h"
 #include "format.h"
 #include "paths.h"
+#include "trace.h"
 
 char *program_name;
 
@@ -40,7 +46,8 @@ const char *argp_program_bug_address = PACKAGE_BUGREPORT;
 
 enum opts {
     OPT_ADMINDIR = 256,
-    OPT_PROCDIR
+    OPT_PROCDIR,
+    OPT_RUNDIR
 };
 
 static struct argp_option options[] = {
@@ -49,6 +56,8 @@ static struct argp_option options[] = {
     { "procdir",	OPT_PROCDIR,	"DIRECTORY",	OPTION_HIDDEN,
 	"proc directory, for test suite use only "
 	"(default: " PROCDIR ")", 5 },
+    { "rundir",		OPT_RUNDIR,	"DIRECTORY",	0,
+	"runtime directory (default: " RUNDIR ")", 4 },
     { 0 }
 };
 
@@ -62,6 +71,10 @@ static error_t parse_opt (int key, char *arg, struct argp_state *state)
 	case OPT_PROCDIR:
 	    procdir = arg;
 	    return 0;
+
+	case OPT_RUNDIR:
+	    rundir = arg;
+	    return 0;
     }
 
     return ARGP_ERR_UNKNOWN;
@@ -76,6 +89,49 @@ static struct argp argp = {
     "later for copying conditions."
 };
 
+/* If the format was registered with open-binary, the kernel has already
+ * opened the target for us.  Returns that file descriptor, or -1.
+ */
+static int exec_fd (void)
+{
+    unsigned long fd;
+
+    errno = 0;
+    fd = getauxval (AT_EXECFD);
+    if (errno)
+	return -1;
+    return (int) fd;
+}
+
+/* Ask detectord if it is running, and otherwise look for ourselves. */
+static gl_list_t find (const char *path, int fd)
+{
+    gl_list_t interpreters, binfmts;
+    gl_list_iterator_t binfmt_iter;
+    const struct binfmt *binfmt;
+    const char *first_match = getenv ("BINFMT_FIRST_MATCH");
+    int flags = FIND_PARALLEL | FIND_CACHE | FIND_PROFILE;
+
+    if (first_match && *first_match && strcmp (first_match, "0"))
+	flags |= FIND_FIRST;
+
+    interpreters = daemon_find (path, fd, flags);
+    trace_mark (TRACE_DAEMON);
+    if (interpreters)
+	return interpreters;
+
+    binfmts = find_interpreters (path, fd, flags);
+    interpreters = gl_list_create_empty (GL_ARRAY_LIST, NULL, NULL, NULL,
+					 true);
+    binfmt_iter = gl_list_iterator (binfmts);
+    while (gl_list_iterator_next (&binfmt_iter, (const void **) &binfmt,
+				  NULL))
+	gl_list_add_last (interpreters, binfmt->interpreter);
+    gl_list_iterator_free (&binfmt_iter);
+    gl_list_free (binfmts);
+    return interpreters;
+}
+
 int main (int argc, char **argv)
 {
     int arg_index;
@@ -83,35 +139,43 @@ int main (int argc, char **argv)
     int i;
     gl_list_t interpreters;
     gl_list_iterator_t interpreter_iter;
-    const struct binfmt *binfmt;
+    const char *interpreter;
 
     program_name = xstrdup ("run-detectors");
+    error_prefix = program_name;
 
     argp_err_exit_status = 2;
     if (argp_parse (&argp, argc, argv, ARGP_IN_ORDER, &arg_index, 0))
 	exit (argp_err_exit_status);
     if (arg_index >= argc)
 	quit ("argument required");
+    trace_start ();
 
     real_argv = xcalloc (argc - arg_index + 2, sizeof *real_argv);
     for (i = arg_index; i < argc; ++i)
 	real_argv[i - arg_index + 1] = argv[i];
     real_argv[argc - arg_index + 1] = NULL;
 
-    interpreters = find_interpreters (argv[arg_index]);
+    /* The kernel's descriptor is deliberately left open across exec, so
+     * that detectors and the interpreter inherit it.
+     */
+    interpreters = find (argv[arg_index], exec_fd ());
 
     /* Try to exec() each interpreter in turn. */
     interpreter_iter = gl_list_iterator (interpreters);
-    while (gl_list_iterator_next (&interpreter_iter, (const void **) &binfmt,
-				  NULL)) {
-	real_argv[0] = (char *) binfmt->interpreter;
+    while (gl_list_iterator_next (&interpreter_iter,
+				  (const void **) &interpreter, NULL)) {
+	real_argv[0] = (char *) interpreter;
 	fflush (NULL);
-	execvp (binfmt->interpreter, real_argv);
-	warning_err ("unable to exec %s", binfmt->interpreter);
+	trace_mark (TRACE_EXEC);
+	trace_commit ();
+	execvp (interpreter, real_argv);
+	warning_err ("unable to exec %s", interpreter);
     }
     gl_list_iterator_free (&interpreter_iter);
 
     gl_list_free (interpreters);
 
+    trace_commit ();
     quit ("unable to find an interpreter for %s", argv[arg_index]);
 }
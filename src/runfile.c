@@ -0,0 +1,202 @@
+/* runfile.c - per-user files in the runtime directory
+ *
+ * Copyright (c) 2026 agent <agent@local>.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/* The verdict cache, the usage profile and the trace are all kept the same
+ * way: a fixed-size file per user in rundir, set up under an fcntl lock and
+ * then mapped shared, and read by update-binfmts for every user at once.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "xalloc.h"
+#include "xvasprintf.h"
+
+#include "paths.h"
+#include "runfile.h"
+
+static int header_ok (const struct runfile *file, const void *map)
+{
+    if (memcmp (map, file->magic, RUNFILE_MAGIC_SIZE))
+	return 0;
+    /* Pairs with the fence before the magic string is written. */
+    __atomic_thread_fence (__ATOMIC_ACQUIRE);
+    return file->header_ok (map);
+}
+
+/* Take (type F_WRLCK) or release (F_UNLCK) the lock on a whole file. */
+int runfile_lock (int fd, short type)
+{
+    struct flock fl;
+
+    memset (&fl, 0, sizeof fl);
+    fl.l_type = type;
+    fl.l_whence = SEEK_SET;
+    while (fcntl (fd, F_SETLKW, &fl) == -1)
+	if (errno != EINTR)
+	    return 0;
+    return 1;
+}
+
+/* Map the current user's file of this kind, creating it or setting it up
+ * afresh if necessary.  Returns NULL if there is no usable file; callers
+ * should simply carry on without one.  If fd is not NULL, the file is left
+ * open for runfile_lock and *fd is set to it.
+ */
+void *runfile_open (const struct runfile *file, int *fd)
+{
+    char *path;
+    int our_fd;
+    struct stat st;
+    void *map;
+
+    path = xasprintf ("%s/%s.%lu", rundir, file->name,
+		      (unsigned long) geteuid ());
+    our_fd = open (path, O_RDWR | O_CREAT | O_NOFOLLOW | O_CLOEXEC, 0600);
+    free (path);
+    if (our_fd < 0)
+	return NULL;
+    /* Anyone else who can write to the file can change what we do. */
+    if (fstat (our_fd, &st) == -1 || !S_ISREG (st.st_mode) ||
+	st.st_uid != geteuid () || (st.st_mode & 077))
+	goto fail;
+
+    if (st.st_size != (off_t) file->size) {
+	if (!runfile_lock (our_fd, F_WRLCK))
+	    goto fail;
+	if (fstat (our_fd, &st) == -1 ||
+	    (st.st_size != (off_t) file->size &&
+	     (ftruncate (our_fd, 0) == -1 ||
+	      ftruncate (our_fd, file->size) == -1))) {
+	    runfile_lock (our_fd, F_UNLCK);
+	    goto fail;
+	}
+	runfile_lock (our_fd, F_UNLCK);
+    }
+
+    map = mmap (NULL, file->size, PROT_READ | PROT_WRITE, MAP_SHARED,
+		our_fd, 0);
+    if (map == MAP_FAILED)
+	goto fail;
+    if (!header_ok (file, map)) {
+	/* New, or left by some other version. */
+	if (!runfile_lock (our_fd, F_WRLCK)) {
+	    munmap (map, file->size);
+	    goto fail;
+	}
+	if (!header_ok (file, map)) {
+	    memset (map, 0, file->size);
+	    file->init (map);
+	    __atomic_thread_fence (__ATOMIC_RELEASE);
+	    memcpy (map, file->magic, RUNFILE_MAGIC_SIZE);
+	}
+	runfile_lock (our_fd, F_UNLCK);
+    }
+
+    if (fd)
+	*fd = our_fd;
+    else
+	close (our_fd);
+    return map;
+
+fail:
+    close (our_fd);
+    return NULL;
+}
+
+/* Undo runfile_open.  fd is what it returned, or -1 if it was not kept. */
+void runfile_close (const struct runfile *file, void *map, int fd)
+{
+    munmap (map, file->size);
+    if (fd >= 0)
+	close (fd);
+}
+
+/* Call fn with every user's file of this kind, mapped read-only.  A file
+ * only counts if its owner matches its name, or is root.
+ */
+void runfile_each (const struct runfile *file,
+		   void (*fn) (const void *map, void *data), void *data)
+{
+    size_t len = strlen (file->name);
+    DIR *dir;
+    struct dirent *entry;
+
+    dir = opendir (rundir);
+    if (!dir)
+	return;
+    while ((entry = readdir (dir)) != NULL) {
+	const char *number = entry->d_name + len + 1;
+	char *path, *end;
+	unsigned long uid;
+	int fd;
+	struct stat st;
+	void *map;
+
+	if (strncmp (entry->d_name, file->name, len) ||
+	    entry->d_name[len] != '.')
+	    continue;
+	errno = 0;
+	uid = strtoul (number, &end, 10);
+	if (errno || end == number || *end)
+	    continue;
+	path = xasprintf ("%s/%s", rundir, entry->d_name);
+	fd = open (path, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+	free (path);
+	if (fd < 0)
+	    continue;
+	if (fstat (fd, &st) == -1 || !S_ISREG (st.st_mode) ||
+	    (st.st_uid != uid && st.st_uid != 0) ||
+	    st.st_size != (off_t) file->size) {
+	    close (fd);
+	    continue;
+	}
+	map = mmap (NULL, file->size, PROT_READ, MAP_SHARED, fd, 0);
+	close (fd);
+	if (map == MAP_FAILED)
+	    continue;
+	if (header_ok (file, map))
+	    fn (map, data);
+	munmap (map, file->size);
+    }
+    closedir (dir);
+}
+
+/* FNV-1a, never returning 0, which callers can use to mean "none". */
+uint64_t runfile_hash (const char *string)
+{
+    uint64_t hash = 14695981039346656037ULL;
+
+    for (; *string; ++string) {
+	hash ^= (unsigned char) *string;
+	hash *= 1099511628211ULL;
+    }
+    return hash | 1;
+}
@@ -0,0 +1,45 @@
+/* runfile.h - interface to per-user files in the runtime directory
+ *
+ * Copyright (c) 2026 agent <agent@local>.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define RUNFILE_MAGIC_SIZE 8
+
+/* A kind of file that each user keeps in rundir, called NAME.UID and mapped
+ * shared by every process running as that user.  Each starts with a magic
+ * string of RUNFILE_MAGIC_SIZE bytes, which is written last when the file is
+ * set up, so that it is never seen half-initialised.
+ */
+struct runfile {
+    const char *name;
+    const char *magic;
+    size_t size;
+    /* Check the rest of the header, once the magic string has matched. */
+    int (*header_ok) (const void *map);
+    /* Fill in the rest of the header of a zeroed file. */
+    void (*init) (void *map);
+};
+
+void *runfile_open (const struct runfile *file, int *fd);
+void runfile_close (const struct runfile *file, void *map, int fd);
+int runfile_lock (int fd, short type);
+void runfile_each (const struct runfile *file,
+		   void (*fn) (const void *map, void *data), void *data);
+uint64_t runfile_hash (const char *string);
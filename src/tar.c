@@ -0,0 +1,386 @@
+/* tar.c - read tar archives as a stream
+ *
+ * Copyright (c) 2026 agent <agent@local>.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/* Only as much of tar is understood as is needed to walk through an
+ * archive once, front to back, looking at the start of each member: ustar
+ * headers, plus the GNU long name and pax extended header extensions that
+ * are needed to get names and sizes right.  If we were built with zlib,
+ * the archive may be compressed with gzip.  Nothing is ever seeked, and no
+ * more than one block and one long name are held in memory at once,
+ * whatever the size of the archive.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#ifdef HAVE_ZLIB
+#  include <zlib.h>
+#endif
+
+#include "xalloc.h"
+#include "xstrndup.h"
+#include "xvasprintf.h"
+
+#include "error.h"
+#include "tar.h"
+
+#define TAR_BLOCK 512
+
+/* Longer names or extended headers than this are rejected rather than
+ * held in memory.
+ */
+#define TAR_MAX_METADATA (1024 * 1024)
+
+struct tar {
+#ifdef HAVE_ZLIB
+    gzFile gz;
+#else
+    int fd;
+    int started;	/* non-zero once anything has been read */
+#endif
+    char *name;
+    char *long_name;	/* from a GNU 'L' entry, for the next member */
+    char *pax_path;	/* from a pax 'x' entry, for the next member */
+    uint64_t pax_size;
+    int pax_size_set;
+    uint64_t remaining;	/* data left in the current member */
+    uint64_t padding;	/* padding after the current member's data */
+};
+
+/* Offsets of fields in a ustar header block. */
+#define TAR_NAME	0
+#define TAR_MODE	100
+#define TAR_SIZE	124
+#define TAR_CHKSUM	148
+#define TAR_TYPEFLAG	156
+#define TAR_MAGIC	257
+#define TAR_PREFIX	345
+
+struct tar *tar_open (int fd)
+{
+    struct tar *tar = xzalloc (sizeof *tar);
+
+#ifdef HAVE_ZLIB
+    /* zlib passes data that is not compressed through unchanged. */
+    tar->gz = gzdopen (fd, "rb");
+    if (!tar->gz)
+	xalloc_die ();
+#else
+    tar->fd = fd;
+#endif
+    return tar;
+}
+
+#ifdef HAVE_ZLIB
+
+static int read_exact (struct tar *tar, void *buf, size_t len)
+{
+    int r = gzread (tar->gz, buf, len);
+
+    if (r == (int) len)
+	return 1;
+    if (r < 0) {
+	int errnum;
+	const char *message = gzerror (tar->gz, &errnum);
+
+	if (errnum == Z_ERRNO)
+	    warning_err ("unable to read archive");
+	else
+	    warning ("unable to read archive: %s", message);
+    } else
+	warning ("archive is truncated");
+    return 0;
+}
+
+#else /* !HAVE_ZLIB */
+
+static int read_exact (struct tar *tar, void *buf, size_t len)
+{
+    size_t got = 0;
+
+    while (got < len) {
+	ssize_t r = read (tar->fd, (char *) buf + got, len - got);
+
+	if (r < 0 && errno == EINTR)
+	    continue;
+	if (r < 0) {
+	    warning_err ("unable to read archive");
+	    return 0;
+	}
+	if (r == 0) {
+	    warning ("archive is truncated");
+	    return 0;
+	}
+	got += r;
+	if (!tar->started && got >= 2) {
+	    const unsigned char *p = buf;
+
+	    tar->started = 1;
+	    if (p[0] == 0x1f && p[1] == 0x8b) {
+		warning ("unable to read archive: built without support for "
+			 "compressed archives");
+		return 0;
+	    }
+	}
+    }
+    return 1;
+}
+
+#endif /* HAVE_ZLIB */
+
+static int skip (struct tar *tar, uint64_t len)
+{
+    char buf[8192];
+
+    while (len) {
+	size_t chunk = len < sizeof buf ? len : sizeof buf;
+
+	if (!read_exact (tar, buf, chunk))
+	    return 0;
+	len -= chunk;
+    }
+    return 1;
+}
+
+static uint64_t padding (uint64_t size)
+{
+    return (TAR_BLOCK - size % TAR_BLOCK) % TAR_BLOCK;
+}
+
+/* Parse a numeric header field, which is either octal or, as a GNU
+ * extension, big-endian binary flagged by the top bit of the first byte.
+ */
+static int parse_number (const unsigned char *field, size_t len,
+			 uint64_t *value)
+{
+    size_t i = 0;
+
+    *value = 0;
+    if (field[0] & 0x80) {
+	*value = field[0] & 0x3f;
+	for (i = 1; i < len; ++i) {
+	    if (*value >> 56)
+		return 0;
+	    *value = (*value << 8) | field[i];
+	}
+	return 1;
+    }
+    while (i < len && field[i] == ' ')
+	++i;
+    for (; i < len && field[i] >= '0' && field[i] <= '7'; ++i) {
+	if (*value >> 61)
+	    return 0;
+	*value = (*value << 3) | (field[i] - '0');
+    }
+    return i == len || field[i] == ' ' || field[i] == '\0';
+}
+
+static int checksum_ok (const unsigned char *block)
+{
+    uint64_t expected;
+    unsigned long sum = 0;
+    size_t i;
+
+    if (!parse_number (block + TAR_CHKSUM, 8, &expected))
+	return 0;
+    for (i = 0; i < TAR_BLOCK; ++i)
+	sum += (i >= TAR_CHKSUM && i < TAR_CHKSUM + 8) ? ' ' : block[i];
+    return sum == expected;
+}
+
+/* Read the data of a metadata entry, which must be small. */
+static char *read_metadata (struct tar *tar, uint64_t size)
+{
+    char *data;
+
+    if (size > TAR_MAX_METADATA) {
+	warning ("archive has an extended header of %llu bytes; giving up",
+		 (unsigned long long) size);
+	return NULL;
+    }
+    data = xmalloc (size + 1);
+    if (!read_exact (tar, data, size) || !skip (tar, padding (size))) {
+	free (data);
+	return NULL;
+    }
+    data[size] = '\0';
+    return data;
+}
+
+/* Pick out the records of a pax extended header that matter here.  Each
+ * is "<length> <key>=<value>\n", where length counts the whole record.
+ */
+static int parse_pax (struct tar *tar, const char *data, size_t size)
+{
+    size_t pos = 0;
+
+    while (pos < size) {
+	const char *record = data + pos, *key, *equals;
+	char *end;
+	unsigned long len = strtoul (record, &end, 10);
+
+	if (end == record || *end != ' ' || len > size - pos ||
+	    len <= (size_t) (end - record) + 1 || record[len - 1] != '\n')
+	    return 0;
+	key = end + 1;
+	equals = memchr (key, '=', record + len - 1 - key);
+	if (!equals)
+	    return 0;
+	if (equals - key == 4 && !strncmp (key, "path", 4)) {
+	    free (tar->pax_path);
+	    tar->pax_path = xstrndup (equals + 1,
+				      record + len - 1 - (equals + 1));
+	} else if (equals - key == 4 && !strncmp (key, "size", 4)) {
+	    tar->pax_size = strtoull (equals + 1, NULL, 10);
+	    tar->pax_size_set = 1;
+	}
+	pos += len;
+    }
+    return 1;
+}
+
+/* Move on to the next member, skipping whatever is left of the current
+ * one.  Returns 1 if there is another member, 0 at the end of the archive,
+ * or -1 on error.
+ */
+int tar_next (struct tar *tar, struct tar_member *member)
+{
+    unsigned char block[TAR_BLOCK];
+
+    if (!skip (tar, tar->remaining + tar->padding))
+	return -1;
+    tar->remaining = tar->padding = 0;
+
+    for (;;) {
+	uint64_t size, mode;
+	char type;
+	char *data;
+	size_t i;
+
+	if (!read_exact (tar, block, sizeof block))
+	    return -1;
+	for (i = 0; i < sizeof block && !block[i]; ++i)
+	    ;
+	if (i == sizeof block)
+	    return 0;
+	if (!checksum_ok (block) ||
+	    !parse_number (block + TAR_SIZE, 12, &size) ||
+	    !parse_number (block + TAR_MODE, 8, &mode)) {
+	    warning ("archive has a corrupt header, or is not a tar archive");
+	    return -1;
+	}
+	type = block[TAR_TYPEFLAG];
+
+	if (type == 'L' || type == 'x') {
+	    data = read_metadata (tar, size);
+	    if (!data)
+		return -1;
+	    if (type == 'L') {
+		free (tar->long_name);
+		tar->long_name = data;
+	    } else {
+		int ok = parse_pax (tar, data, size);
+
+		free (data);
+		if (!ok) {
+		    warning ("archive has a corrupt extended header");
+		    return -1;
+		}
+	    }
+	    continue;
+	}
+	if (type == 'g' || type == 'K') {
+	    if (!skip (tar, size + padding (size)))
+		return -1;
+	    continue;
+	}
+
+	free (tar->name);
+	if (tar->pax_path)
+	    tar->name = tar->pax_path;
+	else if (tar->long_name)
+	    tar->name = tar->long_name;
+	else if (!memcmp (block + TAR_MAGIC, "ustar", 5) &&
+		 block[TAR_PREFIX]) {
+	    char *prefix = xstrndup ((char *) block + TAR_PREFIX, 155);
+	    char *name = xstrndup ((char *) block + TAR_NAME, 100);
+
+	    tar->name = xasprintf ("%s/%s", prefix, name);
+	    free (name);
+	    free (prefix);
+	} else
+	    tar->name = xstrndup ((char *) block + TAR_NAME, 100);
+	if (tar->pax_path)
+	    free (tar->long_name);
+	if (tar->pax_size_set)
+	    size = tar->pax_size;
+	tar->pax_path = tar->long_name = NULL;
+	tar->pax_size_set = 0;
+
+	member->name = tar->name;
+	member->mode = mode & 07777;
+	member->size = size;
+	/* Old archives mark directories with a trailing slash instead. */
+	member->regular = type == '0' || type == '7' ||
+			  (type == '\0' && *tar->name &&
+			   tar->name[strlen (tar->name) - 1] != '/');
+	/* Only regular files and their like have data here. */
+	if (type == '1' || type == '2' || type == '3' || type == '4' ||
+	    type == '5' || type == '6')
+	    size = 0;
+	tar->remaining = size;
+	tar->padding = padding (size);
+	return 1;
+    }
+}
+
+/* Read up to len bytes of the current member's data.  Returns the number
+ * of bytes read, which is only less than len at the end of the member, or
+ * -1 on error.
+ */
+ssize_t tar_read (struct tar *tar, void *buf, size_t len)
+{
+    if (len > tar->remaining)
+	len = tar->remaining;
+    if (len && !read_exact (tar, buf, len))
+	return -1;
+    tar->remaining -= len;
+    return len;
+}
+
+/* Close the archive, and the file descriptor it was opened on. */
+int tar_close (struct tar *tar)
+{
+#ifdef HAVE_ZLIB
+    int ret = gzclose (tar->gz) == Z_OK;
+#else
+    int ret = close (tar->fd) == 0;
+#endif
+
+    free (tar->name);
+    free (tar->long_name);
+    free (tar->pax_path);
+    free (tar);
+    return ret;
+}
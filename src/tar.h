@@ -0,0 +1,35 @@
+/* tar.h - read tar archives as a stream
+ *
+ * Copyright (c) 2026 agent <agent@local>.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <stdint.h>
+#include <sys/types.h>
+
+struct tar;
+
+struct tar_member {
+    const char *name;	/* valid until the next tar_next call */
+    mode_t mode;
+    uint64_t size;
+    int regular;	/* a regular file, as opposed to a link, directory, ... */
+};
+
+struct tar *tar_open (int fd);
+int tar_next (struct tar *tar, struct tar_member *member);
+ssize_t tar_read (struct tar *tar, void *buf, size_t len);
+int tar_close (struct tar *tar);
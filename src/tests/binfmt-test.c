@@ -0,0 +1,182 @@
+/* binfmt-test.c - test libbinfmt
+ *
+ * Copyright (c) 2026 agent <agent@local>.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/* Usage: binfmt-test ADMINDIR PROCDIR RUNDIR DIR
+ *
+ * The library test sets up ADMINDIR with test-magic (interpreter
+ * /bin/magic, for files starting with "MAGIC"), test-ext (interpreter
+ * /bin/ext, for files ending in ".ext") and test-detect (for files starting
+ * with "DETECT", with a detector that does not exist), all enabled in
+ * PROCDIR, and test-off (interpreter /bin/off, for files starting with
+ * "OFF"), which is not.  DIR holds files called magic, file.ext, detect and
+ * off with the corresponding contents, and plain, which matches nothing.
+ *
+ * This only uses the installed interface, and is linked against the shared
+ * library.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "binfmt.h"
+
+static int failures;
+static char *last_message;
+
+static void check (const char *name, int ok)
+{
+    printf ("  %s: %s\n", ok ? "PASS" : "FAIL", name);
+    if (!ok)
+	++failures;
+}
+
+static char *in_dir (const char *dir, const char *name)
+{
+    char *path;
+
+    if (asprintf (&path, "%s/%s", dir, name) < 0) {
+	perror ("binfmt-test");
+	exit (1);
+    }
+    return path;
+}
+
+static void save_message (const char *message, void *data)
+{
+    *(int *) data += 1;
+    free (last_message);
+    last_message = strdup (message);
+}
+
+/* Return non-zero if result found exactly the one interpreter given, or
+ * none if interpreter is NULL.
+ */
+static int found (const struct binfmt_result *result, const char *interpreter)
+{
+    if (result->error != BINFMT_OK)
+	return 0;
+    if (!interpreter)
+	return result->count == 0;
+    return result->count == 1 &&
+	   !strcmp (result->interpreters[0], interpreter);
+}
+
+int main (int argc, char **argv)
+{
+    struct binfmt_context *context;
+    struct binfmt_result result, results[5];
+    const char *paths[5];
+    char *missing, *detect;
+    int error = -1, messages = 0;
+    int fd, ret;
+    size_t i;
+
+    if (argc != 5) {
+	fprintf (stderr, "usage: binfmt-test ADMINDIR PROCDIR RUNDIR DIR\n");
+	return 1;
+    }
+
+    context = binfmt_context_new (argv[1], argv[2], argv[3], &error);
+    check ("context", context != NULL && error == BINFMT_OK);
+    if (!context)
+	return 1;
+
+    paths[0] = in_dir (argv[4], "magic");
+    paths[1] = in_dir (argv[4], "file.ext");
+    paths[2] = in_dir (argv[4], "off");
+    paths[3] = in_dir (argv[4], "plain");
+    paths[4] = missing = in_dir (argv[4], "missing");
+    detect = in_dir (argv[4], "detect");
+
+    binfmt_find (context, paths[0], -1, &result);
+    check ("find: magic", found (&result, "/bin/magic"));
+    binfmt_result_clear (&result);
+    binfmt_find (context, paths[1], -1, &result);
+    check ("find: extension", found (&result, "/bin/ext"));
+    binfmt_result_clear (&result);
+    binfmt_find (context, paths[2], -1, &result);
+    check ("find: disabled format ignored", found (&result, NULL));
+    binfmt_result_clear (&result);
+    binfmt_find (context, paths[3], -1, &result);
+    check ("find: no match", found (&result, NULL));
+    binfmt_result_clear (&result);
+
+    fd = open (paths[0], O_RDONLY);
+    binfmt_find (context, paths[0], fd, &result);
+    check ("find: given descriptor", fd >= 0 && found (&result, "/bin/magic"));
+    binfmt_result_clear (&result);
+    if (fd >= 0)
+	close (fd);
+
+    ret = binfmt_find (context, missing, -1, &result);
+    check ("find: missing file",
+	   ret == BINFMT_ERR_OPEN && result.error == BINFMT_ERR_OPEN &&
+	   result.errnum == ENOENT && result.count == 0);
+    binfmt_result_clear (&result);
+
+    ret = binfmt_find_many (context, paths, 5, results);
+    check ("find many: first error returned", ret == BINFMT_ERR_OPEN);
+    check ("find many: magic", found (&results[0], "/bin/magic"));
+    check ("find many: extension", found (&results[1], "/bin/ext"));
+    check ("find many: disabled format ignored", found (&results[2], NULL));
+    check ("find many: no match", found (&results[3], NULL));
+    check ("find many: missing file",
+	   results[4].error == BINFMT_ERR_OPEN && results[4].errnum == ENOENT);
+    for (i = 0; i < 5; ++i)
+	binfmt_result_clear (&results[i]);
+
+    binfmt_context_set_error_handler (context, save_message, &messages);
+    binfmt_find (context, detect, -1, &result);
+    check ("error handler: detector not run", found (&result, NULL));
+    check ("error handler: called", messages == 1 && last_message &&
+	   !strncmp (last_message, "unable to run /nonexistent/detector: ",
+		     strlen ("unable to run /nonexistent/detector: ")));
+    binfmt_result_clear (&result);
+
+    ret = binfmt_find (NULL, paths[0], -1, &result);
+    check ("find: no context", ret == BINFMT_ERR_INVALID);
+    binfmt_context_free (context);
+
+    error = -1;
+    context = binfmt_context_new (missing, argv[2], argv[3], &error);
+    check ("context: missing admindir",
+	   context == NULL && error == BINFMT_ERR_DATABASE);
+    check ("strerror",
+	   !strcmp (binfmt_strerror (BINFMT_ERR_DATABASE),
+		    "unable to read format database"));
+    check ("internals not exported",
+	   !dlsym (RTLD_DEFAULT, "finder_find") &&
+	   !dlsym (RTLD_DEFAULT, "error_prefix") &&
+	   dlsym (RTLD_DEFAULT, "binfmt_find"));
+
+    for (i = 0; i < 5; ++i)
+	free ((char *) paths[i]);
+    free (detect);
+    free (last_message);
+    return failures ? 1 : 0;
+}
@@ -53,7 +53,11 @@ class BinfmtMisc(fuse.Fuse):
         fields = self.names[path[1:]]
         lines = ['enabled']
         lines.append('interpreter %s' % fields[4])
-        lines.append('flags: ') # TODO
+        flags = fields[5]
+        # As in the kernel, C implies O.
+        if 'C' in flags:
+            flags += 'O'
+        lines.append('flags: %s' % ''.join([f for f in 'POCF' if f in flags]))
         if fields[0] == 'E':
             lines.append('extension .%s' % fields[2])
         else:
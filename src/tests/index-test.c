@@ -0,0 +1,200 @@
+/* index-test.c - test what readers see while the index is replaced
+ *
+ * Copyright (c) 2026 agent <agent@local>.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/* Usage: index-test ADMINDIR PROCDIR RUNDIR DIR
+ *
+ * ADMINDIR must hold a format called test-old matching files that start
+ * with "OLD", and no index.  PROCDIR must have entries for test-old and
+ * test-new.  DIR is somewhere to put test files.  This does what
+ * update-binfmts does to the index while adding test-new, checking what
+ * readers see at each step.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "gl_xlist.h"
+#include "xalloc.h"
+#include "xvasprintf.h"
+
+#include "find.h"
+#include "format.h"
+#include "index.h"
+#include "paths.h"
+
+static const char *dir;
+static int failures;
+
+static void die (const char *message)
+{
+    fprintf (stderr, "index-test: %s\n", message);
+    exit (1);
+}
+
+static void check (const char *name, int ok)
+{
+    printf ("  %s: %s\n", ok ? "PASS" : "FAIL", name);
+    if (!ok)
+	++failures;
+}
+
+static void write_file (const char *path, const char *contents)
+{
+    FILE *file = fopen (path, "w");
+
+    if (!file || fputs (contents, file) == EOF || fclose (file) == EOF) {
+	perror (path);
+	exit (1);
+    }
+}
+
+/* Return non-zero if finder chooses the format called name for a file
+ * starting with contents.
+ */
+static int finds (struct finder *finder, const char *contents,
+		  const char *name)
+{
+    char *path = xasprintf ("%s/input", dir);
+    gl_list_t interpreters;
+    const struct binfmt *binfmt;
+    int fd, ret;
+
+    write_file (path, contents);
+    fd = open (path, O_RDONLY);
+    if (fd < 0) {
+	perror (path);
+	exit (1);
+    }
+    interpreters = finder_find (finder, path, fd, 0);
+    close (fd);
+    free (path);
+    if (!gl_list_size (interpreters)) {
+	gl_list_free (interpreters);
+	return 0;
+    }
+    binfmt = gl_list_get_at (interpreters, 0);
+    ret = !strcmp (binfmt->name, name);
+    gl_list_free (interpreters);
+    return ret;
+}
+
+/* Give admindir a modification time of its own, so that changes to it are
+ * noticed however coarse the filesystem's timestamps are.
+ */
+static void touch_admindir (time_t when)
+{
+    struct timespec times[2];
+
+    times[0].tv_sec = times[1].tv_sec = when;
+    times[0].tv_nsec = times[1].tv_nsec = 0;
+    if (utimensat (AT_FDCWD, admindir, times, 0) == -1) {
+	perror (admindir);
+	exit (1);
+    }
+}
+
+int main (int argc, char **argv)
+{
+    struct finder *reader, *finder;
+    struct index_snapshot before, after;
+    gl_list_t formats, loaded;
+    char *path;
+
+    if (argc != 5)
+	die ("usage: index-test ADMINDIR PROCDIR RUNDIR DIR");
+    admindir = argv[1];
+    procdir = argv[2];
+    rundir = argv[3];
+    dir = argv[4];
+
+    formats = load_formats (0, 0);
+    if (!index_write (formats, NULL))
+	die ("unable to write the index");
+    reader = finder_new (1);
+    check ("index: loaded", reader != NULL);
+    if (!reader)
+	return 1;
+    check ("index: current", finder_current (reader));
+    check ("index: finds test-old", finds (reader, "OLD", "test-old"));
+    loaded = index_load (&before, NULL);
+    gl_list_free (loaded);
+    index_unload (&before);
+
+    /* update-binfmts marks the index pending, and then changes admindir. */
+    index_begin_update ();
+    path = xasprintf ("%s/test-new", admindir);
+    write_file (path, ":\nmagic\n0\nNEW\n\n/bin/sh\n");
+    free (path);
+    touch_admindir (1000000000);
+    check ("pending: reader still current", finder_current (reader));
+    finder = finder_new (1);
+    check ("pending: new reader uses the old index", finder != NULL);
+    if (finder) {
+	check ("pending: new reader finds test-old",
+	       finds (finder, "OLD", "test-old"));
+	check ("pending: new reader does not see test-new",
+	       !finds (finder, "NEW", "test-new"));
+	finder_free_all (finder);
+    }
+
+    /* The new index is renamed into place. */
+    formats = load_formats (0, 0);
+    if (!index_write (formats, NULL))
+	die ("unable to write the index");
+    check ("renamed: reader no longer current", !finder_current (reader));
+    loaded = index_load (&after, NULL);
+    check ("renamed: next generation",
+	   loaded && after.generation == before.generation + 1);
+    if (loaded) {
+	gl_list_free (loaded);
+	index_unload (&after);
+    }
+    finder = finder_new (1);
+    check ("renamed: new reader uses the new index", finder != NULL);
+    if (finder) {
+	check ("renamed: new reader finds test-new",
+	       finds (finder, "NEW", "test-new"));
+	check ("renamed: new reader current", finder_current (finder));
+	finder_free_all (finder);
+    }
+
+    /* admindir changes without update-binfmts marking the index pending. */
+    path = xasprintf ("%s/test-new", admindir);
+    write_file (path, ":\nmagic\n0\nNEWER\n\n/bin/sh\n");
+    free (path);
+    touch_admindir (1000000001);
+    check ("stale: index not used", finder_new (1) == NULL);
+    finder = finder_new (0);
+    check ("stale: admindir scanned",
+	   finds (finder, "NEWER", "test-new") &&
+	   !finds (finder, "NEW", "test-new"));
+    check ("stale: scanned formats not kept", !finder_current (finder));
+    finder_free_all (finder);
+
+    finder_free_all (reader);
+    return failures ? 1 : 0;
+}
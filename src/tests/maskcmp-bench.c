@@ -0,0 +1,198 @@
+/* maskcmp-bench.c - compare maskcmp kernels against a scalar check
+ *
+ * Copyright (c) 2026 agent <agent@local>.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/* Checks batches of qemu-like formats, which share the first 18 bytes of
+ * a masked 20-byte ELF header magic and so would all land in the same
+ * matcher bucket, against a header matching one of them.  Each kernel the
+ * CPU supports must give the same results as the copy, mask and memcmp
+ * loop that find_interpreters used to run for each format.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+
+#include "xalloc.h"
+
+#include "maskcmp.h"
+
+#define MAGIC_SIZE 20
+#define BITS (sizeof (unsigned long) * CHAR_BIT)
+
+static const unsigned char elf_magic[MAGIC_SIZE] =
+    "\x7f" "ELF" "\x01\x01\x01" "\0\0\0\0\0\0\0\0\0" "\x02\0" "\0\0";
+static const unsigned char elf_mask[MAGIC_SIZE] =
+    "\xff\xff\xff\xff\xff\xff\xff\0\xff\xff\xff\xff\xff\xff\xff\xff"
+    "\xfe\xff\xff\xff";
+
+struct batch {
+    size_t n;
+    uint32_t *offsets, *rows, *widths, *candidates;
+    unsigned char *magics, *masks;
+    struct maskcmp_table table;
+};
+
+static void batch_init (struct batch *batch, size_t n)
+{
+    size_t i, width = (MAGIC_SIZE + MASKCMP_ALIGN - 1) / MASKCMP_ALIGN *
+		      MASKCMP_ALIGN;
+
+    batch->n = n;
+    batch->offsets = xcalloc (n, sizeof *batch->offsets);
+    batch->rows = xcalloc (n, sizeof *batch->rows);
+    batch->widths = xcalloc (n, sizeof *batch->widths);
+    batch->candidates = xcalloc (n, sizeof *batch->candidates);
+    batch->magics = xzalloc (n * width);
+    batch->masks = xzalloc (n * width);
+    for (i = 0; i < n; ++i) {
+	unsigned char *magic = batch->magics + i * width;
+
+	batch->rows[i] = i * width;
+	batch->widths[i] = width;
+	batch->candidates[i] = i;
+	memcpy (magic, elf_magic, MAGIC_SIZE);
+	magic[18] = i % 256;
+	magic[19] = i / 256;
+	memcpy (batch->masks + i * width, elf_mask, MAGIC_SIZE);
+    }
+    batch->table.offsets = batch->offsets;
+    batch->table.rows = batch->rows;
+    batch->table.widths = batch->widths;
+    batch->table.magics = batch->magics;
+    batch->table.masks = batch->masks;
+}
+
+static void batch_free (struct batch *batch)
+{
+    free (batch->offsets);
+    free (batch->rows);
+    free (batch->widths);
+    free (batch->candidates);
+    free (batch->magics);
+    free (batch->masks);
+}
+
+/* The check from find_interpreters before maskcmp existed. */
+static void scalar (const struct batch *batch, const unsigned char *header,
+		    unsigned long *matched)
+{
+    size_t i, j;
+
+    for (i = 0; i < batch->n; ++i) {
+	const unsigned char *magic = batch->magics + batch->rows[i];
+	const unsigned char *mask = batch->masks + batch->rows[i];
+	unsigned char *segment;
+
+	segment = xmalloc (MAGIC_SIZE);
+	memcpy (segment, header + batch->offsets[i], MAGIC_SIZE);
+	for (j = 0; j < MAGIC_SIZE; ++j)
+	    segment[j] &= mask[j];
+	if (!memcmp (segment, magic, MAGIC_SIZE))
+	    matched[i / BITS] |= 1UL << (i % BITS);
+	free (segment);
+    }
+}
+
+static double now (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int bench (size_t n)
+{
+    struct batch batch;
+    unsigned char header[MAGIC_SIZE + MASKCMP_ALIGN];
+    size_t nwords = n / BITS + 1;
+    unsigned long *expected, *matched;
+    size_t iterations = 1 + 2000000 / n, it, i;
+    double start;
+    int ret = 1;
+
+    batch_init (&batch, n);
+    memset (header, 0xaa, sizeof header);
+    memcpy (header, elf_magic, MAGIC_SIZE);
+    header[16] = 3;
+    header[18] = (n - 1) % 256;
+    header[19] = (n - 1) / 256;
+
+    expected = xcalloc (nwords, sizeof *expected);
+    matched = xcalloc (nwords, sizeof *matched);
+    scalar (&batch, header, expected);
+    if (expected[(n - 1) / BITS] != 1UL << ((n - 1) % BITS)) {
+	fprintf (stderr, "%zu formats: scalar check failed\n", n);
+	ret = 0;
+	goto out;
+    }
+
+    start = now ();
+    for (it = 0; it < iterations; ++it)
+	scalar (&batch, header, matched);
+    printf ("%5zu formats: %-8s %8.2f ns/format\n", n, "scalar",
+	    (now () - start) * 1e9 / (iterations * n));
+
+    for (i = 0; maskcmp_names (i); ++i) {
+	const char *name = maskcmp_names (i);
+	maskcmp_fn *fn = maskcmp_get (name);
+
+	if (!fn) {
+	    printf ("%5zu formats: %-8s unsupported\n", n, name);
+	    continue;
+	}
+	memset (matched, 0, nwords * sizeof *matched);
+	fn (&batch.table, header, batch.candidates, n, matched);
+	if (memcmp (matched, expected, nwords * sizeof *matched)) {
+	    fprintf (stderr, "%zu formats: %s disagrees with scalar check\n",
+		     n, name);
+	    ret = 0;
+	    continue;
+	}
+	start = now ();
+	for (it = 0; it < iterations; ++it)
+	    fn (&batch.table, header, batch.candidates, n, matched);
+	printf ("%5zu formats: %-8s %8.2f ns/format\n", n, name,
+		(now () - start) * 1e9 / (iterations * n));
+    }
+
+out:
+    free (matched);
+    free (expected);
+    batch_free (&batch);
+    return ret;
+}
+
+int main (void)
+{
+    static const size_t sizes[] = { 8, 64, 512, 4096 };
+    size_t i;
+    int ok = 1;
+
+    for (i = 0; i < sizeof sizes / sizeof *sizes; ++i)
+	if (!bench (sizes[i]))
+	    ok = 0;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,261 @@
+/* match-bench.c - compare matcher against a linear scan of formats
+ *
+ * Copyright (c) 2026 agent <agent@local>.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/* Builds synthetic databases of qemu-like ELF formats (differing in class,
+ * byte order and machine, some with masks) plus some extension formats,
+ * checks that matcher_match returns exactly what the old linear scan in
+ * find_interpreters did, and reports the time per file for each.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "gl_xlist.h"
+#include "gl_array_list.h"
+#include "xalloc.h"
+#include "xvasprintf.h"
+
+#include "format.h"
+#include "match.h"
+
+#define HEADER_SIZE 20
+#define NFILES 256
+
+static struct binfmt *make_magic (size_t i)
+{
+    struct binfmt *binfmt = xzalloc (sizeof *binfmt);
+    unsigned char *magic = xzalloc (HEADER_SIZE + 1);
+    unsigned char *mask = xzalloc (HEADER_SIZE + 1);
+
+    /* \x7fELF, class, data, version, then the e_type and e_machine
+     * fields in the chosen byte order.
+     */
+    memcpy (magic, "\x7f" "ELF", 4);
+    magic[4] = 1 + i % 2;
+    magic[5] = 1 + (i / 2) % 2;
+    magic[6] = 1;
+    magic[16] = 2;
+    magic[18] = (i / 4) % 256;
+    magic[19] = (i / 1024) % 256;
+    memset (mask, 0xff, HEADER_SIZE);
+    /* Ignore padding, and accept both executables and shared objects. */
+    memset (mask + 7, 0, 9);
+    mask[16] = 0xfe;
+
+    binfmt->name = xasprintf ("magic%zu", i);
+    binfmt->type = xstrdup ("magic");
+    binfmt->offset = xstrdup ("0");
+    binfmt->magic = (char *) magic;
+    binfmt->magic_size = HEADER_SIZE;
+    /* A quarter of the formats have no mask, like most real ones. */
+    if (i % 4 == 3) {
+	free (mask);
+	binfmt->mask = xstrdup ("");
+    } else
+	binfmt->mask = (char *) mask;
+    return binfmt;
+}
+
+static struct binfmt *make_extension (size_t i)
+{
+    struct binfmt *binfmt = xzalloc (sizeof *binfmt);
+
+    binfmt->name = xasprintf ("extension%zu", i);
+    binfmt->type = xstrdup ("extension");
+    binfmt->offset = xstrdup ("0");
+    binfmt->magic = xasprintf ("ext%zu", i % 50);
+    binfmt->magic_size = strlen (binfmt->magic);
+    binfmt->mask = xstrdup ("");
+    return binfmt;
+}
+
+static void free_binfmt (const void *data)
+{
+    struct binfmt *binfmt = (struct binfmt *) data;
+
+    free (binfmt->name);
+    free (binfmt->type);
+    free (binfmt->offset);
+    free (binfmt->magic);
+    free (binfmt->mask);
+    free (binfmt);
+}
+
+/* The matching loop from find_interpreters before matchers existed. */
+static gl_list_t linear_match (gl_list_t formats, const char *buf,
+			       size_t toread, const char *extension)
+{
+    gl_list_t ok_formats;
+    gl_list_iterator_t format_iter;
+    const struct binfmt *binfmt;
+
+    ok_formats = gl_list_create_empty (GL_ARRAY_LIST, NULL, NULL, NULL, true);
+    format_iter = gl_list_iterator (formats);
+    while (gl_list_iterator_next (&format_iter, (const void **) &binfmt,
+				  NULL)) {
+	if (!strcmp (binfmt->type, "magic")) {
+	    char *segment;
+
+	    segment = xmalloc (binfmt->magic_size);
+	    memcpy (segment, buf + atoi (binfmt->offset), binfmt->magic_size);
+	    if (*binfmt->mask)
+		for (size_t i = 0; i < toread && i < binfmt->magic_size; ++i)
+		    segment[i] &= binfmt->mask[i];
+	    if (!memcmp (segment, binfmt->magic, binfmt->magic_size))
+		gl_list_add_last (ok_formats, binfmt);
+	    free (segment);
+	} else {
+	    if (extension && !strcmp (extension, binfmt->magic))
+		gl_list_add_last (ok_formats, binfmt);
+	}
+    }
+    gl_list_iterator_free (&format_iter);
+    return ok_formats;
+}
+
+static int same_list (gl_list_t left, gl_list_t right)
+{
+    size_t i;
+
+    if (gl_list_size (left) != gl_list_size (right))
+	return 0;
+    for (i = 0; i < gl_list_size (left); ++i)
+	if (gl_list_get_at (left, i) != gl_list_get_at (right, i))
+	    return 0;
+    return 1;
+}
+
+static double now (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int bench (size_t nformats)
+{
+    gl_list_t formats;
+    struct matcher *matcher;
+    char bufs[NFILES][HEADER_SIZE];
+    char *extensions[NFILES] = { NULL };
+    size_t i, toread, iterations, matches = 0;
+    double start, linear_time, matcher_time;
+    int ret = 1;
+
+    formats = gl_list_create_empty (GL_ARRAY_LIST, NULL, NULL, free_binfmt,
+				    true);
+    for (i = 0; i < nformats; ++i) {
+	if (i % 10 == 9)
+	    gl_list_add_last (formats, make_extension (i));
+	else
+	    gl_list_add_last (formats, make_magic (i));
+    }
+    matcher = matcher_new (formats);
+    toread = matcher_toread (matcher);
+    if (toread != HEADER_SIZE) {
+	fprintf (stderr, "toread is %zu, expected %d\n", toread, HEADER_SIZE);
+	ret = 0;
+	goto out;
+    }
+
+    /* Headers of some files that match, and some that don't. */
+    srand (nformats);
+    for (i = 0; i < NFILES; ++i) {
+	size_t j;
+
+	if (i % 2) {
+	    const struct binfmt *binfmt =
+		gl_list_get_at (formats, rand () % nformats);
+
+	    memcpy (bufs[i], binfmt->magic, HEADER_SIZE);
+	    for (j = 7; j < 16; ++j)
+		bufs[i][j] = rand ();
+	    if (rand () % 2)
+		bufs[i][16] = 3;
+	} else
+	    for (j = 0; j < HEADER_SIZE; ++j)
+		bufs[i][j] = rand ();
+	extensions[i] = i % 3 ? xasprintf ("ext%d", rand () % 60) : NULL;
+    }
+
+    for (i = 0; i < NFILES; ++i) {
+	gl_list_t expected = linear_match (formats, bufs[i], toread,
+					   extensions[i]);
+	gl_list_t got = matcher_match (matcher, bufs[i], extensions[i]);
+
+	if (!same_list (expected, got)) {
+	    fprintf (stderr, "%zu formats: file %zu: matcher returned %zu "
+			     "formats, linear scan returned %zu\n",
+		     nformats, i, gl_list_size (got),
+		     gl_list_size (expected));
+	    ret = 0;
+	}
+	matches += gl_list_size (got);
+	gl_list_free (expected);
+	gl_list_free (got);
+    }
+    if (!ret)
+	goto out;
+
+    iterations = 1 + 100000 / nformats;
+
+    start = now ();
+    for (size_t n = 0; n < iterations; ++n)
+	for (i = 0; i < NFILES; ++i)
+	    gl_list_free (linear_match (formats, bufs[i], toread,
+					extensions[i]));
+    linear_time = now () - start;
+
+    start = now ();
+    for (size_t n = 0; n < iterations; ++n)
+	for (i = 0; i < NFILES; ++i)
+	    gl_list_free (matcher_match (matcher, bufs[i], extensions[i]));
+    matcher_time = now () - start;
+
+    printf ("%6zu formats: linear %9.2f us/file, matcher %7.2f us/file "
+	    "(%zu matches)\n",
+	    nformats, linear_time * 1e6 / (iterations * NFILES),
+	    matcher_time * 1e6 / (iterations * NFILES), matches);
+
+out:
+    for (i = 0; i < NFILES; ++i)
+	free (extensions[i]);
+    matcher_free (matcher);
+    gl_list_free (formats);
+    return ret;
+}
+
+int main (void)
+{
+    static const size_t sizes[] = { 10, 100, 1000, 10000 };
+    size_t i;
+    int ok = 1;
+
+    for (i = 0; i < sizeof sizes / sizeof *sizes; ++i)
+	if (!bench (sizes[i]))
+	    ok = 0;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,110 @@
+/* spawn-bench.c - compare ways of starting detector programs
+ *
+ * Copyright (c) 2026 agent <agent@local>.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/* Runs a trivial detector repeatedly with libpipeline, as run-detectors
+ * used to, and with launch_detector, first from a small process and then
+ * after growing the process so that fork has more page tables to copy.
+ * Both must agree on the exit status of accepting and rejecting detectors.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <pipeline.h>
+
+#include "xalloc.h"
+
+#include "launch.h"
+
+#define ITERATIONS 500
+
+char *program_name = "spawn-bench";
+
+static int run_pipeline (const char *detector)
+{
+    pipeline *p = pipeline_new_command_args (detector, "/dev/null", NULL);
+
+    return pipeline_run (p);
+}
+
+static int run_launch (const char *detector)
+{
+    pid_t pid = launch_detector (detector, "/dev/null");
+
+    return pid > 0 ? launch_wait (pid) : -1;
+}
+
+static double now (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void bench (const char *label)
+{
+    double start;
+    int i;
+
+    start = now ();
+    for (i = 0; i < ITERATIONS; ++i)
+	run_pipeline ("true");
+    printf ("%-12s %-10s %8.1f us/detector\n", label, "libpipeline",
+	    (now () - start) * 1e6 / ITERATIONS);
+
+    start = now ();
+    for (i = 0; i < ITERATIONS; ++i)
+	run_launch ("true");
+    printf ("%-12s %-10s %8.1f us/detector\n", label, "launch",
+	    (now () - start) * 1e6 / ITERATIONS);
+}
+
+int main (void)
+{
+    static const size_t sizes[] = { 128, 512 };
+    size_t i;
+    char *ballast[sizeof sizes / sizeof *sizes];
+
+    if (run_pipeline ("true") != 0 || run_launch ("true") != 0 ||
+	run_pipeline ("false") == 0 || run_launch ("false") == 0) {
+	fprintf (stderr, "libpipeline and launch disagree\n");
+	return 1;
+    }
+
+    bench ("small");
+    for (i = 0; i < sizeof sizes / sizeof *sizes; ++i) {
+	char label[32];
+
+	/* Touch every page so that it really is mapped. */
+	ballast[i] = xmalloc (sizes[i] << 20);
+	memset (ballast[i], 1, sizes[i] << 20);
+	snprintf (label, sizeof label, "+%zu MiB", sizes[i]);
+	bench (label);
+    }
+    for (i = 0; i < sizeof sizes / sizeof *sizes; ++i)
+	free (ballast[i]);
+    return 0;
+}
@@ -0,0 +1,45 @@
+/* test-detector.c - detector plugin for the test suite
+ *
+ * Copyright (c) 2026 agent <agent@local>.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/* Accepts files whose first line starts with "plugin".  Built more than
+ * once: with TEST_ABI set to claim some other interface version, and with
+ * TEST_NO_DETECT set to leave out binfmt_detect.
+ */
+
+#include <string.h>
+
+#include "binfmt-detector.h"
+
+#ifndef TEST_ABI
+#  define TEST_ABI BINFMT_DETECTOR_ABI
+#endif
+
+const int binfmt_detector_abi = TEST_ABI;
+
+#ifndef TEST_NO_DETECT
+int binfmt_detect (const char *path, int fd,
+		   const unsigned char *header, size_t header_size)
+{
+    (void) path;
+    (void) fd;
+    if (header_size >= 6 && !memcmp (header, "plugin", 6))
+	return BINFMT_DETECT_MATCH;
+    return BINFMT_DETECT_NO_MATCH;
+}
+#endif
@@ -33,7 +33,8 @@ init () {
 	tmpdir="tmp-${0##*/}"
 	mkdir -p "$tmpdir" || exit $?
 	trap cleanup HUP INT QUIT TERM
-	mkdir -p "$tmpdir/usr/share/binfmts" "$tmpdir/var/lib/binfmts"
+	mkdir -p "$tmpdir/usr/share/binfmts" "$tmpdir/var/lib/binfmts" \
+		 "$tmpdir/run/binfmt-support"
 }
 
 fake_proc () {
@@ -53,7 +54,8 @@ fake_proc () {
 
 update_binfmts () {
 	$UPDATE_BINFMTS --admindir "$tmpdir/var/lib/binfmts" \
-			--importdir "$tmpdir/usr/share/binfmts" "$@"
+			--importdir "$tmpdir/usr/share/binfmts" \
+			--rundir "$tmpdir/run/binfmt-support" "$@"
 }
 
 update_binfmts_proc () {
@@ -62,7 +64,8 @@ update_binfmts_proc () {
 
 run_detectors () {
 	$RUN_DETECTORS --admindir "$tmpdir/var/lib/binfmts" \
-		       --procdir "$tmpdir/proc" "$@"
+		       --procdir "$tmpdir/proc" \
+		       --rundir "$tmpdir/run/binfmt-support" "$@"
 }
 
 expect_pass () {
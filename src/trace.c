@@ -0,0 +1,265 @@
+/* trace.c - run-detectors timing traces
+ *
+ * Copyright (c) 2026 agent <agent@local>.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/* If BINFMT_TRACE is set in its environment, run-detectors times each
+ * phase of its work and each detector it runs, and just before exec()ing
+ * the interpreter adds a record of it all to a trace file.  Like the usage
+ * profile, each user has a file in rundir, mapped shared by every
+ * run-detectors process running as that user.  It is a ring of fixed-size
+ * records: writers claim the next slot with an atomic counter, and each
+ * slot has a sequence number that is odd while the slot is being written,
+ * so that readers can skip records that are torn.
+ *
+ * Without BINFMT_TRACE, tracing costs one getenv and a test of a null
+ * pointer at each phase.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "xalloc.h"
+
+#include "runfile.h"
+#include "trace.h"
+
+#define TRACE_MAGIC "BFTRACE"
+#define TRACE_VERSION 1
+#define TRACE_SLOTS 512
+
+struct trace_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t slots;
+    uint32_t record_size;
+    uint32_t reserved;
+    uint64_t next;	/* the number of slots ever claimed */
+};
+
+struct trace_slot {
+    uint32_t sequence;	/* odd while being written; 0 if never written */
+    uint32_t reserved;
+    struct trace_record record;
+};
+
+#define TRACE_SIZE (sizeof (struct trace_header) + \
+		    TRACE_SLOTS * sizeof (struct trace_slot))
+
+static const char *const phase_names[TRACE_PHASES] = {
+    "daemon", "load", "cache", "read", "match", "enabled", "rules", "detect",
+    "save", "exec"
+};
+
+/* The record for this process, or NULL if it is not being traced. */
+static struct trace_record *current;
+static uint64_t last_mark;
+static int64_t claimed = -1;
+
+const char *trace_phase_name (enum trace_phase phase)
+{
+    return phase_names[phase];
+}
+
+static uint64_t now_usec (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static uint32_t since (uint64_t then)
+{
+    uint64_t usec = now_usec () - then;
+
+    return usec > UINT32_MAX ? UINT32_MAX : usec;
+}
+
+static void copy_name (char *dest, const char *name)
+{
+    strncpy (dest, name, TRACE_NAME_MAX - 1);
+    dest[TRACE_NAME_MAX - 1] = '\0';
+}
+
+/* Start tracing this process if BINFMT_TRACE asks for it. */
+void trace_start (void)
+{
+    const char *env = getenv ("BINFMT_TRACE");
+
+    if (!env || !*env || !strcmp (env, "0"))
+	return;
+    current = xzalloc (sizeof *current);
+    current->start = last_mark = now_usec ();
+}
+
+/* Return the time to pass to trace_detector, or 0 if not tracing. */
+uint64_t trace_now (void)
+{
+    return current ? now_usec () : 0;
+}
+
+/* Charge the time since the last mark to phase. */
+void trace_mark (enum trace_phase phase)
+{
+    uint64_t now;
+
+    if (!current)
+	return;
+    now = now_usec ();
+    current->usec[phase] += now - last_mark;
+    current->phases |= 1U << phase;
+    last_mark = now;
+}
+
+/* Record that the detector for format finished with status, having been
+ * started at started (from trace_now).
+ */
+void trace_detector (const char *format, int status, uint64_t started)
+{
+    struct trace_detector *detector;
+
+    if (!current || current->detectors >= TRACE_DETECTORS)
+	return;
+    detector = &current->detector[current->detectors++];
+    copy_name (detector->format, format);
+    detector->status = status;
+    detector->usec = since (started);
+}
+
+void trace_format (const char *format)
+{
+    if (current)
+	copy_name (current->format, format);
+}
+
+static int header_ok (const void *map)
+{
+    const struct trace_header *header = map;
+
+    return header->version == TRACE_VERSION &&
+	   header->slots == TRACE_SLOTS &&
+	   header->record_size == sizeof (struct trace_record);
+}
+
+static void header_init (void *map)
+{
+    struct trace_header *header = map;
+
+    header->version = TRACE_VERSION;
+    header->slots = TRACE_SLOTS;
+    header->record_size = sizeof (struct trace_record);
+}
+
+static const struct runfile trace_file = {
+    "trace", TRACE_MAGIC, TRACE_SIZE, header_ok, header_init
+};
+
+/* Write this process's record to the current user's trace file.  This may
+ * be called again if exec() fails, in which case the same slot is
+ * rewritten.  Failures are ignored; the trace is only advisory.
+ */
+void trace_commit (void)
+{
+    struct trace_header *header;
+    struct trace_slot *slot;
+    uint32_t sequence;
+
+    if (!current)
+	return;
+    current->total = since (current->start);
+
+    header = runfile_open (&trace_file, NULL);
+    if (!header)
+	return;
+    if (claimed < 0)
+	claimed = __atomic_fetch_add (&header->next, 1, __ATOMIC_RELAXED) %
+		  TRACE_SLOTS;
+    slot = (struct trace_slot *) (header + 1) + claimed;
+
+    /* If another process is writing this slot, which can only happen once
+     * the ring has wrapped right round, let it win.
+     */
+    sequence = __atomic_load_n (&slot->sequence, __ATOMIC_RELAXED);
+    if ((sequence & 1) ||
+	!__atomic_compare_exchange_n (&slot->sequence, &sequence,
+				      sequence + 1, 0, __ATOMIC_ACQUIRE,
+				      __ATOMIC_RELAXED))
+	goto out;
+    __atomic_thread_fence (__ATOMIC_RELEASE);
+    memcpy (&slot->record, current, sizeof *current);
+    __atomic_store_n (&slot->sequence, sequence + 2, __ATOMIC_RELEASE);
+
+out:
+    runfile_close (&trace_file, header, -1);
+}
+
+struct collected {
+    struct trace_record *records;
+    size_t count, allocated;
+};
+
+static void collect (const void *map, void *data)
+{
+    const struct trace_header *header = map;
+    const struct trace_slot *slots = (const struct trace_slot *) (header + 1);
+    struct collected *collected = data;
+    size_t i, j;
+
+    for (i = 0; i < TRACE_SLOTS; ++i) {
+	struct trace_record *record;
+	uint32_t before, after;
+
+	before = __atomic_load_n (&slots[i].sequence, __ATOMIC_ACQUIRE);
+	if (!before || (before & 1))
+	    continue;
+	if (collected->count == collected->allocated)
+	    collected->records = x2nrealloc (collected->records,
+					     &collected->allocated,
+					     sizeof *collected->records);
+	record = &collected->records[collected->count];
+	memcpy (record, &slots[i].record, sizeof *record);
+	__atomic_thread_fence (__ATOMIC_ACQUIRE);
+	after = __atomic_load_n (&slots[i].sequence, __ATOMIC_RELAXED);
+	/* Skip records rewritten while they were being copied. */
+	if (before != after)
+	    continue;
+	record->format[TRACE_NAME_MAX - 1] = '\0';
+	if (record->detectors > TRACE_DETECTORS)
+	    record->detectors = TRACE_DETECTORS;
+	for (j = 0; j < record->detectors; ++j)
+	    record->detector[j].format[TRACE_NAME_MAX - 1] = '\0';
+	++collected->count;
+    }
+}
+
+/* Collect the records in every user's trace file, setting *count to the
+ * number of them.
+ */
+struct trace_record *trace_load (size_t *count)
+{
+    struct collected collected = { NULL, 0, 0 };
+
+    runfile_each (&trace_file, collect, &collected);
+    *count = collected.count;
+    return collected.records;
+}
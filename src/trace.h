@@ -0,0 +1,70 @@
+/* trace.h - interface to run-detectors timing traces
+ *
+ * Copyright (c) 2026 agent <agent@local>.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <stdint.h>
+
+#define TRACE_NAME_MAX 48
+#define TRACE_DETECTORS 8
+
+/* The phases of one run of run-detectors, in the order they happen. */
+enum trace_phase {
+    TRACE_DAEMON,	/* asking detectord */
+    TRACE_LOAD,		/* loading the formats */
+    TRACE_CACHE,	/* looking up a cached verdict */
+    TRACE_READ,		/* opening the target and reading its header */
+    TRACE_MATCH,	/* matching magic and extensions */
+    TRACE_ENABLED,	/* checking formats are enabled in procdir */
+    TRACE_RULES,	/* checking rules */
+    TRACE_DETECT,	/* running detectors */
+    TRACE_SAVE,		/* recording the verdict and usage profile */
+    TRACE_EXEC,		/* everything up to the last call to execvp */
+    TRACE_PHASES
+};
+
+/* Detector statuses other than exit statuses. */
+#define TRACE_ABNORMAL	-1	/* killed by a signal */
+#define TRACE_NOT_RUN	-2	/* could not be started */
+#define TRACE_KILLED	-3	/* killed once another detector accepted */
+
+struct trace_detector {
+    char format[TRACE_NAME_MAX];
+    int32_t status;		/* 0 if the detector accepted the target */
+    uint32_t usec;
+};
+
+struct trace_record {
+    uint64_t start;		/* CLOCK_MONOTONIC, in microseconds */
+    uint32_t phases;		/* bit n is set if phase n took place */
+    uint32_t usec[TRACE_PHASES];
+    uint32_t total;
+    uint32_t detectors;
+    char format[TRACE_NAME_MAX];	/* the format chosen, or empty */
+    struct trace_detector detector[TRACE_DETECTORS];
+};
+
+const char *trace_phase_name (enum trace_phase phase);
+
+void trace_start (void);
+uint64_t trace_now (void);
+void trace_mark (enum trace_phase phase);
+void trace_detector (const char *format, int status, uint64_t started);
+void trace_format (const char *format);
+void trace_commit (void);
+
+struct trace_record *trace_load (size_t *count);
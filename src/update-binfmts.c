@@ -25,12 +25,18 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <errno.h>
 #include <stdarg.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <string.h>
 #include <ctype.h>
 #include <dirent.h>
+#include <ftw.h>
+#include <pthread.h>
+#include <sys/file.h>
 #include <sys/utsname.h>
 #include <sys/stat.h>
 #include <sys/types.h>
@@ -46,16 +52,27 @@
 #include <pipeline.h>
 
 #include "argp.h"
+#include "gl_array_list.h"
 #include "gl_xlist.h"
 #include "hash.h"
 #include "xalloc.h"
+#include "xstrndup.h"
 #include "xvasprintf.h"
 
+#include "builtin.h"
+#include "cache.h"
+#include "consolidate.h"
 #include "error.h"
 #include "find.h"
 #include "format.h"
+#include "index.h"
 #include "kvhash.h"
 #include "paths.h"
+#include "plugin.h"
+#include "profile.h"
+#include "rule.h"
+#include "tar.h"
+#include "trace.h"
 
 #define HASH_FOR_EACH(iter, hash) \
     for (iter = hash_get_first (hash); iter; iter = hash_get_next (hash, iter))
@@ -63,10 +80,30 @@
 char *program_name;
 
 static int test = 0;
+static int consolidate = 0;
+static int from_plan = 0;
+static long jobs = 0;
+static int null_separated = 0;
 
 static char *path_register, *path_status;
 static char *run_detectors;
 
+/* Kept open from the first registration until the end of the action. */
+static int register_fd = -1;
+
+/* While enabling many formats at once, the number of formats using each
+ * spec, so that each format need not be compared with every other.
+ */
+static Hash_table *spec_users;
+
+/* While running --batch, the names of formats whose administrative files
+ * are to be written or removed, and the kernel state wanted for formats
+ * (BATCH_ENABLE or BATCH_DISABLE), both applied only by batch_commit.
+ */
+static Hash_table *batch_admin, *batch_kernel;
+#define BATCH_ENABLE ((void *) 1)
+#define BATCH_DISABLE ((void *) 2)
+
 Hash_table *formats;
 
 static inline bool exists (const char *name)
@@ -76,6 +113,16 @@ static inline bool exists (const char *name)
     return stat (name, &st) != -1;
 }
 
+/* Priorities are decimal integers, possibly negative. */
+static bool priority_valid (const char *priority)
+{
+    char *end;
+
+    errno = 0;
+    strtol (priority, &end, 10);
+    return *priority && !*end && !errno;
+}
+
 static inline bool is_file (const char *name)
 {
     struct stat st;
@@ -210,10 +257,14 @@ static enum binfmt_style get_binfmt_style (void)
 
 static int load_binfmt_misc (void)
 {
+    static int loaded = 0;
     enum binfmt_style style;
 
+    if (loaded)
+	return 1;
     if (test) {
 	printf ("load binfmt_misc\n");
+	loaded = 1;
 	return 1;
     }
 
@@ -264,6 +315,7 @@ static int load_binfmt_misc (void)
 	    fclose (status_file);
 	} else
 	    warning_err ("unable to open %s for writing", path_status);
+	loaded = 1;
 	return 1;
     } else {
 	warning ("binfmt_misc initialised, but %s missing!  Giving up.",
@@ -319,7 +371,15 @@ static int unload_binfmt_misc (void)
 
 static void load_format (const char *name, int quiet)
 {
-    char *admindir_name = xasprintf ("%s/%s", admindir, name);
+    char *admindir_name;
+
+    /* An existing entry would not be replaced anyway. */
+    if (kvhash_exists (formats, name))
+	return;
+    /* Until a batch is committed, its changes exist only in formats. */
+    if (batch_admin && kvhash_exists (batch_admin, name))
+	return;
+    admindir_name = xasprintf ("%s/%s", admindir, name);
     if (is_file (admindir_name)) {
 	struct binfmt *format = binfmt_load (name, admindir_name, quiet);
 	if (format) {
@@ -339,34 +399,601 @@ static void load_all_formats (int quiet)
     if (!dir)
 	quit_err ("unable to open %s", admindir);
     while ((entry = readdir (dir)) != NULL) {
-	if (!strcmp (entry->d_name, ".") || !strcmp (entry->d_name, ".."))
+	if (entry->d_name[0] == '.')
 	    continue;
 	load_format (entry->d_name, quiet);
     }
     closedir (dir);
 }
 
+static char *boot_plan (void);
+
+/* Recompile the index read by run-detectors and --find.  Formats are
+ * loaded afresh rather than taken from the formats table, since the index
+ * needs them with their magic and mask expanded.  Also make sure that
+ * run-detectors has somewhere to keep its verdict cache.
+ */
+static void update_index (void)
+{
+    gl_list_t all_formats;
+    gl_list_iterator_t format_iter;
+    struct binfmt *binfmt;
+    char *plan;
+
+    if (test)
+	return;
+
+    all_formats = load_formats (0, 1);
+    plan = boot_plan ();
+    if (!index_write (all_formats, plan))
+	warning ("unable to update index of binary formats");
+    free (plan);
+    cache_create_dir ();
+
+    format_iter = gl_list_iterator (all_formats);
+    while (gl_list_iterator_next (&format_iter, (const void **) &binfmt,
+				  NULL))
+	binfmt_free (binfmt);
+    gl_list_iterator_free (&format_iter);
+    gl_list_free (all_formats);
+}
+
 /* Actions. */
 
+static inline bool flag_set (const char *flag)
+{
+    return flag && !strcmp (flag, "yes");
+}
+
+static char *spec_key (const struct binfmt *binfmt)
+{
+    /* The same fields as binfmt_equals compares. */
+    return xasprintf ("%s\n%s\n%s\n%s", binfmt->type, binfmt->offset,
+		      binfmt->magic, binfmt->mask);
+}
+
+/* Count the users of each spec among all installed formats, in one pass. */
+static void spec_users_init (void)
+{
+    struct kvelem *format_iter;
+
+    load_all_formats (1);
+    spec_users = kvhash_initialize (hash_get_n_entries (formats), NULL,
+				    kvhash_free_key);
+    HASH_FOR_EACH (format_iter, formats) {
+	char *key = spec_key (format_iter->value);
+	uintptr_t users = (uintptr_t) kvhash_lookup (spec_users, key);
+
+	if (users)
+	    kvhash_delete (spec_users, key);
+	kvhash_insert (spec_users, key, (void *) (users + 1));
+	free (key);
+    }
+}
+
+static void spec_users_free (void)
+{
+    hash_free (spec_users);
+    spec_users = NULL;
+}
+
+/* Hand one registration string to the kernel.  binfmt_misc takes exactly
+ * one registration per write, so each gets its own write call, but the
+ * register file is only opened once.
+ */
+static int register_entry (const char *regstring)
+{
+    size_t len = strlen (regstring);
+
+    if (register_fd < 0) {
+	register_fd = open (path_register, O_WRONLY | O_TRUNC | O_CLOEXEC);
+	if (register_fd < 0) {
+	    warning_err ("unable to open %s for writing", path_register);
+	    return 0;
+	}
+    }
+    if (write (register_fd, regstring, len) != (ssize_t) len) {
+	warning_err ("unable to write to %s", path_register);
+	return 0;
+    }
+    return 1;
+}
+
+static int register_close (void)
+{
+    int fd = register_fd;
+
+    if (fd < 0)
+	return 1;
+    register_fd = -1;
+    if (close (fd)) {
+	warning_err ("unable to close %s", path_register);
+	return 0;
+    }
+    return 1;
+}
+
+/* Return the interpreter that the kernel should run for binfmt, the format
+ * called name.  If force_detector is set, this is run-detectors even if
+ * the format alone would not need it.
+ */
+static const char *format_interpreter (const struct binfmt *binfmt,
+				       const char *name, int force_detector)
+{
+    int need_detector;
+
+    need_detector = force_detector ||
+		    (binfmt->detector && *binfmt->detector) ||
+		    (binfmt->rule && *binfmt->rule);
+    if (!need_detector && spec_users) {
+	char *key = spec_key (binfmt);
+
+	need_detector = (uintptr_t) kvhash_lookup (spec_users, key) > 1;
+	free (key);
+    } else if (!need_detector) {
+	struct kvelem *format_iter;
+
+	/* Scan the format database to see if anything else uses the same
+	 * spec as us. If so, assume that we need a detector, effectively
+	 * /bin/true. Don't actually set binfmt->detector though, since
+	 * run-detectors optimizes the case of empty detectors and "runs"
+	 * them last.
+	 */
+	load_all_formats (1);
+
+	HASH_FOR_EACH (format_iter, formats) {
+	    if (!strcmp (format_iter->key, name))
+		continue;
+	    if (binfmt_equals (binfmt, format_iter->value)) {
+		need_detector = 1;
+		break;
+	    }
+	}
+    }
+    /* Fake the interpreter if we need a userspace detector program. */
+    return need_detector ? run_detectors : binfmt->interpreter;
+}
+
+/* Build the string that registers binfmt, the format called name, with
+ * the kernel as an entry called entry (normally the same as name); see
+ * format_interpreter.
+ */
+static char *format_regstring (const struct binfmt *binfmt, const char *name,
+			       const char *entry, int force_detector)
+{
+    char type;
+    const char *interpreter;
+
+    type = (!strcmp (binfmt->type, "magic")) ? 'M' : 'E';
+    interpreter = format_interpreter (binfmt, name, force_detector);
+
+    return xasprintf (":%s:%c:%s:%s:%s:%s:%s%s%s%s\n",
+		      entry, type, binfmt->offset, binfmt->magic,
+		      binfmt->mask, interpreter,
+		      flag_set (binfmt->credentials) ? "C" : "",
+		      flag_set (binfmt->preserve) ? "P" : "",
+		      flag_set (binfmt->open_binary) ? "O" : "",
+		      flag_set (binfmt->fix_binary) ? "F" : "");
+}
+
+/* Register a single binary format with the kernel; see format_regstring. */
+static int enable_format (const char *name, const char *entry,
+			  int force_detector)
+{
+    char *regstring;
+
+    load_format (name, 0);
+    if (!test && !kvhash_exists (formats, name)) {
+	warning ("%s not in database of installed binary formats.", name);
+	return 0;
+    }
+    regstring = format_regstring (kvhash_lookup (formats, name), name, entry,
+				  force_detector);
+    if (test)
+	printf ("enable %s with the following format string:\n %s",
+		entry, regstring);
+    else if (!register_entry (regstring)) {
+	free (regstring);
+	return 0;
+    }
+    free (regstring);
+    return 1;
+}
+
+/* Remove the kernel entry called entry. */
+static int disable_entry (const char *entry)
+{
+    char *procdir_name;
+    FILE *procentry_file;
+
+    if (test) {
+	printf ("disable %s\n", entry);
+	return 1;
+    }
+
+    procdir_name = xasprintf ("%s/%s", procdir, entry);
+    procentry_file = fopen (procdir_name, "w");
+    if (!procentry_file) {
+	warning_err ("unable to open %s for writing", procdir_name);
+	free (procdir_name);
+	return 0;
+    }
+    fputs ("-1", procentry_file);
+    if (fclose (procentry_file)) {
+	warning_err ("unable to close %s", procdir_name);
+	free (procdir_name);
+	return 0;
+    }
+    if (exists (procdir_name)) {
+	warning ("removal of %s ignored by kernel!", procdir_name);
+	free (procdir_name);
+	return 0;
+    }
+    free (procdir_name);
+    return 1;
+}
+
+static long format_priority (const char *name)
+{
+    const struct binfmt *binfmt;
+
+    load_format (name, 1);
+    binfmt = kvhash_lookup (formats, name);
+    if (!binfmt || !binfmt->priority)
+	return 0;
+    return strtol (binfmt->priority, NULL, 10);
+}
+
+/* Map the names of the formats in list, from load_formats, to the formats. */
+static Hash_table *format_list_index (gl_list_t list)
+{
+    Hash_table *index = kvhash_initialize (gl_list_size (list), NULL, free);
+    gl_list_iterator_t list_iter;
+    struct binfmt *binfmt;
+
+    list_iter = gl_list_iterator (list);
+    while (gl_list_iterator_next (&list_iter, (const void **) &binfmt, NULL))
+	kvhash_insert (index, binfmt->name, binfmt);
+    gl_list_iterator_free (&list_iter);
+    return index;
+}
+
+struct rank {
+    const char *name;
+    long priority;
+    uint64_t uses;
+};
+
+static int compare_rank (const void *left, const void *right)
+{
+    const struct rank *l = left, *r = right;
+
+    if (l->priority != r->priority)
+	return (l->priority < r->priority) ? -1 : 1;
+    if (l->uses != r->uses)
+	return (l->uses < r->uses) ? -1 : 1;
+    return strcmp (l->name, r->name);
+}
+
+/* Return non-zero if the kernel entry for the format called names[i] could
+ * match a file that one of the others also could.  expanded is from
+ * format_list_index.
+ */
+static bool entry_overlaps (const char **names, size_t n, size_t i,
+			    Hash_table *expanded)
+{
+    const struct binfmt *binfmt = kvhash_lookup (expanded, names[i]);
+    size_t j;
+
+    if (!binfmt)
+	return true;
+    for (j = 0; j < n; ++j) {
+	const struct binfmt *other;
+
+	if (j == i)
+	    continue;
+	other = kvhash_lookup (expanded, names[j]);
+	if (!other || binfmt_overlaps (binfmt, other))
+	    return true;
+    }
+    return false;
+}
+
+/* Sort names into registration order.  The kernel tries the most recently
+ * registered entry first, so the formats most likely to be wanted go last:
+ * those with the highest priority, and then those that run-detectors has
+ * chosen most often.  Formats consolidated into an entry according to map
+ * count towards it.
+ *
+ * Where two entries could match the same file, registration order decides
+ * which of them the kernel uses.  Any user can add to the usage counts, so
+ * they are only applied to entries that overlap none of the others; that
+ * way they can make the kernel find a format sooner, but never change
+ * which format it finds.
+ */
+static void order_formats (const char **names, size_t n, Hash_table *map)
+{
+    struct profile *profile = profile_load ();
+    struct rank *ranks = XNMALLOC (n, struct rank);
+    gl_list_t all_formats;
+    gl_list_iterator_t format_iter;
+    struct binfmt *binfmt;
+    Hash_table *expanded;
+    struct kvelem *elem;
+    size_t i;
+
+    all_formats = load_formats (0, 1);
+    expanded = format_list_index (all_formats);
+    for (i = 0; i < n; ++i) {
+	ranks[i].name = names[i];
+	ranks[i].priority = format_priority (names[i]);
+	ranks[i].uses = profile_lookup (profile, names[i]);
+    }
+    HASH_FOR_EACH (elem, map) {
+	for (i = 0; i < n; ++i) {
+	    long priority;
+
+	    if (strcmp (elem->value, names[i]))
+		continue;
+	    priority = format_priority (elem->key);
+	    if (priority > ranks[i].priority)
+		ranks[i].priority = priority;
+	    ranks[i].uses += profile_lookup (profile, elem->key);
+	    break;
+	}
+    }
+    for (i = 0; i < n; ++i)
+	if (ranks[i].uses && entry_overlaps (names, n, i, expanded))
+	    ranks[i].uses = 0;
+    qsort (ranks, n, sizeof *ranks, compare_rank);
+    for (i = 0; i < n; ++i)
+	names[i] = ranks[i].name;
+
+    free (ranks);
+    hash_free (expanded);
+    format_iter = gl_list_iterator (all_formats);
+    while (gl_list_iterator_next (&format_iter, (const void **) &binfmt,
+				  NULL))
+	binfmt_free (binfmt);
+    gl_list_iterator_free (&format_iter);
+    gl_list_free (all_formats);
+    profile_free (profile);
+}
+
+static bool has_members (Hash_table *map, const char *name)
+{
+    struct kvelem *elem;
+
+    HASH_FOR_EACH (elem, map)
+	if (!strcmp (elem->value, name))
+	    return true;
+    return false;
+}
+
+/* The number of bits of the file that a format's kernel entry tests, or
+ * SIZE_MAX for extension formats, which can only share with formats using
+ * the same extension.
+ */
+static size_t spec_bits (const struct binfmt *binfmt)
+{
+    size_t bits = 0, i;
+
+    if (strcmp (binfmt->type, "magic"))
+	return SIZE_MAX;
+    for (i = 0; i < binfmt->magic_size; ++i) {
+	unsigned char mask = *binfmt->mask ? binfmt->mask[i] : 0xff;
+
+	for (; mask; mask &= mask - 1)
+	    ++bits;
+    }
+    return bits;
+}
+
+static int compare_spec_bits (const void *left, const void *right)
+{
+    const struct binfmt *l = *(const struct binfmt **) left;
+    const struct binfmt *r = *(const struct binfmt **) right;
+    size_t lbits = spec_bits (l), rbits = spec_bits (r);
+
+    if (lbits != rbits)
+	return (lbits < rbits) ? -1 : 1;
+    return strcmp (l->name, r->name);
+}
+
+static bool same_flags (const struct binfmt *left, const struct binfmt *right)
+{
+    return flag_set (left->credentials) == flag_set (right->credentials) &&
+	   flag_set (left->preserve) == flag_set (right->preserve) &&
+	   flag_set (left->open_binary) == flag_set (right->open_binary) &&
+	   flag_set (left->fix_binary) == flag_set (right->fix_binary);
+}
+
+/* Enable all disabled formats, giving each format whose spec is covered by
+ * another's no kernel entry of its own.  Formats are considered from the
+ * most general spec to the most specific, so that each one is served by
+ * the first entry that covers it.
+ */
+static int enable_consolidated (void)
+{
+    gl_list_t all_formats;
+    gl_list_iterator_t format_iter;
+    struct binfmt *binfmt;
+    struct binfmt **candidates, **owners;
+    const char **names;
+    size_t n_candidates = 0, n_owners = 0, i, j;
+    Hash_table *entries, *map;
+    int worked = 1;
+
+    all_formats = load_formats (0, 1);
+    candidates = XNMALLOC (gl_list_size (all_formats), struct binfmt *);
+    owners = XNMALLOC (gl_list_size (all_formats), struct binfmt *);
+    entries = kernel_entries_load ();
+    map = consolidated_load ();
+    format_iter = gl_list_iterator (all_formats);
+    while (gl_list_iterator_next (&format_iter, (const void **) &binfmt,
+				  NULL))
+	if (!format_enabled_in (binfmt->name, entries, map))
+	    candidates[n_candidates++] = binfmt;
+    gl_list_iterator_free (&format_iter);
+    hash_free (entries);
+    qsort (candidates, n_candidates, sizeof *candidates, compare_spec_bits);
+
+    for (i = 0; i < n_candidates; ++i) {
+	for (j = 0; j < n_owners; ++j) {
+	    if (same_flags (owners[j], candidates[i]) &&
+		binfmt_covers (owners[j], candidates[i]))
+		break;
+	}
+	if (j < n_owners) {
+	    if (test)
+		printf ("consolidate %s into %s\n",
+			candidates[i]->name, owners[j]->name);
+	    kvhash_insert (map, candidates[i]->name, xstrdup (owners[j]->name));
+	} else
+	    owners[n_owners++] = candidates[i];
+    }
+
+    names = XNMALLOC (n_owners, const char *);
+    for (i = 0; i < n_owners; ++i)
+	names[i] = owners[i]->name;
+    order_formats (names, n_owners, map);
+    spec_users_init ();
+    for (i = 0; i < n_owners; ++i) {
+	if (!enable_format (names[i], names[i], has_members (map, names[i]))) {
+	    worked = 0;
+	    /* Members of a failed entry stay disabled. */
+	    for (j = 0; j < n_candidates; ++j) {
+		const char *owner = kvhash_lookup (map, candidates[j]->name);
+		if (owner && !strcmp (owner, names[i]))
+		    free (kvhash_delete (map, candidates[j]->name));
+	    }
+	}
+    }
+    spec_users_free ();
+    free (names);
+    printf ("kernel entries: %zu without consolidation, %zu with\n",
+	    n_candidates, n_owners);
+    if (!test && !consolidated_save (map))
+	worked = 0;
+
+    hash_free (map);
+    free (owners);
+    free (candidates);
+    format_iter = gl_list_iterator (all_formats);
+    while (gl_list_iterator_next (&format_iter, (const void **) &binfmt,
+				  NULL))
+	binfmt_free (binfmt);
+    gl_list_iterator_free (&format_iter);
+    gl_list_free (all_formats);
+    return worked;
+}
+
+/* Work out everything that enabling all formats would register, in order,
+ * so that --from-plan has nothing left to do at boot but write it out.
+ * Nothing is enabled yet at boot, so no format is skipped, and the
+ * consolidated map is empty.
+ */
+static char *boot_plan (void)
+{
+    struct kvelem *format_iter;
+    const char **names;
+    char **regstrings;
+    size_t n = 0, len = 0, i;
+    Hash_table *map;
+    char *plan, *p;
+
+    /* The action may have left formats out of date. */
+    hash_clear (formats);
+    spec_users_init ();
+    names = XNMALLOC (hash_get_n_entries (formats), const char *);
+    HASH_FOR_EACH (format_iter, formats)
+	names[n++] = format_iter->key;
+    map = kvhash_initialize (1, NULL, kvhash_free_pair);
+    order_formats (names, n, map);
+    hash_free (map);
+
+    regstrings = XNMALLOC (n, char *);
+    for (i = 0; i < n; ++i) {
+	regstrings[i] = format_regstring (kvhash_lookup (formats, names[i]),
+					  names[i], names[i], 0);
+	len += strlen (regstrings[i]);
+    }
+    plan = p = xmalloc (len + 1);
+    for (i = 0; i < n; ++i) {
+	p = stpcpy (p, regstrings[i]);
+	free (regstrings[i]);
+    }
+    *p = '\0';
+
+    free (regstrings);
+    free (names);
+    spec_users_free ();
+    return plan;
+}
+
+/* Record that the format called name, or every format if name is NULL,
+ * should end the batch with the kernel state want.
+ */
+static int batch_want (const char *name, void *want)
+{
+    struct kvelem *format_iter;
+
+    if (name) {
+	kvhash_delete (batch_kernel, name);
+	kvhash_insert (batch_kernel, name, want);
+	return 1;
+    }
+    load_all_formats (0);
+    HASH_FOR_EACH (format_iter, formats)
+	batch_want (format_iter->key, want);
+    return 1;
+}
+
+/* Enable all binary formats by writing out plan, as kept in the index. */
+static int enable_from_plan (char *plan)
+{
+    Hash_table *entries = kernel_entries_load ();
+    const char *line, *end;
+    int worked = 1;
+
+    for (line = plan; (end = strchr (line, '\n')) != NULL; line = end + 1) {
+	const char *entry_end;
+	char *entry, *regstring;
+
+	if (*line != ':')
+	    continue;
+	entry_end = memchr (line + 1, ':', end - line - 1);
+	if (!entry_end)
+	    continue;
+	entry = xstrndup (line + 1, entry_end - line - 1);
+	regstring = xstrndup (line, end - line + 1);
+	if (kvhash_exists (entries, entry))
+	    warning ("%s already enabled in kernel.", entry);
+	else if (test)
+	    printf ("enable %s with the following format string:\n %s",
+		    entry, regstring);
+	else
+	    worked &= register_entry (regstring);
+	free (regstring);
+	free (entry);
+    }
+    hash_free (entries);
+    free (plan);
+    return worked;
+}
+
 /* Enable a binary format in the kernel. */
 static int act_enable (const char *name)
 {
-    char *procdir_name;
+    char *plan;
 
+    if (batch_kernel)
+	return batch_want (name, BATCH_ENABLE);
     if (!load_binfmt_misc ())
 	return 1;
 
     if (name) {
-	const struct binfmt *binfmt;
-	char type;
-	int need_detector;
-	const char *interpreter;
-	const char *credentials;
-	const char *preserve;
-	char *regstring;
-
-	procdir_name = xasprintf ("%s/%s", procdir, name);
-	if (exists (procdir_name)) {
+	if (format_enabled (name)) {
 	    /* This can happen in chroots, since /proc/sys/fs/binfmt_misc is
 	     * shared between all chroots.  The real fix for this is to give
 	     * the binfmt_misc filesystem per-chroot (or per-mount) state,
@@ -375,89 +1002,113 @@ static int act_enable (const char *name)
 	     * gracefully bail out if the format is already enabled.
 	     */
 	    warning ("%s already enabled in kernel.", name);
-	    free (procdir_name);
 	    return 1;
 	}
-	free (procdir_name);
+	return enable_format (name, name, 0);
+    } else if (consolidate)
+	return enable_consolidated ();
+    else if (from_plan && (plan = index_load_plan ()) != NULL)
+	return enable_from_plan (plan);
+    else {
+	int worked = 1;
+	struct kvelem *format_iter;
+	const char **names;
+	size_t n = 0, i;
+	Hash_table *entries, *map;
 
-	load_format (name, 0);
-	if (!test && !kvhash_exists (formats, name)) {
-	    warning ("%s not in database of installed binary formats.", name);
-	    return 0;
+	/* The index needs rewriting if it had no usable plan. */
+	from_plan = 0;
+
+	/* Everything is read once up front, since there may be many
+	 * formats to enable.
+	 */
+	load_all_formats (0);
+	entries = kernel_entries_load ();
+	map = consolidated_load ();
+	names = XNMALLOC (hash_get_n_entries (formats), const char *);
+	HASH_FOR_EACH (format_iter, formats) {
+	    if (!format_enabled_in (format_iter->key, entries, map))
+		names[n++] = format_iter->key;
 	}
-	binfmt = kvhash_lookup (formats, name);
-	type = (!strcmp (binfmt->type, "magic")) ? 'M' : 'E';
+	order_formats (names, n, map);
+	hash_free (map);
+	hash_free (entries);
+	spec_users_init ();
+	for (i = 0; i < n; ++i)
+	    worked &= enable_format (names[i], names[i], 0);
+	spec_users_free ();
+	free (names);
+	return worked;
+    }
+}
 
-	need_detector = binfmt->detector && *binfmt->detector;
-	if (!need_detector) {
-	    struct kvelem *format_iter;
+/* Drop a format served by another format's kernel entry from the map. */
+static int disable_consolidated (const char *name)
+{
+    Hash_table *map = consolidated_load ();
+    const char *owner = kvhash_lookup (map, name);
+    int worked = 1;
 
-	    /* Scan the format database to see if anything else uses the
-	     * same spec as us. If so, assume that we need a detector,
-	     * effectively /bin/true. Don't actually set binfmt->detector
-	     * though, since run-detectors optimizes the case of empty
-	     * detectors and "runs" them last.
-	     */
-	    load_all_formats (1);
-
-	    HASH_FOR_EACH (format_iter, formats) {
-		if (!strcmp (format_iter->key, name))
-		    continue;
-		if (binfmt_equals (binfmt, format_iter->value)) {
-		    need_detector = 1;
-		    break;
-		}
-	    }
-	}
-	/* Fake the interpreter if we need a userspace detector program. */
-	interpreter = need_detector ? run_detectors : binfmt->interpreter;
-
-	credentials =
-		(binfmt->credentials && !strcmp (binfmt->credentials, "yes"))
-		? "C" : "";
-	preserve = (binfmt->preserve && !strcmp (binfmt->preserve, "yes"))
-		? "P" : "";
-	regstring = xasprintf (":%s:%c:%s:%s:%s:%s:%s%s\n",
-			       name, type, binfmt->offset, binfmt->magic,
-			       binfmt->mask, interpreter,
-			       credentials, preserve);
+    if (owner) {
 	if (test)
-	    printf ("enable %s with the following format string:\n %s",
-		    name, regstring);
+	    printf ("disable %s (consolidated into %s)\n", name, owner);
 	else {
-	    FILE *register_file;
-
-	    register_file = fopen (path_register, "w");
-	    if (!register_file) {
-		warning_err ("unable to open %s for writing",
-			     path_register);
-		return 0;
-	    }
-	    fputs (regstring, register_file);
-	    if (fclose (register_file)) {
-		warning_err ("unable to close %s", path_register);
-		return 0;
-	    }
+	    free (kvhash_delete (map, name));
+	    worked = consolidated_save (map);
 	}
+    }
+    hash_free (map);
+    return worked;
+}
+
+/* The kernel entry for name has gone; give each format it served an entry
+ * of its own.
+ */
+static int split_consolidated (const char *name)
+{
+    Hash_table *map = consolidated_load ();
+    gl_list_t members;
+    gl_list_iterator_t member_iter;
+    struct kvelem *elem;
+    const char *member;
+    int worked = 1;
+
+    members = gl_list_create_empty (GL_ARRAY_LIST, NULL, NULL, NULL, true);
+    HASH_FOR_EACH (elem, map)
+	if (!strcmp (elem->value, name))
+	    gl_list_add_last (members, xstrdup (elem->key));
+    if (!gl_list_size (members)) {
+	gl_list_free (members);
+	hash_free (map);
 	return 1;
-    } else {
-	int worked = 1;
-	struct kvelem *format_iter;
+    }
 
-	load_all_formats (0);
-	HASH_FOR_EACH (format_iter, formats) {
-	    procdir_name = xasprintf ("%s/%s", procdir, format_iter->key);
-	    if (!exists (procdir_name))
-		worked &= act_enable (format_iter->key);
-	    free (procdir_name);
-	}
-	return worked;
+    if (!test) {
+	member_iter = gl_list_iterator (members);
+	while (gl_list_iterator_next (&member_iter, (const void **) &member,
+				      NULL))
+	    free (kvhash_delete (map, member));
+	gl_list_iterator_free (&member_iter);
+	worked = consolidated_save (map);
+    }
+    member_iter = gl_list_iterator (members);
+    while (gl_list_iterator_next (&member_iter, (const void **) &member,
+				  NULL)) {
+	worked &= enable_format (member, member, 0);
+	free ((char *) member);
     }
+    gl_list_iterator_free (&member_iter);
+
+    gl_list_free (members);
+    hash_free (map);
+    return worked;
 }
 
 /* Disable a binary format in the kernel. */
 static int act_disable (const char *name)
 {
+    if (batch_kernel)
+	return batch_want (name, BATCH_DISABLE);
     if (!is_directory (procdir))
 	return 1; /* We're disabling anyway, so we don't mind */
     if (name) {
@@ -471,9 +1122,11 @@ static int act_disable (const char *name)
 	     * that the disable operation succeeded.
 	     */
 	    free (procdir_name);
-	    return 1;
+	    return disable_consolidated (name);
 	}
 
+	free (procdir_name);
+
 	/* We used to check the entry in procdir to make sure we were
 	 * removing an entry with the same interpreter, but this is bad; it
 	 * makes things really difficult for packages that want to change
@@ -484,34 +1137,20 @@ static int act_disable (const char *name)
 	 * In other words, admindir becomes the canonical reference, not
 	 * procdir.  This is in line with similar update-* tools in Debian.
 	 */
-
-	if (test)
-	    printf ("disable %s\n", name);
-	else {
-	    FILE *procentry_file;
-
-	    procentry_file = fopen (procdir_name, "w");
-	    if (!procentry_file) {
-		warning_err ("unable to open %s for writing", procdir_name);
-		free (procdir_name);
-		return 0;
-	    }
-	    fputs ("-1", procentry_file);
-	    if (fclose (procentry_file)) {
-		warning_err ("unable to close %s", procdir_name);
-		free (procdir_name);
-		return 0;
-	    }
-	    if (exists (procdir_name)) {
-		warning ("removal of %s ignored by kernel!", procdir_name);
-		return 0;
-	    }
-	}
-	return 1;
+	if (!disable_entry (name))
+	    return 0;
+	return split_consolidated (name);
     } else {
 	int worked = 1;
 	struct kvelem *format_iter;
+	Hash_table *map;
 
+	/* Every entry is going, so nothing is served by another. */
+	if (!test) {
+	    map = kvhash_initialize (1, NULL, kvhash_free_pair);
+	    worked &= consolidated_save (map);
+	    hash_free (map);
+	}
 	load_all_formats (0);
 	HASH_FOR_EACH (format_iter, formats) {
 	    char *procdir_id = xasprintf ("%s/%s", procdir, format_iter->key);
@@ -519,14 +1158,313 @@ static int act_disable (const char *name)
 		worked &= act_disable (format_iter->key);
 	    free (procdir_id);
 	}
-	unload_binfmt_misc (); /* ignore errors here */
+	unload_binfmt_misc (); /* ignore errors here */
+	return worked;
+    }
+}
+
+/* Re-register every enabled format in the order chosen by
+ * order_formats.  Each format is first given a twin entry, which serves it
+ * while its own entry is replaced, so the kernel always has an entry for
+ * it.
+ */
+static int act_reorder (void)
+{
+    struct kvelem *format_iter;
+    const char **names;
+    char **twins;
+    bool *replaced, *shared;
+    size_t n = 0, i;
+    Hash_table *entries, *map;
+    int worked = 1;
+
+    if (!load_binfmt_misc ())
+	return 0;
+
+    load_all_formats (0);
+    entries = kernel_entries_load ();
+    names = XNMALLOC (hash_get_n_entries (formats), const char *);
+    HASH_FOR_EACH (format_iter, formats) {
+	if (kvhash_exists (entries, format_iter->key))
+	    names[n++] = format_iter->key;
+    }
+    hash_free (entries);
+    map = consolidated_load ();
+    order_formats (names, n, map);
+    twins = XNMALLOC (n, char *);
+    replaced = XCALLOC (n, bool);
+    shared = XNMALLOC (n, bool);
+    for (i = 0; i < n; ++i) {
+	twins[i] = xasprintf ("%s%s", REORDER_PREFIX, names[i]);
+	shared[i] = has_members (map, names[i]);
+    }
+    hash_free (map);
+
+    spec_users_init ();
+    for (i = 0; i < n; ++i) {
+	if (!enable_format (names[i], twins[i], shared[i])) {
+	    warning ("unable to reorder binary formats");
+	    while (i-- > 0)
+		disable_entry (twins[i]);
+	    worked = 0;
+	    goto out;
+	}
+    }
+    for (i = 0; i < n; ++i) {
+	/* If this fails, the twin stays in place of the format's entry. */
+	if (disable_entry (names[i]) &&
+	    enable_format (names[i], names[i], shared[i]))
+	    replaced[i] = true;
+	else
+	    worked = 0;
+    }
+    for (i = 0; i < n; ++i)
+	if (replaced[i])
+	    worked &= disable_entry (twins[i]);
+
+out:
+    spec_users_free ();
+    for (i = 0; i < n; ++i)
+	free (twins[i]);
+    free (shared);
+    free (replaced);
+    free (twins);
+    free (names);
+    return worked;
+}
+
+/* Replace the kernel's entry for the format called name, keeping a twin
+ * registered in the meantime so that the format is never missing.
+ */
+static int replace_format (const char *name, int force_detector)
+{
+    char *twin = xasprintf ("%s%s", REORDER_PREFIX, name);
+    int worked = 0;
+
+    /* If this fails part way, the twin stays in place of the format's
+     * entry.
+     */
+    if (enable_format (name, twin, force_detector) &&
+	disable_entry (name) && enable_format (name, name, force_detector))
+	worked = disable_entry (twin);
+    free (twin);
+    return worked;
+}
+
+static void format_list_free (gl_list_t list)
+{
+    gl_list_iterator_t list_iter;
+    struct binfmt *binfmt;
+
+    list_iter = gl_list_iterator (list);
+    while (gl_list_iterator_next (&list_iter, (const void **) &binfmt, NULL))
+	binfmt_free (binfmt);
+    gl_list_iterator_free (&list_iter);
+    gl_list_free (list);
+}
+
+/* Bring the kernel's entry for the format called name into line with the
+ * database.  expanded maps names to formats with their magic and mask
+ * expanded, as the kernel shows them.
+ */
+static int reconcile_format (const char *name, Hash_table *entries,
+			     Hash_table *map, Hash_table *expanded)
+{
+    bool shared = has_members (map, name);
+    const struct binfmt *wanted = kvhash_lookup (expanded, name);
+    struct binfmt *current;
+    int same;
+
+    if (!kvhash_exists (entries, name))
+	return enable_format (name, name, shared);
+    current = binfmt_load_kernel (name);
+    same = current && wanted &&
+	   binfmt_kernel_matches (current, wanted,
+				  format_interpreter
+				    (kvhash_lookup (formats, name),
+				     name, shared));
+    if (current)
+	binfmt_free (current);
+    return same ? 1 : replace_format (name, shared);
+}
+
+/* Bring the kernel's entries into line with the database, touching only
+ * those that differ, so that unchanged formats stay registered throughout.
+ * Kernel entries that do not belong to any installed format are left
+ * alone.
+ */
+static int act_reconcile (void)
+{
+    struct kvelem *format_iter, *entry_iter, *map_iter;
+    gl_list_t all_formats;
+    gl_list_iterator_t list_iter;
+    Hash_table *entries, *map, *expanded;
+    gl_list_t orphans;
+    const char **names;
+    const char *orphan;
+    size_t n = 0, i;
+    int worked = 1;
+
+    if (!load_binfmt_misc ())
+	return 0;
+
+    load_all_formats (0);
+    entries = kernel_entries_load ();
+    map = consolidated_load ();
+
+    /* A format whose covering format has gone needs its own entry again. */
+    orphans = gl_list_create_empty (GL_ARRAY_LIST, NULL, NULL, NULL, true);
+    HASH_FOR_EACH (map_iter, map) {
+	if (!kvhash_exists (formats, map_iter->value))
+	    gl_list_add_last (orphans, map_iter->key);
+    }
+    list_iter = gl_list_iterator (orphans);
+    while (gl_list_iterator_next (&list_iter, (const void **) &orphan, NULL))
+	free (kvhash_delete (map, orphan));
+    gl_list_iterator_free (&list_iter);
+    if (gl_list_size (orphans) && !test)
+	worked &= consolidated_save (map);
+    gl_list_free (orphans);
+
+    /* Formats served by a consolidated entry should have none of their
+     * own, and neither should twins left behind by an interrupted
+     * --reorder.
+     */
+    HASH_FOR_EACH (entry_iter, entries) {
+	const char *entry = entry_iter->key;
+	const char *base = entry;
+
+	if (!strncmp (entry, REORDER_PREFIX, strlen (REORDER_PREFIX)))
+	    base += strlen (REORDER_PREFIX);
+	if (!kvhash_exists (formats, base))
+	    continue;
+	if (base != entry || kvhash_exists (map, entry))
+	    worked &= disable_entry (entry);
+    }
+
+    names = XNMALLOC (hash_get_n_entries (formats), const char *);
+    HASH_FOR_EACH (format_iter, formats) {
+	if (!kvhash_exists (map, format_iter->key))
+	    names[n++] = format_iter->key;
+    }
+    order_formats (names, n, map);
+
+    all_formats = load_formats (0, 1);
+    expanded = format_list_index (all_formats);
+    spec_users_init ();
+    for (i = 0; i < n; ++i)
+	worked &= reconcile_format (names[i], entries, map, expanded);
+    spec_users_free ();
+    hash_free (expanded);
+    format_list_free (all_formats);
+    free (names);
+    hash_free (map);
+    hash_free (entries);
+    return worked;
+}
+
+/* Write binfmt to admindir as the format called name. */
+static int write_format (const char *name, const struct binfmt *binfmt)
+{
+    char *admindir_name = xasprintf ("%s/%s", admindir, name);
+    char *admindir_name_tmp = xasprintf ("%s.tmp", admindir_name);
+    int worked = 0;
+
+    if (!binfmt_write (binfmt, admindir_name_tmp))
+	goto out;
+    if (!rename_mv (admindir_name_tmp, admindir_name)) {
+	warning_err ("unable to install %s as %s",
+		     admindir_name_tmp, admindir_name);
+	goto out;
+    }
+    worked = 1;
+
+out:
+    free (admindir_name_tmp);
+    free (admindir_name);
+    return worked;
+}
+
+/* Apply the changes recorded while running a batch: write or remove the
+ * administrative files that changed, and then change only those kernel
+ * entries that need it.
+ */
+static int batch_commit (void)
+{
+    Hash_table *admin = batch_admin, *kernel = batch_kernel;
+    struct kvelem *elem;
+    const char **names;
+    size_t n = 0, i;
+    Hash_table *entries, *map, *expanded;
+    gl_list_t all_formats;
+    int worked = 1;
+
+    batch_admin = batch_kernel = NULL;
+
+    HASH_FOR_EACH (elem, admin) {
+	const struct binfmt *binfmt = kvhash_lookup (formats, elem->key);
+
+	if (test)
+	    continue;
+	if (binfmt)
+	    worked &= write_format (elem->key, binfmt);
+	else {
+	    char *admindir_name = xasprintf ("%s/%s", admindir, elem->key);
+
+	    if (unlink (admindir_name) == -1 && errno != ENOENT) {
+		warning_err ("unable to remove %s", admindir_name);
+		worked = 0;
+	    }
+	    free (admindir_name);
+	}
+    }
+    hash_free (admin);
+    if (!worked || !hash_get_n_entries (kernel)) {
+	hash_free (kernel);
 	return worked;
     }
+
+    if (!load_binfmt_misc ()) {
+	hash_free (kernel);
+	return 0;
+    }
+    names = XNMALLOC (hash_get_n_entries (kernel), const char *);
+    HASH_FOR_EACH (elem, kernel) {
+	if (elem->value == BATCH_DISABLE)
+	    worked &= act_disable (elem->key);
+	else
+	    names[n++] = elem->key;
+    }
+
+    entries = kernel_entries_load ();
+    map = consolidated_load ();
+    order_formats (names, n, map);
+    all_formats = load_formats (0, 1);
+    expanded = format_list_index (all_formats);
+    spec_users_init ();
+    for (i = 0; i < n; ++i) {
+	/* Some formats are served by another's entry. */
+	if (!kvhash_exists (entries, names[i]) &&
+	    format_enabled_in (names[i], entries, map))
+	    continue;
+	worked &= reconcile_format (names[i], entries, map, expanded);
+    }
+    spec_users_free ();
+
+    hash_free (expanded);
+    format_list_free (all_formats);
+    hash_free (map);
+    hash_free (entries);
+    free (names);
+    hash_free (kernel);
+    return worked;
 }
 
 static int act_install (const char *name, const struct binfmt *binfmt)
 {
     char *admindir_name, *procdir_name;
+    struct binfmt *old_binfmt;
+    bool known;
 
     load_format (name, 1);
     if (kvhash_exists (formats, name)) {
@@ -554,7 +1492,9 @@ static int act_install (const char *name, const struct binfmt *binfmt)
      * corrupt.
      */
     admindir_name = xasprintf ("%s/%s", admindir, name);
-    if (is_file (admindir_name)) {
+    known = batch_admin ? kvhash_exists (formats, name) :
+			  is_file (admindir_name);
+    if (known) {
 	if (!act_disable (name)) {
 	    warning ("unable to disable binary format %s", name);
 	    free (admindir_name);
@@ -562,7 +1502,8 @@ static int act_install (const char *name, const struct binfmt *binfmt)
 	}
     }
     procdir_name = xasprintf ("%s/%s", procdir, name);
-    if (exists (procdir_name) && !test) {
+    /* In a batch, the old entry is only disabled at the end. */
+    if (exists (procdir_name) && !test && !(batch_admin && known)) {
 	/* This is a bit tricky.  If we get here, then the kernel knows
 	 * about a format we don't.  Either somebody has used binfmt_misc
 	 * directly, or update-binfmts did something wrong.  For now we do
@@ -583,26 +1524,19 @@ static int act_install (const char *name, const struct binfmt *binfmt)
     }
     free (procdir_name);
 
+    free (admindir_name);
     if (test) {
 	printf ("install the following binary format description:\n");
 	binfmt_print (binfmt);
-    } else {
-	char *admindir_name_tmp = xasprintf ("%s.tmp", admindir_name);
-	if (!binfmt_write (binfmt, admindir_name_tmp)) {
-	    free (admindir_name_tmp);
-	    free (admindir_name);
-	    return 0;
-	}
-	if (!rename_mv (admindir_name_tmp, admindir_name)) {
-	    warning_err ("unable to install %s as %s",
-			 admindir_name_tmp, admindir_name);
-	    free (admindir_name_tmp);
-	    free (admindir_name);
-	    return 0;
-	}
-	free (admindir_name_tmp);
     }
-    free (admindir_name);
+    if (batch_admin)
+	kvhash_insert (batch_admin, name, NULL);
+    else if (!test && !write_format (name, binfmt))
+	return 0;
+    /* Replace any old version, which kvhash_insert would keep. */
+    old_binfmt = kvhash_delete (formats, name);
+    if (old_binfmt)
+	binfmt_free (old_binfmt);
     kvhash_insert (formats, name, binfmt);
     if (!act_enable (name)) {
 	warning ("unable to enable binary format %s", name);
@@ -617,9 +1551,15 @@ static int act_install (const char *name, const struct binfmt *binfmt)
 static int act_remove (const char *name, const char *package)
 {
     char *admindir_name;
+    bool known;
 
     admindir_name = xasprintf ("%s/%s", admindir, name);
-    if (!is_file (admindir_name)) {
+    if (batch_admin) {
+	load_format (name, 1);
+	known = kvhash_exists (formats, name);
+    } else
+	known = is_file (admindir_name);
+    if (!known) {
 	/* There may be a --force option in the future to allow entries like
 	 * this to be removed; either they were created manually or
 	 * update-binfmts was broken.
@@ -651,7 +1591,13 @@ static int act_remove (const char *name, const char *package)
     }
     if (test)
 	printf ("remove %s", admindir_name);
-    else {
+    if (batch_admin) {
+	struct binfmt *old_binfmt = kvhash_delete (formats, name);
+
+	if (old_binfmt)
+	    binfmt_free (old_binfmt);
+	kvhash_insert (batch_admin, name, NULL);
+    } else if (!test) {
 	if (unlink (admindir_name) == -1) {
 	    warning_err ("unable to remove %s", admindir_name);
 	    free (admindir_name);
@@ -672,7 +1618,7 @@ static int act_import (const char *name)
 	const char *slash, *id;
 	char *path;
 	Hash_table *import;
-	const char *interpreter;
+	const char *interpreter, *rule, *priority, *message;
 
 	slash = strrchr (name, '/');
 	if (slash) {
@@ -683,7 +1629,7 @@ static int act_import (const char *name)
 	    path = xasprintf ("%s/%s", importdir, name);
 	}
 
-	if (!strcmp (id, ".") || !strcmp (id, "..") ||
+	if (id[0] == '.' ||
 	    !strcmp (id, "register") || !strcmp (id, "status")) {
 	    warning ("binary format name '%s' is reserved", id);
 	    free (path);
@@ -721,6 +1667,20 @@ static int act_import (const char *name)
 	    return 0;
 	}
 
+	rule = kvhash_lookup (import, "rule");
+	if (rule && !rule_valid (rule, &message)) {
+	    warning ("%s: invalid rule: %s", path, message);
+	    free (path);
+	    return 0;
+	}
+
+	priority = kvhash_lookup (import, "priority");
+	if (priority && !priority_valid (priority)) {
+	    warning ("%s: invalid priority: %s", path, priority);
+	    free (path);
+	    return 0;
+	}
+
 	interpreter = kvhash_lookup (import, "interpreter");
 	if (!interpreter || access (interpreter, X_OK))
 	    warning ("%s: no executable %s found, but continuing anyway as "
@@ -742,7 +1702,10 @@ static int act_import (const char *name)
 	worked = 1;
 	while ((entry = readdir (dir)) != NULL) {
 	    char *importdir_name;
-	    if (!strcmp (entry->d_name, ".") || !strcmp (entry->d_name, ".."))
+	    /* Names starting with "." are reserved, and are more likely to
+	     * be editor backups than formats.
+	     */
+	    if (entry->d_name[0] == '.')
 		continue;
 	    importdir_name = xasprintf ("%s/%s", importdir, entry->d_name);
 	    if (is_file (importdir_name))
@@ -757,11 +1720,9 @@ static int act_import (const char *name)
 static int act_display (const char *name)
 {
     if (name) {
-	char *procdir_name;
 	const struct binfmt *binfmt;
 	const char *package;
 
-	procdir_name = xasprintf ("%s/%s", procdir, name);
 	load_format (name, 0);
 	binfmt = kvhash_lookup (formats, name);
 	if (!binfmt) {
@@ -769,7 +1730,7 @@ static int act_display (const char *name)
 	    return 0;
 	}
 	printf ("%s (%s):\n",
-		name, exists (procdir_name) ? "enabled" : "disabled");
+		name, format_enabled (name) ? "enabled" : "disabled");
 	package = (!strcmp (binfmt->package, ":"))
 		  ? "<local>" : binfmt->package;
 	printf ("\
@@ -779,9 +1740,13 @@ static int act_display (const char *name)
        magic = %s\n\
         mask = %s\n\
  interpreter = %s\n\
-    detector = %s\n",
+    detector = %s\n\
+        rule = %s\n\
+  fix-binary = %s\n\
+    priority = %s\n",
 	    package, binfmt->type, binfmt->offset, binfmt->magic, binfmt->mask,
-	    binfmt->interpreter, binfmt->detector);
+	    binfmt->interpreter, binfmt->detector, binfmt->rule,
+	    binfmt->fix_binary, binfmt->priority);
     } else {
 	struct kvelem *format_iter;
 
@@ -798,7 +1763,7 @@ static int act_find (const char *executable)
     gl_list_iterator_t interpreter_iter;
     const struct binfmt *binfmt;
 
-    interpreters = find_interpreters (executable);
+    interpreters = find_interpreters (executable, -1, 0);
 
     interpreter_iter = gl_list_iterator (interpreters);
     while (gl_list_iterator_next (&interpreter_iter, (const void **) &binfmt,
@@ -811,6 +1776,471 @@ static int act_find (const char *executable)
     return 1;
 }
 
+/* Paths read by --find but not yet written out, for each worker.  Results
+ * are written in input order, so a slow file holds up at most this many
+ * others per worker.
+ */
+#define FIND_WINDOW_PER_JOB 64
+
+struct find_slot {
+    char *path;
+    gl_list_t interpreters;	/* NULL if path could not be opened */
+    int err;
+    bool done;
+};
+
+/* Paths flow from the main thread to the workers through a ring of slots.
+ * Slots from written up to claimed are being worked on, and those from
+ * claimed up to filled are waiting for a worker.
+ */
+struct find_pool {
+    struct finder *finder;
+    struct find_slot *slots;
+    size_t window;
+    size_t filled, claimed, written;
+    bool eof;
+    int ok;			/* no path has failed yet */
+    pthread_mutex_t lock;
+    pthread_cond_t work;	/* a path is waiting, or there are no more */
+    pthread_cond_t done;	/* a path has been classified */
+    pthread_t *workers;
+    long started;
+};
+
+static void *find_worker (void *data)
+{
+    struct find_pool *pool = data;
+
+    for (;;) {
+	struct find_slot *slot;
+	int fd;
+
+	pthread_mutex_lock (&pool->lock);
+	while (pool->claimed == pool->filled && !pool->eof)
+	    pthread_cond_wait (&pool->work, &pool->lock);
+	if (pool->claimed == pool->filled) {
+	    pthread_mutex_unlock (&pool->lock);
+	    return NULL;
+	}
+	slot = &pool->slots[pool->claimed++ % pool->window];
+	pthread_mutex_unlock (&pool->lock);
+
+	/* Each worker runs its detectors one at a time, so no more than
+	 * jobs detectors ever run at once.
+	 */
+	fd = open (slot->path, O_RDONLY | O_CLOEXEC);
+	if (fd >= 0) {
+	    slot->interpreters = finder_find (pool->finder, slot->path, fd, 0);
+	    close (fd);
+	} else
+	    slot->err = errno;
+
+	pthread_mutex_lock (&pool->lock);
+	slot->done = true;
+	pthread_cond_signal (&pool->done);
+	pthread_mutex_unlock (&pool->lock);
+    }
+}
+
+/* Write one result record: the path, then each interpreter preceded by a
+ * tab.
+ */
+static int find_write (struct find_slot *slot)
+{
+    char terminator = null_separated ? '\0' : '\n';
+    int ret = 1;
+
+    if (slot->interpreters) {
+	gl_list_iterator_t interpreter_iter;
+	const struct binfmt *binfmt;
+
+	fputs (slot->path, stdout);
+	interpreter_iter = gl_list_iterator (slot->interpreters);
+	while (gl_list_iterator_next (&interpreter_iter,
+				      (const void **) &binfmt, NULL))
+	    printf ("\t%s", binfmt->interpreter);
+	gl_list_iterator_free (&interpreter_iter);
+	gl_list_free (slot->interpreters);
+    } else {
+	errno = slot->err;
+	warning_err ("unable to open %s", slot->path);
+	fputs (slot->path, stdout);
+	ret = 0;
+    }
+    putchar (terminator);
+    free (slot->path);
+    memset (slot, 0, sizeof *slot);
+    return ret;
+}
+
+/* Write out finished results in order, waiting until at least one more
+ * has been written if wait is set.  Called with the pool locked.
+ */
+static int find_flush (struct find_pool *pool, bool wait)
+{
+    int ret = 1;
+
+    for (;;) {
+	struct find_slot *slot;
+
+	if (pool->written == pool->filled)
+	    break;
+	slot = &pool->slots[pool->written % pool->window];
+	if (!slot->done) {
+	    if (!wait)
+		break;
+	    pthread_cond_wait (&pool->done, &pool->lock);
+	    continue;
+	}
+	/* Workers never touch a finished slot, so it can be written
+	 * without holding the lock.
+	 */
+	pthread_mutex_unlock (&pool->lock);
+	if (!find_write (slot))
+	    ret = 0;
+	pthread_mutex_lock (&pool->lock);
+	++pool->written;
+	wait = false;
+    }
+    return ret;
+}
+
+/* Load the format database and start the worker threads. */
+static void find_pool_start (struct find_pool *pool)
+{
+    if (jobs <= 0) {
+	jobs = sysconf (_SC_NPROCESSORS_ONLN);
+	if (jobs <= 0)
+	    jobs = 1;
+    }
+
+    memset (pool, 0, sizeof *pool);
+    pool->ok = 1;
+    pool->finder = finder_new (0);
+    finder_preload (pool->finder);
+    pool->window = jobs * FIND_WINDOW_PER_JOB;
+    pool->slots = xcalloc (pool->window, sizeof *pool->slots);
+    pthread_mutex_init (&pool->lock, NULL);
+    pthread_cond_init (&pool->work, NULL);
+    pthread_cond_init (&pool->done, NULL);
+
+    pool->workers = xcalloc (jobs, sizeof *pool->workers);
+    for (pool->started = 0; pool->started < jobs; ++pool->started) {
+	int err = pthread_create (&pool->workers[pool->started], NULL,
+				  find_worker, pool);
+
+	if (err) {
+	    errno = err;
+	    if (!pool->started)
+		quit_err ("unable to start worker thread");
+	    warning_err ("unable to start more than %ld worker threads",
+			 pool->started);
+	    break;
+	}
+    }
+}
+
+/* Queue path for the workers, writing out any results that are ready. */
+static void find_pool_add (struct find_pool *pool, const char *path,
+			   size_t len)
+{
+    struct find_slot *slot;
+
+    pthread_mutex_lock (&pool->lock);
+    if (!find_flush (pool, pool->filled - pool->written == pool->window))
+	pool->ok = 0;
+    slot = &pool->slots[pool->filled++ % pool->window];
+    slot->path = xstrndup (path, len);
+    pthread_cond_signal (&pool->work);
+    pthread_mutex_unlock (&pool->lock);
+}
+
+/* Write out the remaining results and stop the workers.  Returns zero if
+ * any path failed.
+ */
+static int find_pool_finish (struct find_pool *pool)
+{
+    long i;
+    int ret;
+
+    pthread_mutex_lock (&pool->lock);
+    pool->eof = true;
+    pthread_cond_broadcast (&pool->work);
+    while (pool->written < pool->filled)
+	if (!find_flush (pool, true))
+	    pool->ok = 0;
+    pthread_mutex_unlock (&pool->lock);
+
+    for (i = 0; i < pool->started; ++i)
+	pthread_join (pool->workers[i], NULL);
+    free (pool->workers);
+    pthread_cond_destroy (&pool->done);
+    pthread_cond_destroy (&pool->work);
+    pthread_mutex_destroy (&pool->lock);
+    free (pool->slots);
+    finder_free (pool->finder);
+    ret = pool->ok;
+
+    if (fflush (stdout) == EOF) {
+	warning_err ("unable to write to standard output");
+	ret = 0;
+    }
+    return ret;
+}
+
+/* Find the interpreters for each path on standard input, loading the
+ * format database only once and sharing the files out among worker
+ * threads.
+ */
+static int act_find_many (void)
+{
+    struct find_pool pool;
+    char *line = NULL;
+    size_t size = 0;
+    ssize_t len;
+    int delim = null_separated ? '\0' : '\n';
+
+    find_pool_start (&pool);
+    while ((len = getdelim (&line, &size, delim, stdin)) != -1) {
+	if (len && line[len - 1] == delim)
+	    line[--len] = '\0';
+	if (len)
+	    find_pool_add (&pool, line, len);
+    }
+    if (ferror (stdin)) {
+	warning_err ("unable to read paths from standard input");
+	pool.ok = 0;
+    }
+    free (line);
+    return find_pool_finish (&pool);
+}
+
+/* nftw has no way to pass data to its callback. */
+static struct find_pool *tree_pool;
+
+static int find_tree_visit (const char *path, const struct stat *st,
+			    int flag, struct FTW *ftw)
+{
+    (void) ftw;
+    switch (flag) {
+	case FTW_F:
+	    if (S_ISREG (st->st_mode) && (st->st_mode & 0111))
+		find_pool_add (tree_pool, path, strlen (path));
+	    break;
+	case FTW_DNR:
+	case FTW_NS:
+	    warning ("unable to examine %s", path);
+	    tree_pool->ok = 0;
+	    break;
+	default:
+	    break;
+    }
+    return 0;
+}
+
+/* Find the interpreters for every regular executable file under dir, in
+ * the same way as act_find_many.  Symbolic links are not followed.
+ */
+static int act_find_tree (const char *dir)
+{
+    struct find_pool pool;
+
+    find_pool_start (&pool);
+    tree_pool = &pool;
+    if (nftw (dir, find_tree_visit, 64, FTW_PHYS) == -1) {
+	warning_err ("unable to walk %s", dir);
+	pool.ok = 0;
+    }
+    tree_pool = NULL;
+    return find_pool_finish (&pool);
+}
+
+/* Report the formats that each executable member of a tar archive matches,
+ * reading the archive once from start to finish without extracting it.
+ * Only the start of each member is examined, so formats are reported by
+ * magic and extension alone.
+ */
+static int act_find_tar (const char *archive)
+{
+    struct finder *finder;
+    struct tar *tar;
+    struct tar_member member;
+    char terminator = null_separated ? '\0' : '\n';
+    size_t toread;
+    char *header;
+    int fd, r, ret = 1;
+
+    if (archive) {
+	fd = open (archive, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+	    quit_err ("unable to open %s", archive);
+    } else {
+	/* tar_close closes this along with the archive. */
+	fd = dup (STDIN_FILENO);
+	if (fd < 0)
+	    quit_err ("unable to read standard input");
+    }
+
+    finder = finder_new (0);
+    toread = finder_toread (finder);
+    header = xmalloc (toread);
+    tar = tar_open (fd);
+    while ((r = tar_next (tar, &member)) > 0) {
+	gl_list_t formats;
+	gl_list_iterator_t format_iter;
+	const struct binfmt *binfmt;
+	ssize_t got;
+
+	if (!member.regular || !(member.mode & 0111))
+	    continue;
+	memset (header, 0, toread);
+	got = tar_read (tar, header, toread);
+	if (got < 0)
+	    break;
+	formats = finder_match (finder, member.name, header);
+	fputs (member.name, stdout);
+	format_iter = gl_list_iterator (formats);
+	while (gl_list_iterator_next (&format_iter, (const void **) &binfmt,
+				      NULL))
+	    printf ("\t%s", binfmt->interpreter);
+	gl_list_iterator_free (&format_iter);
+	gl_list_free (formats);
+	putchar (terminator);
+    }
+    if (r)
+	ret = 0;
+    if (!tar_close (tar))
+	ret = 0;
+    free (header);
+    finder_free (finder);
+
+    if (fflush (stdout) == EOF) {
+	warning_err ("unable to write to standard output");
+	ret = 0;
+    }
+    return ret;
+}
+
+struct timing {
+    const char *name;
+    uint32_t usec;
+    int accepted;
+};
+
+static int compare_timing (const void *left, const void *right)
+{
+    const struct timing *l = left, *r = right;
+    int cmp = strcmp (l->name, r->name);
+
+    if (cmp)
+	return cmp;
+    if (l->usec != r->usec)
+	return (l->usec < r->usec) ? -1 : 1;
+    return 0;
+}
+
+/* Return the p'th percentile of n sorted timings, by nearest rank. */
+static uint32_t percentile (const struct timing *timings, size_t n, int p)
+{
+    return timings[(n * p + 99) / 100 - 1].usec;
+}
+
+/* Print a line for each run of timings with the same name, after sorting
+ * them.  If accepted is set, also count how many were accepted.
+ */
+static void print_timings (struct timing *timings, size_t n, int accepted)
+{
+    size_t start, end, i;
+
+    qsort (timings, n, sizeof *timings, compare_timing);
+    for (start = 0; start < n; start = end) {
+	size_t count = 0;
+
+	for (end = start; end < n; ++end)
+	    if (strcmp (timings[end].name, timings[start].name))
+		break;
+	printf ("%-24s %7zu %8lu %8lu %8lu %8lu",
+		timings[start].name, end - start,
+		(unsigned long) percentile (timings + start, end - start, 50),
+		(unsigned long) percentile (timings + start, end - start, 90),
+		(unsigned long) percentile (timings + start, end - start, 99),
+		(unsigned long) timings[end - 1].usec);
+	if (accepted) {
+	    for (i = start; i < end; ++i)
+		count += timings[i].accepted;
+	    printf (" %8zu", count);
+	}
+	putchar ('\n');
+    }
+}
+
+static int act_trace_summary (void)
+{
+    struct trace_record *records;
+    struct timing *timings;
+    size_t n, n_timings, i, j;
+
+    records = trace_load (&n);
+    if (!n) {
+	warning ("no run-detectors traces found in %s", rundir);
+	free (records);
+	return 1;
+    }
+    timings = XNMALLOC (n * (TRACE_PHASES + 1 + TRACE_DETECTORS),
+			struct timing);
+
+    /* Phases are listed in the order they happen, whatever their names. */
+    printf ("%-24s %7s %8s %8s %8s %8s\n",
+	    "phase", "runs", "p50", "p90", "p99", "max");
+    for (j = 0; j <= TRACE_PHASES; ++j) {
+	const char *label = j < TRACE_PHASES ? trace_phase_name (j) : "total";
+
+	n_timings = 0;
+	for (i = 0; i < n; ++i) {
+	    if (j < TRACE_PHASES && !(records[i].phases & (1U << j)))
+		continue;
+	    timings[n_timings].name = label;
+	    timings[n_timings].usec = j < TRACE_PHASES ? records[i].usec[j]
+						       : records[i].total;
+	    ++n_timings;
+	}
+	print_timings (timings, n_timings, 0);
+    }
+
+    printf ("\n%-24s %7s %8s %8s %8s %8s\n",
+	    "format", "runs", "p50", "p90", "p99", "max");
+    for (i = 0; i < n; ++i) {
+	timings[i].name = *records[i].format ? records[i].format : "(none)";
+	timings[i].usec = records[i].total;
+    }
+    print_timings (timings, n, 0);
+
+    n_timings = 0;
+    for (i = 0; i < n; ++i) {
+	for (j = 0; j < records[i].detectors; ++j) {
+	    const struct trace_detector *detector = &records[i].detector[j];
+
+	    timings[n_timings].name = detector->format;
+	    timings[n_timings].usec = detector->usec;
+	    timings[n_timings].accepted = detector->status == 0;
+	    ++n_timings;
+	}
+    }
+    if (n_timings) {
+	printf ("\n%-24s %7s %8s %8s %8s %8s %8s\n",
+		"detector", "runs", "p50", "p90", "p99", "max", "accepted");
+	print_timings (timings, n_timings, 1);
+    }
+
+    free (timings);
+    free (records);
+    if (fflush (stdout) == EOF) {
+	warning_err ("unable to write to standard output");
+	return 0;
+    }
+    return 1;
+}
+
 const char *argp_program_version = "binfmt-support " PACKAGE_VERSION;
 const char *argp_program_bug_address = PACKAGE_BUGREPORT;
 
@@ -822,18 +2252,33 @@ enum opts {
     OPT_ENABLE,
     OPT_DISABLE,
     OPT_FIND,
+    OPT_FIND_TREE,
+    OPT_FIND_TAR,
+    OPT_REORDER,
+    OPT_RECONCILE,
+    OPT_BATCH,
+    OPT_TRACE_SUMMARY,
     OPT_MAGIC,
     OPT_MASK,
     OPT_OFFSET,
     OPT_EXTENSION,
     OPT_DETECTOR,
+    OPT_RULE,
     OPT_CREDENTIALS,
     OPT_PRESERVE,
+    OPT_OPEN_BINARY,
+    OPT_FIX_BINARY,
+    OPT_PRIORITY,
     OPT_PACKAGE,
     OPT_ADMINDIR,
     OPT_IMPORTDIR,
     OPT_PROCDIR,
-    OPT_TEST
+    OPT_RUNDIR,
+    OPT_TEST,
+    OPT_CONSOLIDATE,
+    OPT_FROM_PLAN,
+    OPT_JOBS,
+    OPT_NULL
 };
 
 static struct argp_option options[] = {
@@ -855,6 +2300,20 @@ static struct argp_option options[] = {
 	"disable binary format in kernel" },
     { "find",		OPT_FIND,	0,		OPTION_HIDDEN,
 	"find list of interpreters for an executable" },
+    { "find-tree",	OPT_FIND_TREE,	0,		OPTION_HIDDEN,
+	"find interpreters for every executable in a directory tree" },
+    { "find-tar",	OPT_FIND_TAR,	0,
+	OPTION_ARG_OPTIONAL | OPTION_HIDDEN,
+	"find formats for every executable in a tar archive" },
+    { "reorder",	OPT_REORDER,	0,		OPTION_HIDDEN,
+	"re-register enabled binary formats in priority order" },
+    { "reconcile",	OPT_RECONCILE,	0,		OPTION_HIDDEN,
+	"change only those kernel entries that differ from the database" },
+    { "batch",		OPT_BATCH,	0,
+	OPTION_ARG_OPTIONAL | OPTION_HIDDEN,
+	"apply a file of commands as one transaction" },
+    { "trace-summary",	OPT_TRACE_SUMMARY, 0,		OPTION_HIDDEN,
+	"summarize the timings traced by run-detectors" },
     { "magic",		OPT_MAGIC,	"BYTE-SEQUENCE",
 	OPTION_HIDDEN,
 	"match files starting with this byte sequence" },
@@ -867,25 +2326,46 @@ static struct argp_option options[] = {
 	"match files whose names end in .EXTENSION" },
     { "detector",	OPT_DETECTOR,	"PATH",		OPTION_HIDDEN,
 	"use this userspace detector program" },
+    { "rule",		OPT_RULE,	"RULE",		OPTION_HIDDEN,
+	"only match files satisfying this rule" },
     { "credentials",	OPT_CREDENTIALS, "YES/NO",	OPTION_HIDDEN,
 	"use credentials of original binary for interpreter (yes/no)" },
     { "preserve",	OPT_PRESERVE, "YES/NO",	OPTION_HIDDEN,
 	"preserve argv[0] of original binary for interpreter (yes/no)" },
+    { "open-binary",	OPT_OPEN_BINARY, "YES/NO", OPTION_HIDDEN,
+	"pass an open file descriptor for the binary to interpreter (yes/no)" },
+    { "fix-binary",	OPT_FIX_BINARY,	"YES/NO",	OPTION_HIDDEN,
+	"open interpreter once when the format is enabled (yes/no)" },
+    { "priority",	OPT_PRIORITY,	"NUMBER",	OPTION_HIDDEN,
+	"have the kernel try formats with higher priorities first" },
     { "package",	OPT_PACKAGE,	"PACKAGE-NAME",	0,
 	"for --install and --remove, specify the current package name", 1 },
     { "admindir",	OPT_ADMINDIR,	"DIRECTORY",	0,
 	"administration directory (default: " ADMINDIR ")", 2 },
     { "importdir",	OPT_IMPORTDIR,	"DIRECTORY",	0,
 	"import directory (default: " IMPORTDIR ")", 3 },
+    { "rundir",		OPT_RUNDIR,	"DIRECTORY",	0,
+	"runtime directory (default: " RUNDIR ")", 4 },
     { "procdir",	OPT_PROCDIR,	"DIRECTORY",	OPTION_HIDDEN,
 	"proc directory, for test suite use only "
 	"(default: " PROCDIR ")", 5 },
     { "test",		OPT_TEST,	0,		0,
 	"don't do anything, just demonstrate", 6 },
+    { "consolidate",	OPT_CONSOLIDATE, 0,		0,
+	"with --enable, let formats share kernel entries where possible", 6 },
+    { "from-plan",	OPT_FROM_PLAN,	0,		0,
+	"with --enable, register formats as planned when the database last "
+	"changed", 6 },
+    { "jobs",		OPT_JOBS,	"NUMBER",	0,
+	"with --find-tree or --find and no <path>, examine this many files "
+	"at once (default: number of processors)", 6 },
+    { "null",		OPT_NULL,	0,		0,
+	"with --find-tree, --find-tar, or --find and no <path>, separate "
+	"paths and results with NUL rather than newline", 6 },
     { 0 }
 };
 
-const char *package, *name, *executable;
+const char *package, *name, *executable, *directory, *archive;
 static enum opts mode, type;
 
 static struct {
@@ -895,8 +2375,12 @@ static struct {
     const char *extension;
     const char *interpreter;
     const char *detector;
+    const char *rule;
     const char *credentials;
     const char *preserve;
+    const char *open_binary;
+    const char *fix_binary;
+    const char *priority;
 } spec;
 
 static const char *mode_name (enum opts m)
@@ -909,6 +2393,12 @@ static const char *mode_name (enum opts m)
 	case OPT_ENABLE:	return "enable";
 	case OPT_DISABLE:	return "disable";
 	case OPT_FIND:		return "find";
+	case OPT_FIND_TREE:	return "find-tree";
+	case OPT_FIND_TAR:	return "find-tar";
+	case OPT_REORDER:	return "reorder";
+	case OPT_RECONCILE:	return "reconcile";
+	case OPT_BATCH:		return "batch";
+	case OPT_TRACE_SUMMARY:	return "trace-summary";
 	default:		return "";
     }
 }
@@ -922,8 +2412,39 @@ static const char *type_name (enum opts t)
     }
 }
 
+/* Set while parsing a command read by --batch. */
+static bool batch_parsing = false;
+
 static error_t parse_opt (int key, char *arg, struct argp_state *state)
 {
+    if (batch_parsing) {
+	switch (key) {
+	    case OPT_DISPLAY:
+	    case OPT_FIND:
+	    case OPT_FIND_TREE:
+	    case OPT_FIND_TAR:
+	    case OPT_REORDER:
+	    case OPT_RECONCILE:
+	    case OPT_BATCH:
+	    case OPT_TRACE_SUMMARY:
+	    case OPT_ADMINDIR:
+	    case OPT_IMPORTDIR:
+	    case OPT_RUNDIR:
+	    case OPT_PROCDIR:
+	    case OPT_TEST:
+	    case OPT_CONSOLIDATE:
+	    case OPT_FROM_PLAN:
+	    case OPT_JOBS:
+	    case OPT_NULL:
+		argp_error (state,
+			    "batch commands may only use --install, --remove, "
+			    "--import, --enable, --disable, --package, and "
+			    "<spec> options");
+	    default:
+		break;
+	}
+    }
+
     /* Mode/type processing. */
     switch (key) {
 	case OPT_INSTALL:
@@ -933,6 +2454,12 @@ static error_t parse_opt (int key, char *arg, struct argp_state *state)
 	case OPT_ENABLE:
 	case OPT_DISABLE:
 	case OPT_FIND:
+	case OPT_FIND_TREE:
+	case OPT_FIND_TAR:
+	case OPT_REORDER:
+	case OPT_RECONCILE:
+	case OPT_BATCH:
+	case OPT_TRACE_SUMMARY:
 	    if (mode)
 		argp_error (state, "two modes given: --%s and --%s",
 			    mode_name (mode), mode_name (key));
@@ -971,14 +2498,30 @@ static error_t parse_opt (int key, char *arg, struct argp_state *state)
 	case OPT_DISPLAY:
 	case OPT_ENABLE:
 	case OPT_DISABLE:
+	case OPT_BATCH:
 	    if (state->next < state->argc)
 		name = state->argv[state->next++];
 	    return 0;
 
 	case OPT_FIND:
+	    if (state->next < state->argc)
+		executable = state->argv[state->next++];
+	    return 0;
+
+	case OPT_FIND_TREE:
 	    if (state->next >= state->argc)
-		argp_error (state, "--find needs <path>");
-	    executable = state->argv[state->next++];
+		argp_error (state, "--find-tree needs <directory>");
+	    directory = state->argv[state->next++];
+	    return 0;
+
+	case OPT_FIND_TAR:
+	    if (state->next < state->argc)
+		archive = state->argv[state->next++];
+	    return 0;
+
+	case OPT_REORDER:
+	case OPT_RECONCILE:
+	case OPT_TRACE_SUMMARY:
 	    return 0;
 
 	case OPT_MAGIC:
@@ -1012,11 +2555,34 @@ static error_t parse_opt (int key, char *arg, struct argp_state *state)
 	    if (spec.detector)
 		argp_error (state, "more than one --detector option given");
 	    spec.detector = arg;
-	    if (access (spec.detector, X_OK))
+	    if (builtin_name (spec.detector)) {
+		const char *message;
+		if (!builtin_valid (builtin_name (spec.detector), &message))
+		    argp_failure (state, argp_err_exit_status, 0,
+				  "invalid detector '%s': %s",
+				  spec.detector, message);
+	    } else if (plugin_path (spec.detector)) {
+		if (access (plugin_path (spec.detector), R_OK))
+		    warning ("no detector plugin %s found, but continuing "
+			     "anyway as you request",
+			     plugin_path (spec.detector));
+	    } else if (access (spec.detector, X_OK))
 		warning ("no executable %s found, but continuing anyway as "
 			 "you request", spec.detector);
 	    return 0;
 
+	case OPT_RULE:
+	    if (spec.rule)
+		argp_error (state, "more than one --rule option given");
+	    spec.rule = arg;
+	    {
+		const char *message;
+		if (!rule_valid (spec.rule, &message))
+		    argp_failure (state, argp_err_exit_status, 0,
+				  "invalid rule '%s': %s", spec.rule, message);
+	    }
+	    return 0;
+
 	case OPT_CREDENTIALS:
 	    spec.credentials = arg;
 	    return 0;
@@ -1025,6 +2591,21 @@ static error_t parse_opt (int key, char *arg, struct argp_state *state)
 	    spec.preserve = arg;
 	    return 0;
 
+	case OPT_OPEN_BINARY:
+	    spec.open_binary = arg;
+	    return 0;
+
+	case OPT_FIX_BINARY:
+	    spec.fix_binary = arg;
+	    return 0;
+
+	case OPT_PRIORITY:
+	    if (!priority_valid (arg))
+		argp_failure (state, argp_err_exit_status, 0,
+			      "invalid priority '%s'", arg);
+	    spec.priority = arg;
+	    return 0;
+
 	case OPT_PACKAGE:
 	    if (package)
 		argp_error (state, "more than one --package option given");
@@ -1039,6 +2620,10 @@ static error_t parse_opt (int key, char *arg, struct argp_state *state)
 	    importdir = arg;
 	    return 0;
 
+	case OPT_RUNDIR:
+	    rundir = arg;
+	    return 0;
+
 	case OPT_PROCDIR:
 	    procdir = arg;
 	    return 0;
@@ -1047,20 +2632,62 @@ static error_t parse_opt (int key, char *arg, struct argp_state *state)
 	    test = 1;
 	    return 0;
 
+	case OPT_CONSOLIDATE:
+	    consolidate = 1;
+	    return 0;
+
+	case OPT_FROM_PLAN:
+	    from_plan = 1;
+	    return 0;
+
+	case OPT_JOBS:
+	    {
+		char *end;
+
+		errno = 0;
+		jobs = strtol (arg, &end, 10);
+		if (errno || *end || end == arg || jobs <= 0 || jobs > 1024)
+		    argp_failure (state, argp_err_exit_status, 0,
+				  "invalid number of jobs '%s'", arg);
+	    }
+	    return 0;
+
+	case OPT_NULL:
+	    null_separated = 1;
+	    return 0;
+
 	case ARGP_KEY_SUCCESS:
 	    if (!mode)
 		argp_error (state,
 			    "you must use one of --install, --remove, "
 			    "--import, --display, --enable, --disable, "
-			    "--find");
+			    "--find, --find-tree, --find-tar, --reorder, "
+			    "--reconcile, --batch, --trace-summary");
 	    else if (mode == OPT_INSTALL) {
 		if (!type)
 		    argp_error (state, "--install requires a <spec> option");
-		if (!strcmp (name, ".") || !strcmp (name, "..") ||
+		if (name[0] == '.' ||
 		    !strcmp (name, "register") || !strcmp (name, "status"))
 		    argp_failure (state, argp_err_exit_status, 0,
 				  "binary format name '%s' is reserved", name);
-	    }
+	    } else if (consolidate && (mode != OPT_ENABLE || name))
+		argp_error (state,
+			    "--consolidate only works with --enable for all "
+			    "formats");
+	    else if (from_plan && (mode != OPT_ENABLE || name || consolidate))
+		argp_error (state,
+			    "--from-plan only works with --enable for all "
+			    "formats, without --consolidate");
+	    else if (jobs && mode != OPT_FIND_TREE &&
+		     (mode != OPT_FIND || executable))
+		argp_error (state,
+			    "--jobs only works with --find-tree, or with "
+			    "--find and no <path>");
+	    else if (null_separated && mode != OPT_FIND_TREE &&
+		     mode != OPT_FIND_TAR && (mode != OPT_FIND || executable))
+		argp_error (state,
+			    "--null only works with --find-tree, --find-tar, "
+			    "or --find and no <path>");
 	    return 0;
     }
 
@@ -1074,8 +2701,17 @@ static struct argp argp = {
     "--import [<name>]\n"
     "--display [<name>]\n"
     "--enable [<name>]\n"
+    "--consolidate --enable\n"
+    "--from-plan --enable\n"
     "--disable [<name>]\n"
-    "--find <path>",
+    "--find <path>\n"
+    "[--jobs <number>] [--null] --find\n"
+    "[--jobs <number>] [--null] --find-tree <directory>\n"
+    "[--null] --find-tar [<archive>]\n"
+    "--reorder\n"
+    "--reconcile\n"
+    "--batch [<file>]\n"
+    "--trace-summary",
     "\n"
     "where <spec> is one of\n"
     "\n"
@@ -1083,10 +2719,12 @@ static struct argp argp = {
 	"[--offset <offset>]\n"
     "      --extension <extension>\n"
     "\n"
-    "The following argument may be added to any <spec> to have a userspace "
-    "process determine whether the file should be handled:\n"
+    "The following arguments may be added to any <spec> to check further "
+    "whether the file should be handled, by a userspace process or by "
+    "testing fields of the file:\n"
     "\n"
     "      --detector <path>\n"
+    "      --rule <rule>\n"
     "\n"
     "Options:"
     "\v"
@@ -1096,11 +2734,214 @@ static struct argp argp = {
     "later for copying conditions."
 };
 
+/* Make the format described by the <spec> options for --install. */
+static struct binfmt *spec_binfmt (void)
+{
+    struct binfmt *binfmt;
+    Hash_table *format_args;
+
+    format_args = kvhash_initialize (8, NULL, free);
+    kvhash_insert (format_args, "package", package);
+    kvhash_insert (format_args, "type",
+		   (type == OPT_MAGIC) ? "magic" : "extension");
+#define ADD_SPEC(field) do { \
+    if (spec.field) \
+	kvhash_insert (format_args, #field, spec.field); \
+} while (0)
+    ADD_SPEC (magic);
+    ADD_SPEC (mask);
+    ADD_SPEC (offset);
+    ADD_SPEC (extension);
+    ADD_SPEC (interpreter);
+    ADD_SPEC (detector);
+    ADD_SPEC (rule);
+    ADD_SPEC (credentials);
+    ADD_SPEC (preserve);
+    ADD_SPEC (priority);
+#undef ADD_SPEC
+    if (spec.open_binary)
+	kvhash_insert (format_args, "open-binary", spec.open_binary);
+    if (spec.fix_binary)
+	kvhash_insert (format_args, "fix-binary", spec.fix_binary);
+    binfmt = binfmt_new (name, format_args);
+    hash_free (format_args);
+    return binfmt;
+}
+
+/* Split line into words at whitespace, in place.  Single or double quotes
+ * group words containing whitespace; nothing else is special, so that
+ * escapes in byte sequences need no further quoting.  A word starting with
+ * '#' starts a comment.  argv[0] is the program name.
+ */
+static char **batch_split (char *line, int *argc)
+{
+    char **argv = XNMALLOC (strlen (line) / 2 + 3, char *);
+    char *in = line, *out;
+
+    *argc = 0;
+    argv[(*argc)++] = program_name;
+    for (;;) {
+	while (isspace ((unsigned char) *in))
+	    ++in;
+	if (!*in || *in == '#')
+	    break;
+	argv[(*argc)++] = out = in;
+	while (*in && !isspace ((unsigned char) *in)) {
+	    if (*in == '\'' || *in == '"') {
+		char quote = *in++;
+
+		while (*in && *in != quote)
+		    *out++ = *in++;
+		if (*in)
+		    ++in;
+	    } else
+		*out++ = *in++;
+	}
+	if (*in)
+	    ++in;
+	*out = '\0';
+    }
+    argv[*argc] = NULL;
+    return argv;
+}
+
+struct batch_command {
+    enum opts mode;
+    const char *name;
+    const char *package;
+    struct binfmt *binfmt;
+};
+
+/* Read commands from file (or standard input), one per line with the same
+ * options as on the command line, and apply them as one transaction.
+ * Every command is checked before any is run, and the database and kernel
+ * are only changed once all of them have succeeded.
+ */
+static int act_batch (const char *file)
+{
+    FILE *input;
+    gl_list_t lines, commands;
+    gl_list_iterator_t iter;
+    struct batch_command *command;
+    char *line;
+    size_t n;
+    enum opts batch_mode = mode;
+    int worked = 1;
+
+    if (!file || !strcmp (file, "-"))
+	input = stdin;
+    else {
+	input = fopen (file, "r");
+	if (!input) {
+	    warning_err ("unable to open %s", file);
+	    return 0;
+	}
+    }
+
+    lines = gl_list_create_empty (GL_ARRAY_LIST, NULL, NULL, NULL, true);
+    commands = gl_list_create_empty (GL_ARRAY_LIST, NULL, NULL, NULL, true);
+    batch_parsing = true;
+    for (line = NULL, n = 0; getline (&line, &n, input) != -1;
+	 line = NULL, n = 0) {
+	char **argv;
+	int argc;
+
+	gl_list_add_last (lines, line);
+	argv = batch_split (line, &argc);
+	if (argc == 1) {
+	    free (argv);
+	    continue;
+	}
+	mode = type = 0;
+	name = executable = package = NULL;
+	memset (&spec, 0, sizeof spec);
+	if (argp_parse (&argp, argc, argv, ARGP_NO_HELP, 0, 0))
+	    exit (argp_err_exit_status);
+	free (argv);
+
+	command = XZALLOC (struct batch_command);
+	command->mode = mode;
+	command->name = name;
+	command->package = package ? package : ":";
+	if (mode == OPT_INSTALL) {
+	    package = command->package;
+	    command->binfmt = spec_binfmt ();
+	    if (!command->binfmt)
+		worked = 0;
+	}
+	gl_list_add_last (commands, command);
+    }
+    free (line);
+    batch_parsing = false;
+    mode = batch_mode;
+    if (input != stdin)
+	fclose (input);
+
+    if (worked) {
+	batch_admin = kvhash_initialize (16, NULL, kvhash_free_key);
+	batch_kernel = kvhash_initialize (16, NULL, kvhash_free_key);
+	iter = gl_list_iterator (commands);
+	while (worked && gl_list_iterator_next (&iter, (const void **) &command,
+						NULL)) {
+	    if (command->mode == OPT_INSTALL) {
+		worked = act_install (command->name, command->binfmt);
+		command->binfmt = NULL;
+	    } else if (command->mode == OPT_REMOVE)
+		worked = act_remove (command->name, command->package);
+	    else if (command->mode == OPT_IMPORT)
+		worked = act_import (command->name);
+	    else if (command->mode == OPT_ENABLE)
+		worked = act_enable (command->name);
+	    else if (command->mode == OPT_DISABLE)
+		worked = act_disable (command->name);
+	}
+	gl_list_iterator_free (&iter);
+	if (worked)
+	    worked = batch_commit ();
+	else {
+	    warning ("batch abandoned; nothing was changed");
+	    hash_free (batch_admin);
+	    hash_free (batch_kernel);
+	    batch_admin = batch_kernel = NULL;
+	}
+    }
+
+    iter = gl_list_iterator (commands);
+    while (gl_list_iterator_next (&iter, (const void **) &command, NULL))
+	free (command);
+    gl_list_iterator_free (&iter);
+    gl_list_free (commands);
+    iter = gl_list_iterator (lines);
+    while (gl_list_iterator_next (&iter, (const void **) &line, NULL))
+	free (line);
+    gl_list_iterator_free (&iter);
+    gl_list_free (lines);
+    return worked;
+}
+
+/* Keep other instances of update-binfmts from changing the database or
+ * the kernel until this one exits.
+ */
+static void lock_admindir (void)
+{
+    int fd = open (admindir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+    if (fd < 0) {
+	if (errno == ENOENT)
+	    return;
+	quit_err ("unable to open %s", admindir);
+    }
+    while (flock (fd, LOCK_EX) == -1)
+	if (errno != EINTR)
+	    quit_err ("unable to lock %s", admindir);
+}
+
 int main (int argc, char **argv)
 {
     int status = 0;
 
     program_name = xstrdup ("update-binfmts");
+    error_prefix = program_name;
 
     check_supported_os ();
 
@@ -1117,31 +2958,18 @@ int main (int argc, char **argv)
 
     formats = kvhash_initialize (16, NULL, binfmt_hash_free);
 
-    if (mode == OPT_INSTALL) {
-	struct binfmt *binfmt;
-	Hash_table *format_args;
-
-	format_args = kvhash_initialize (8, NULL, free);
-	kvhash_insert (format_args, "package", package);
-	kvhash_insert (format_args, "type",
-		       (type == OPT_MAGIC) ? "magic" : "extension");
-#define ADD_SPEC(field) do { \
-    if (spec.field) \
-	kvhash_insert (format_args, #field, spec.field); \
-} while (0)
-	ADD_SPEC (magic);
-	ADD_SPEC (mask);
-	ADD_SPEC (offset);
-	ADD_SPEC (extension);
-	ADD_SPEC (interpreter);
-	ADD_SPEC (detector);
-	ADD_SPEC (credentials);
-	ADD_SPEC (preserve);
-#undef ADD_SPEC
-	binfmt = binfmt_new (name, format_args);
-
-	status = act_install (name, binfmt);
-    } else if (mode == OPT_REMOVE)
+    if (!test && mode != OPT_DISPLAY && mode != OPT_FIND &&
+	mode != OPT_FIND_TREE && mode != OPT_FIND_TAR &&
+	mode != OPT_TRACE_SUMMARY)
+	lock_admindir ();
+    /* Readers keep using the current index until the new one is in place. */
+    if (!test && (mode == OPT_INSTALL || mode == OPT_REMOVE ||
+		  mode == OPT_IMPORT || mode == OPT_BATCH))
+	index_begin_update ();
+
+    if (mode == OPT_INSTALL)
+	status = act_install (name, spec_binfmt ());
+    else if (mode == OPT_REMOVE)
 	status = act_remove (name, package);
     else if (mode == OPT_IMPORT)
 	status = act_import (name);
@@ -1152,7 +2980,31 @@ int main (int argc, char **argv)
     else if (mode == OPT_DISABLE)
 	status = act_disable (name);
     else if (mode == OPT_FIND)
-	status = act_find (executable);
+	status = executable ? act_find (executable) : act_find_many ();
+    else if (mode == OPT_FIND_TREE)
+	status = act_find_tree (directory);
+    else if (mode == OPT_FIND_TAR)
+	status = act_find_tar (archive);
+    else if (mode == OPT_REORDER)
+	status = act_reorder ();
+    else if (mode == OPT_RECONCILE)
+	status = act_reconcile ();
+    else if (mode == OPT_BATCH)
+	status = act_batch (name);
+    else if (mode == OPT_TRACE_SUMMARY)
+	status = act_trace_summary ();
+    if (!register_close ())
+	status = 0;
+
+    /* Even if the action failed, it may have changed the database.  Only
+     * a replayed plan leaves the index as it was.
+     */
+    if (from_plan)
+	cache_create_dir ();
+    else if (mode == OPT_INSTALL || mode == OPT_REMOVE ||
+	     mode == OPT_IMPORT || mode == OPT_ENABLE || mode == OPT_DISABLE ||
+	     mode == OPT_BATCH)
+	update_index ();
 
     if (status)
 	return 0;